@@ -1,19 +1,322 @@
 #include "header.h"
 
+#include <stdlib.h>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
 #include "NES.h"
 
-bool NES::init(char* romPath) {
+NES::NES() {
+	mapper = NULL;
+	hugePages = false;
+	apu.arena = &arena;
+}
+
+static void* allocateAligned(size_t size) {
+	void* pointer;
+#ifdef _WIN32
+	pointer = _aligned_malloc(size, CACHE_LINE_SIZE);
+#else
+	if(posix_memalign(&pointer, CACHE_LINE_SIZE, size) != 0) pointer = NULL;
+#endif
+	if(pointer == NULL) throw std::bad_alloc();
+	return pointer;
+}
+
+static void freeAligned(void* pointer) {
+#ifdef _WIN32
+	_aligned_free(pointer);
+#else
+	free(pointer);
+#endif
+}
+
+void* NES::operator new(size_t size) { return allocateAligned(size); }
+void* NES::operator new[](size_t size) { return allocateAligned(size); }
+void NES::operator delete(void* pointer) { freeAligned(pointer); }
+void NES::operator delete[](void* pointer) { freeAligned(pointer); }
+
+NES::~NES() {
+	if(mapper != NULL) mapper->~NES_MAPPER();
+}
+
+bool NES::init(const char* romPath) {
 	if(!rom.loadRom(romPath)) return false;
-	cpu.init(&rom);
+	return attachRom();
+}
+
+bool NES::init(const uint8_t* image, size_t size) {
+	if(!rom.loadImage(image, size)) return false;
+	return attachRom();
+}
+
+bool NES::init(const NES_ROM& source) {
+	if(!rom.loadShared(source)) return false;
+	return attachRom();
+}
+
+bool NES::attachRom() { //Builds the rest of the console around the loaded rom
+	//Everything in the arena goes at once, audio is set up again with the host's settings afterwards
+	uint32_t sampleRate = apu.muted ? apu.mutedRate : apu.sampleRate;
+	uint32_t ringSamples = apu.ringMask + 1;
+	apu.releaseOutput();
+
+	if(mapper != NULL) mapper->~NES_MAPPER();
+	mapper = NULL;
+
+	size_t audioSize = ARENA_AUDIO_SAMPLES * sizeof(int16_t) + (BLIP_BUFFER_SIZE + BLIP_TAPS) * sizeof(int32_t);
+	if(!arena.reserve(NES_MAPPER::arenaSize(&rom) + audioSize, hugePages)) return false;
+
+	mapper = NES_MAPPER::create(&rom, arena);
+	if(mapper == NULL) return false;
+
+	bus.init();
+	cpu.init(&rom, &bus, mapper);
+	ppu.init(&cpu, &bus, mapper);
+	apu.init(&cpu, &bus);
+	bus.mapIO(0x4000, 0x47ff, ioRead, ioWrite, this);
+
+	if(sampleRate != 0 && !apu.setOutput(sampleRate, ringSamples)) return false;
+
+	frame = 0;
+
+	buttons[0] = 0;
+	buttons[1] = 0;
+	controllerShift[0] = 0;
+	controllerShift[1] = 0;
+	controllerStrobe = false;
 
 	return true;
 }
 
-bool NES::run() {
+bool NES::run() { //Runs a single instruction
 	uint8_t cycles = cpu.runOp();
+#if CPU_DEBUG
 	printf("CPU ran for %i cycles\n", cycles);
+#endif
 	if(cycles < 1) return false;
-	else return true;
+
+	catchUpDevices();
+	if(ppu.frameComplete) endFrame();
+	return true;
+}
+
+uint64_t NES::nextEventCycle() { //The next cycle at which the PPU or APU has to run on its own
+	uint64_t eventCycle = ppu.nextEventCycle();
+	uint64_t apuEventCycle = apu.nextEventCycle();
+	return apuEventCycle < eventCycle ? apuEventCycle : eventCycle;
+}
+
+void NES::catchUpDevices() {
+	ppu.catchUp(cpu.cycles);
+	if(cpu.cycles >= apu.nextEventCycle()) apu.catchUp(cpu.cycles);
+}
+
+NES_RUN_STATUS NES::runCycles(uint64_t n) { return runUntil(cpu.cycles + n, false); }
+
+NES_RUN_STATUS NES::runFrame() { return runUntil(UINT64_MAX, true); }
+
+NES_RUN_STATUS NES::runUntil(uint64_t targetCycle, bool stopAtFrame) {
+	/*
+	 * The CPU runs uninterrupted up to the next point where something outside it has to happen,
+	 * which is either the requested target or the next event of the PPU (vblank NMI, scanline IRQ, end of frame)
+	 * or the APU (frame and DMC IRQ). Both only catch up at those points and when the CPU touches their registers.
+	 */
+	NES_RUN_STATUS status;
+	uint64_t startCycle = cpu.cycles;
+
+	status.reason = STOP_CYCLES;
+	status.faultOpcode = 0;
+	status.faultPC = 0;
+
+	while(cpu.cycles < targetCycle) {
+		uint64_t eventCycle = nextEventCycle();
+		uint64_t limit = targetCycle < eventCycle ? targetCycle : eventCycle;
+
+		bool running = cpu.runUntil(limit);
+		catchUpDevices();
+
+		if(!running) {
+			status.reason = STOP_FAULT;
+			status.faultOpcode = cpu.opcode;
+			status.faultPC = cpu.PC;
+			break;
+		}
+
+		if(ppu.frameComplete) {
+			endFrame();
+			if(stopAtFrame) {
+				status.reason = STOP_FRAME;
+				break;
+			}
+		}
+	}
+
+	status.cycles = cpu.cycles - startCycle;
+	return status;
+}
+
+void NES::endFrame() {
+	ppu.frameComplete = false;
+	frame++;
+
+	if(apu.sampleRate != 0) apu.endBlock(cpu.cycles); //one audio block per frame
+}
+
+size_t NES::stateSize() {
+	NES_STATE state(NULL, 0, false);
+	serialize(state);
+	return state.position;
+}
+
+size_t NES::saveState(uint8_t* buffer, size_t capacity) {
+	NES_STATE state(buffer, capacity, false);
+	serialize(state);
+
+	if(state.failed) {
+		printf("ERROR: Save state needs %lu bytes, got %lu\n", (unsigned long) stateSize(), (unsigned long) capacity);
+		return 0;
+	}
+	return state.position;
+}
+
+bool NES::loadState(const uint8_t* buffer, size_t size) {
+	//Everything is checked before anything is overwritten, a rejected state leaves the console untouched
+	NES_STATE header((uint8_t*) buffer, size, true);
+	if(!serializeHeader(header)) return false;
+
+	if(size != stateSize()) {
+		printf("ERROR: Save state is %lu bytes, expected %lu\n", (unsigned long) size, (unsigned long) stateSize());
+		return false;
+	}
+
+	NES_STATE state((uint8_t*) buffer, size, true);
+	serialize(state);
+	return true;
+}
+
+void NES::serialize(NES_STATE& state) {
+	/*
+	 * Only what changes at runtime is stored: RAM, PRG RAM, CHR RAM, VRAM and the registers of every part.
+	 * The ROM is identified by the header and never written.
+	 */
+	if(!serializeHeader(state)) return;
+
+	cpu.serialize(state);
+	bus.serialize(state);
+	mapper->serialize(state);
+	ppu.serialize(state);
+	apu.serialize(state);
+	state.value(frame);
+
+	state.bytes(buttons, 2);
+	state.bytes(controllerShift, 2);
+	state.value(controllerStrobe);
+}
+
+bool NES::serializeHeader(NES_STATE& state) {
+	uint32_t magic = NES_STATE_MAGIC;
+	uint16_t version = NES_STATE_VERSION;
+	uint16_t mapperNumber = rom.mapper;
+	uint32_t prgSize = rom.prg_size;
+	uint32_t chrSize = rom.chr_size;
+
+	state.value(magic);
+	state.value(version);
+	state.value(mapperNumber);
+	state.value(prgSize);
+	state.value(chrSize);
+
+	if(!state.loading) return true;
+
+	if(state.failed || magic != NES_STATE_MAGIC) {
+		printf("ERROR: Not a save state\n");
+		state.failed = true;
+		return false;
+	}
+	if(version != NES_STATE_VERSION) {
+		printf("ERROR: Save state version %u is not supported\n", version);
+		state.failed = true;
+		return false;
+	}
+	if(mapperNumber != rom.mapper || prgSize != rom.prg_size || chrSize != rom.chr_size) {
+		printf("ERROR: Save state was made with a different cartridge\n");
+		state.failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+void NES::oamDMA(uint8_t page) { //Copies 256 bytes from page * 0x100 into OAM, halting the CPU for 513 or 514 cycles
+	ppu.catchUp(cpu.currentCycle());
+
+	uint16_t source = page << 8;
+	for(int i = 0; i < 256; ++i) ppu.writeOAM(bus.read(source + i));
+
+	cpu.cycles += 513 + (cpu.currentCycle() & 1); //an extra alignment cycle when the write lands on an odd cycle, counted from 0 at power on
+}
+
+void NES::setButtons(uint8_t port, uint8_t pressed) { buttons[port & 1] = pressed; }
+
+uint32_t NES::ramHash() {
+	uint32_t hash = 2166136261u;
+	for(int i = 0; i < CPU_RAM_SIZE; ++i) hash = (hash ^ bus.ram[i]) * 16777619u;
+	return hash;
+}
+
+uint8_t NES::readController(uint8_t port) {
+	//While strobing, the controller keeps reloading and only A can be read. After 8 reads it returns 1s.
+	if(controllerStrobe) controllerShift[port] = buttons[port];
+
+	uint8_t bit = controllerShift[port] & 1;
+	if(!controllerStrobe) controllerShift[port] = (controllerShift[port] >> 1) | 0x80;
+
+	return bit | 0x40; //the upper bits are open bus, usually the high byte of 0x4016
+}
+
+uint8_t NES::ioRead(void* device, uint16_t address) {
+	NES* nes = (NES*) device;
+
+	switch(address) {
+
+	case 0x4016:
+	case 0x4017:
+		return nes->readController(address & 1);
+
+	case 0x4015:
+		nes->apu.catchUp(nes->cpu.currentCycle());
+		return nes->apu.readStatus();
+
+	default:
+		return NES_BUS::openBusRead(device, address);
+	}
+}
+
+void NES::ioWrite(void* device, uint16_t address, uint8_t value) {
+	NES* nes = (NES*) device;
+
+	if(address == 0x4014) {
+		nes->oamDMA(value);
+		return;
+	}
+
+	if(address == 0x4016) {
+		nes->controllerStrobe = value & 1;
+		if(nes->controllerStrobe) {
+			nes->controllerShift[0] = nes->buttons[0];
+			nes->controllerShift[1] = nes->buttons[1];
+		}
+		return;
+	}
+
+	if(address <= 0x4017) {
+		nes->apu.catchUp(nes->cpu.currentCycle());
+		nes->apu.writeRegister(address, value);
+	}
 }
 
 
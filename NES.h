@@ -3,15 +3,101 @@
 #define NES_H_
 
 #include "NES_ROM.h"
+#include "NES_BUS.h"
 #include "NES_CPU.h"
+#include "NES_MAPPER.h"
+#include "NES_PPU.h"
+#include "NES_APU.h"
+#include "NES_STATE.h"
+#include "NES_ARENA.h"
+
+#define ARENA_AUDIO_SAMPLES 65536 //audio ring the arena leaves room for, setOutput takes larger ones from the heap
+
+//Standard controller buttons, in the order they are shifted out
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START 0x08
+#define BUTTON_UP 0x10
+#define BUTTON_DOWN 0x20
+#define BUTTON_LEFT 0x40
+#define BUTTON_RIGHT 0x80
+
+enum NES_STOP_REASON {
+	STOP_CYCLES, //the requested number of cycles has been run
+	STOP_FRAME, //a frame has been completed
+	STOP_FAULT //the CPU jammed, see faultOpcode and faultPC
+};
+
+struct NES_RUN_STATUS {
+	uint64_t cycles; //CPU cycles executed by this call, whole instructions so this may overshoot the request
+	uint8_t reason; //NES_STOP_REASON
+	uint8_t faultOpcode;
+	uint16_t faultPC;
+};
 
 class NES {
 public:
+	NES_ARENA arena; //mapper, PRG RAM, CHR RAM and audio buffers, sized from the ROM header by init
+	bool hugePages; //back the arena with huge pages, from the next init on
+
 	NES_ROM rom;
 	NES_CPU cpu;
+	NES_BUS bus; //right behind the CPU's registers, see NES_CPU
+	NES_MAPPER* mapper;
+	NES_PPU ppu;
+	NES_APU apu;
+
+	uint32_t frame; //frames completed since init
+
+	//Controllers at 0x4016 and 0x4017
+	uint8_t buttons[2]; //BUTTON_ bits currently held, set by the host
+	uint8_t controllerShift[2];
+	bool controllerStrobe;
+
+	NES();
+	~NES();
 
-	bool init(char* romPath);
+	//Instances are cache line aligned wherever they are allocated, which C++11 new does not do by itself
+	static void* operator new(size_t size);
+	static void* operator new[](size_t size);
+	static void operator delete(void* pointer);
+	static void operator delete[](void* pointer);
+
+	bool init(const char* romPath);
+	bool init(const uint8_t* image, size_t size); //an iNES image in memory
+	bool init(const NES_ROM& source); //the cartridge of another instance, sharing its cached image
 	bool run();
+
+	NES_RUN_STATUS runCycles(uint64_t n);
+	NES_RUN_STATUS runFrame();
+
+	NES_RUN_STATUS runUntil(uint64_t targetCycle, bool stopAtFrame);
+	void endFrame();
+
+	//For anything that drives the CPU itself: run it up to nextEventCycle, then catch the devices up
+	uint64_t nextEventCycle();
+	void catchUpDevices();
+
+	void oamDMA(uint8_t page);
+	void setButtons(uint8_t port, uint8_t pressed);
+	uint8_t readController(uint8_t port);
+
+	uint32_t ramHash(); //FNV-1a of the internal RAM, what batch, movie and self-check results compare
+
+	//Save states, see NES_STATE for the format
+	size_t stateSize();
+	size_t saveState(uint8_t* buffer, size_t capacity); //returns the bytes written, 0 if capacity is too small
+	bool loadState(const uint8_t* buffer, size_t size);
+	void serialize(NES_STATE& state);
+	bool serializeHeader(NES_STATE& state);
+
+	//0x4000-0x47ff, the APU and I/O registers
+	static uint8_t ioRead(void* nes, uint16_t address);
+	static void ioWrite(void* nes, uint16_t address, uint8_t value);
+
+private:
+	bool attachRom();
 };
 
 
@@ -5,6 +5,820 @@
  *      Author: User
  */
 
+#include "header.h"
 
+#include <math.h>
+#include <string.h>
 
+#include "NES_APU.h"
+#include "NES_ARENA.h"
+#include "NES_CPU.h"
+#include "NES_STATE.h"
 
+#define APU_VOLUME 32767 //full scale of the mixer output
+
+static const uint8_t lengthTable[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t dutyTable[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const uint8_t triangleTable[32] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+static const uint16_t noisePeriods[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+
+static const uint16_t dmcPeriods[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+//CPU cycles from the start of a frame counter sequence to each of its steps, 4 step and 5 step mode
+static const uint32_t frameSteps[2][5] = {
+	{ 7457, 14913, 22371, 29829, 0 },
+	{ 7457, 14913, 22371, 29829, 37281 }
+};
+static const uint32_t frameLengths[2] = { 29830, 37282 };
+
+/*
+ * Mixer lookup tables and the band-limited step kernel
+ * The kernel is a windowed sinc at BLIP_PHASES sub-sample offsets, every phase sums to exactly 1 << BLIP_KERNEL_BITS
+ * so that integrating the buffer always settles on the exact amplitude.
+ */
+struct NES_APU_TABLES {
+	int pulseMix[31];
+	int tndMix[203];
+	int16_t kernel[BLIP_PHASES][BLIP_TAPS];
+
+	NES_APU_TABLES() {
+		pulseMix[0] = 0;
+		for(int n = 1; n < 31; ++n) pulseMix[n] = (int) (95.52 / (8128.0 / n + 100.0) * APU_VOLUME);
+
+		tndMix[0] = 0;
+		for(int n = 1; n < 203; ++n) tndMix[n] = (int) (163.67 / (24329.0 / n + 100.0) * APU_VOLUME);
+
+		const double pi = 3.14159265358979323846;
+		const double cutoff = 0.9; //of the Nyquist frequency
+
+		for(int p = 0; p < BLIP_PHASES; ++p) {
+			double taps[BLIP_TAPS];
+			double sum = 0;
+
+			for(int k = 0; k < BLIP_TAPS; ++k) {
+				double x = k - BLIP_TAPS / 2 + 1 - (double) p / BLIP_PHASES;
+				double u = (x + BLIP_TAPS / 2) / BLIP_TAPS;
+				double window = 0.42 - 0.5 * cos(2 * pi * u) + 0.08 * cos(4 * pi * u);
+				double sinc = x == 0 ? 1 : sin(pi * cutoff * x) / (pi * cutoff * x);
+
+				taps[k] = sinc * window;
+				sum += taps[k];
+			}
+
+			int total = 0;
+			for(int k = 0; k < BLIP_TAPS; ++k) {
+				kernel[p][k] = (int16_t) floor(taps[k] / sum * (1 << BLIP_KERNEL_BITS) + 0.5);
+				total += kernel[p][k];
+			}
+			kernel[p][BLIP_TAPS / 2 - 1] += (1 << BLIP_KERNEL_BITS) - total; //rounding error goes to the centre tap
+		}
+	}
+};
+
+static const NES_APU_TABLES apuTables;
+
+
+void NES_APU_ENVELOPE::clock() {
+	if(start) {
+		start = false;
+		decay = 15;
+		divider = period;
+	} else if(divider == 0) {
+		divider = period;
+		if(decay > 0) decay--;
+		else if(loop) decay = 15;
+	} else divider--;
+}
+
+void NES_APU_ENVELOPE::serialize(NES_STATE& state) {
+	state.value(start);
+	state.value(loop);
+	state.value(constant);
+	state.value(period);
+	state.value(divider);
+	state.value(decay);
+}
+
+
+void NES_APU_PULSE::write(uint8_t reg, uint8_t value) {
+	switch(reg) {
+
+	case 0:
+		duty = value >> 6;
+		envelope.loop = value & 0x20;
+		envelope.constant = value & 0x10;
+		envelope.period = value & 0x0f;
+		break;
+
+	case 1:
+		sweepEnabled = value & 0x80;
+		sweepPeriod = (value >> 4) & 7;
+		sweepNegate = value & 0x08;
+		sweepShift = value & 7;
+		sweepReload = true;
+		break;
+
+	case 2:
+		timer = (timer & 0x700) | value;
+		break;
+
+	case 3:
+		timer = (timer & 0x0ff) | ((value & 7) << 8);
+		if(enabled) length = lengthTable[value >> 3];
+		sequence = 0;
+		envelope.start = true;
+		break;
+	}
+}
+
+void NES_APU_PULSE::serialize(NES_STATE& state) {
+	envelope.serialize(state);
+	state.value(duty);
+	state.value(sequence);
+	state.value(timer);
+	state.value(length);
+	state.value(enabled);
+	state.value(sweepEnabled);
+	state.value(sweepNegate);
+	state.value(sweepReload);
+	state.value(sweepPeriod);
+	state.value(sweepShift);
+	state.value(sweepDivider);
+	state.value(nextStep);
+}
+
+int NES_APU_PULSE::sweepTarget() {
+	int change = timer >> sweepShift;
+	if(sweepNegate) return timer - change - (onesComplement ? 1 : 0);
+	return timer + change;
+}
+
+void NES_APU_PULSE::clockSweep() {
+	if(sweepDivider == 0 && sweepEnabled && sweepShift > 0 && timer >= 8) {
+		int target = sweepTarget();
+		if(target <= 0x7ff) timer = target < 0 ? 0 : target;
+	}
+
+	if(sweepDivider == 0 || sweepReload) {
+		sweepDivider = sweepPeriod;
+		sweepReload = false;
+	} else sweepDivider--;
+}
+
+void NES_APU_PULSE::clockLength() { if(length > 0 && !envelope.loop) length--; }
+
+void NES_APU_PULSE::step() { sequence = (sequence + 1) & 7; }
+
+uint8_t NES_APU_PULSE::output() { return audible() && dutyTable[duty][sequence] ? envelope.volume() : 0; }
+
+
+void NES_APU_TRIANGLE::write(uint8_t reg, uint8_t value) {
+	switch(reg) {
+
+	case 0:
+		control = value & 0x80;
+		linearReloadValue = value & 0x7f;
+		break;
+
+	case 2:
+		timer = (timer & 0x700) | value;
+		break;
+
+	case 3:
+		timer = (timer & 0x0ff) | ((value & 7) << 8);
+		if(enabled) length = lengthTable[value >> 3];
+		linearReload = true;
+		break;
+	}
+}
+
+void NES_APU_TRIANGLE::serialize(NES_STATE& state) {
+	state.value(control);
+	state.value(linearReloadValue);
+	state.value(linear);
+	state.value(linearReload);
+	state.value(timer);
+	state.value(length);
+	state.value(sequence);
+	state.value(enabled);
+	state.value(nextStep);
+}
+
+void NES_APU_TRIANGLE::clockLinear() {
+	if(linearReload) linear = linearReloadValue;
+	else if(linear > 0) linear--;
+
+	if(!control) linearReload = false;
+}
+
+void NES_APU_TRIANGLE::clockLength() { if(length > 0 && !control) length--; }
+
+void NES_APU_TRIANGLE::step() { sequence = (sequence + 1) & 31; }
+
+uint8_t NES_APU_TRIANGLE::output() { return triangleTable[sequence]; } //a halted triangle holds its level
+
+
+void NES_APU_NOISE::write(uint8_t reg, uint8_t value) {
+	switch(reg) {
+
+	case 0:
+		envelope.loop = value & 0x20;
+		envelope.constant = value & 0x10;
+		envelope.period = value & 0x0f;
+		break;
+
+	case 2:
+		mode = value & 0x80;
+		periodIndex = value & 0x0f;
+		break;
+
+	case 3:
+		if(enabled) length = lengthTable[value >> 3];
+		envelope.start = true;
+		break;
+	}
+}
+
+void NES_APU_NOISE::serialize(NES_STATE& state) {
+	envelope.serialize(state);
+	state.value(mode);
+	state.value(periodIndex);
+	state.value(length);
+	state.value(lfsr);
+	state.value(enabled);
+	state.value(nextStep);
+}
+
+void NES_APU_NOISE::clockLength() { if(length > 0 && !envelope.loop) length--; }
+
+void NES_APU_NOISE::step() {
+	uint16_t feedback = (lfsr ^ (lfsr >> (mode ? 6 : 1))) & 1;
+	lfsr = (lfsr >> 1) | (feedback << 14);
+}
+
+uint32_t NES_APU_NOISE::period() { return noisePeriods[periodIndex]; }
+
+
+void NES_APU_DMC::serialize(NES_STATE& state) {
+	state.value(irqEnabled);
+	state.value(loop);
+	state.value(rateIndex);
+	state.value(level);
+	state.value(sampleAddress);
+	state.value(sampleLength);
+	state.value(currentAddress);
+	state.value(bytesRemaining);
+	state.value(shift);
+	state.value(bitsRemaining);
+	state.value(buffer);
+	state.value(bufferEmpty);
+	state.value(silence);
+	state.value(nextStep);
+}
+
+uint32_t NES_APU_DMC::period() { return dmcPeriods[rateIndex]; }
+
+
+NES_APU::NES_APU() {
+	cpu = NULL;
+	bus = NULL;
+
+	sampleRate = 0;
+	blip = NULL;
+	ring = NULL;
+	ringMask = 0;
+	ringRead = 0;
+	ringWrite = 0;
+	arena = NULL;
+	heapBuffers = false;
+	muted = false;
+	mutedRate = 0;
+}
+
+NES_APU::~NES_APU() { releaseOutput(); }
+
+void NES_APU::releaseOutput() { //Drops the buffers without touching the rest of the state, audio is off until setOutput, muting stays as it is
+	if(heapBuffers) {
+		delete[] blip;
+		delete[] ring;
+	}
+	blip = NULL;
+	ring = NULL;
+	heapBuffers = false;
+	ringMask = 0;
+	ringRead = 0;
+	ringWrite = 0;
+	sampleRate = 0;
+	mutedRate = 0;
+}
+
+void NES_APU::setMuted(bool _muted) {
+	/*
+	 * Muted, the APU runs as it does without output: only what the CPU can observe, which leaves the
+	 * emulation exactly the same. Synthesis restarts at the current cycle, from the channels' current levels.
+	 */
+	if(_muted == muted) return;
+	muted = _muted;
+
+	if(muted) {
+		if(sampleRate != 0) endBlock(cpu->cycles);
+		mutedRate = sampleRate;
+		sampleRate = 0;
+		schedule();
+	} else {
+		catchUp(cpu->cycles);
+		sampleRate = mutedRate;
+		mutedRate = 0;
+		schedule();
+		resetSynthesis();
+	}
+}
+
+void NES_APU::init(NES_CPU* _cpu, NES_BUS* _bus) {
+	cpu = _cpu;
+	bus = _bus;
+
+	memset(pulse, 0, sizeof(pulse));
+	memset(&triangle, 0, sizeof(triangle));
+	memset(&noise, 0, sizeof(noise));
+	memset(&dmc, 0, sizeof(dmc));
+
+	pulse[0].onesComplement = true;
+	noise.lfsr = 1;
+	dmc.bitsRemaining = 8;
+	dmc.bufferEmpty = true;
+	dmc.silence = true;
+
+	pulse[0].nextStep = APU_NEVER;
+	pulse[1].nextStep = APU_NEVER;
+	triangle.nextStep = APU_NEVER;
+	noise.nextStep = APU_NEVER;
+	dmc.nextStep = APU_NEVER;
+
+	clock = 0;
+
+	fiveStep = false;
+	irqInhibit = false;
+	frameIrq = false;
+	dmcIrq = false;
+	frameStep = 0;
+	frameStart = 0;
+	nextFrameEvent = frameSteps[0][0];
+
+	resetSynthesis();
+	ringRead = ringWrite;
+}
+
+bool NES_APU::setOutput(uint32_t _sampleRate, uint32_t ringSamples) {
+	releaseOutput();
+
+	if(_sampleRate == 0 || ringSamples == 0) {
+		schedule();
+		return true;
+	}
+
+	if(_sampleRate > APU_CPU_CLOCK / 4) {
+		printf("ERROR: Sample rate %u is too high\n", _sampleRate);
+		return false;
+	}
+
+	uint32_t capacity = 1;
+	while(capacity < ringSamples) capacity <<= 1;
+
+	//From the arena while it has room, buffers given up by earlier calls stay there until the next NES::init
+	if(arena != NULL) {
+		ring = (int16_t*) arena->allocate(capacity * sizeof(int16_t));
+		blip = (int32_t*) arena->allocate((BLIP_BUFFER_SIZE + BLIP_TAPS) * sizeof(int32_t));
+	}
+	if(ring == NULL || blip == NULL) {
+		ring = new int16_t[capacity]();
+		blip = new int32_t[BLIP_BUFFER_SIZE + BLIP_TAPS]();
+		heapBuffers = true;
+	}
+	ringMask = capacity - 1;
+
+	timeFactor = ((uint64_t) _sampleRate << BLIP_FRACTION_BITS) / APU_CPU_CLOCK;
+	maxBlockCycles = ((uint64_t) (BLIP_BUFFER_SIZE - 1) << BLIP_FRACTION_BITS) / timeFactor - 1;
+	highpassFactor = (int32_t) ((1 - exp(-2 * 3.14159265358979323846 * 90 / _sampleRate)) * 65536); //the console's 90Hz high-pass
+
+	if(muted) { //set up for when setMuted(false) comes, which restarts synthesis itself
+		mutedRate = _sampleRate;
+		schedule();
+		return true;
+	}
+
+	sampleRate = _sampleRate;
+
+	schedule();
+	resetSynthesis();
+	return true;
+}
+
+void NES_APU::serialize(NES_STATE& state) {
+	pulse[0].serialize(state);
+	pulse[1].serialize(state);
+	triangle.serialize(state);
+	noise.serialize(state);
+	dmc.serialize(state);
+
+	state.value(clock);
+	state.value(fiveStep);
+	state.value(irqInhibit);
+	state.value(frameIrq);
+	state.value(dmcIrq);
+	state.value(frameStep);
+	state.value(frameStart);
+	state.value(nextFrameEvent);
+
+	if(!state.loading) return;
+
+	schedule(); //the saving instance may have had audio off, or on
+	resetSynthesis();
+}
+
+
+void NES_APU::catchUp(uint64_t cpuCycle) {
+	if(cpuCycle <= clock) return;
+
+	if(sampleRate != 0) {
+		while(cpuCycle - blockCycle > maxBlockCycles) flushBlock(blockCycle + maxBlockCycles);
+	}
+	run(cpuCycle);
+}
+
+uint64_t NES_APU::nextEventCycle() {
+	/*
+	 * The first CPU cycle by which the APU has to have run because it raises an IRQ there.
+	 * Nothing else the APU does is visible to the CPU without a register access.
+	 */
+	uint64_t next = APU_NEVER;
+
+	if(!fiveStep && !irqInhibit && !frameIrq) next = frameStart + frameSteps[0][3] + 1;
+
+	if(dmc.irqEnabled && !dmc.loop && dmc.bytesRemaining > 0 && dmc.nextStep != APU_NEVER) {
+		//the last byte is fetched when the shift register empties for the bytesRemaining-th time
+		uint64_t steps = dmc.bitsRemaining + 8 * (dmc.bytesRemaining - 1);
+		uint64_t irqCycle = dmc.nextStep + (steps - 1) * dmc.period() + 1;
+		if(irqCycle < next) next = irqCycle;
+	}
+
+	return next;
+}
+
+void NES_APU::endBlock(uint64_t cpuCycle) {
+	if(sampleRate == 0) {
+		catchUp(cpuCycle);
+		return;
+	}
+
+	while(cpuCycle - blockCycle > maxBlockCycles) flushBlock(blockCycle + maxBlockCycles);
+	flushBlock(cpuCycle);
+}
+
+uint32_t NES_APU::samplesAvailable() { return ringWrite - ringRead; }
+
+uint32_t NES_APU::readSamples(int16_t* out, uint32_t count) {
+	uint32_t available = ringWrite - ringRead;
+	if(count > available) count = available;
+
+	for(uint32_t i = 0; i < count; ++i) out[i] = ring[(ringRead + i) & ringMask];
+	ringRead += count;
+
+	return count;
+}
+
+
+void NES_APU::run(uint64_t cpuCycle) {
+	/*
+	 * Jumps from event to event: the frame counter steps and the timer steps of every running channel,
+	 * whichever comes first. The output only changes at these, so this is also where steps are synthesised.
+	 */
+	for(;;) {
+		uint64_t next = nextFrameEvent;
+		if(pulse[0].nextStep < next) next = pulse[0].nextStep;
+		if(pulse[1].nextStep < next) next = pulse[1].nextStep;
+		if(triangle.nextStep < next) next = triangle.nextStep;
+		if(noise.nextStep < next) next = noise.nextStep;
+		if(dmc.nextStep < next) next = dmc.nextStep;
+
+		if(next >= cpuCycle) break;
+		clock = next;
+
+		for(int i = 0; i < 2; ++i) {
+			if(pulse[i].nextStep == next) {
+				pulse[i].step();
+				pulse[i].nextStep += pulse[i].period();
+			}
+		}
+		if(triangle.nextStep == next) {
+			triangle.step();
+			triangle.nextStep += triangle.period();
+		}
+		if(noise.nextStep == next) {
+			noise.step();
+			noise.nextStep += noise.period();
+		}
+		if(dmc.nextStep == next) {
+			stepDMC();
+			dmc.nextStep += dmc.period();
+			schedule();
+		}
+		if(nextFrameEvent == next) {
+			clockFrameCounter();
+			schedule();
+		}
+
+		mix(next);
+	}
+
+	clock = cpuCycle;
+}
+
+void NES_APU::clockFrameCounter() {
+	switch(frameStep) {
+
+	case 0:
+	case 2:
+		quarterFrame();
+		break;
+
+	case 1:
+	case 4:
+		quarterFrame();
+		halfFrame();
+		break;
+
+	case 3: //the 5 step sequence does nothing here
+		if(fiveStep) break;
+		quarterFrame();
+		halfFrame();
+		if(!irqInhibit) {
+			frameIrq = true;
+			setIrq(IRQ_FRAME, true);
+		}
+		break;
+	}
+
+	if(++frameStep == (fiveStep ? 5 : 4)) {
+		frameStep = 0;
+		frameStart += frameLengths[fiveStep];
+	}
+	nextFrameEvent = frameStart + frameSteps[fiveStep][frameStep];
+}
+
+void NES_APU::quarterFrame() { //Envelopes and the linear counter
+	pulse[0].envelope.clock();
+	pulse[1].envelope.clock();
+	noise.envelope.clock();
+	triangle.clockLinear();
+}
+
+void NES_APU::halfFrame() { //Length counters and sweeps
+	pulse[0].clockLength();
+	pulse[1].clockLength();
+	triangle.clockLength();
+	noise.clockLength();
+	pulse[0].clockSweep();
+	pulse[1].clockSweep();
+}
+
+void NES_APU::stepDMC() {
+	if(!dmc.silence) {
+		if(dmc.shift & 1) {
+			if(dmc.level <= 125) dmc.level += 2;
+		} else if(dmc.level >= 2) dmc.level -= 2;
+		dmc.shift >>= 1;
+	}
+
+	if(--dmc.bitsRemaining > 0) return;
+
+	dmc.bitsRemaining = 8;
+	if(dmc.bufferEmpty) dmc.silence = true;
+	else {
+		dmc.silence = false;
+		dmc.shift = dmc.buffer;
+		dmc.bufferEmpty = true;
+		fetchDMC();
+	}
+}
+
+void NES_APU::fetchDMC() { //Refills the sample buffer, the cycles this steals from the CPU are not emulated
+	if(!dmc.bufferEmpty || dmc.bytesRemaining == 0) return;
+
+	dmc.buffer = bus->read(dmc.currentAddress);
+	dmc.bufferEmpty = false;
+	dmc.currentAddress = dmc.currentAddress == 0xffff ? 0x8000 : dmc.currentAddress + 1;
+
+	if(--dmc.bytesRemaining > 0) return;
+
+	if(dmc.loop) {
+		dmc.currentAddress = dmc.sampleAddress;
+		dmc.bytesRemaining = dmc.sampleLength;
+	} else if(dmc.irqEnabled) {
+		dmcIrq = true;
+		setIrq(IRQ_DMC, true);
+	}
+}
+
+void NES_APU::setIrq(uint8_t line, bool value) {
+	if(value) cpu->irqLines |= line;
+	else cpu->irqLines &= ~line;
+}
+
+
+uint8_t NES_APU::readStatus() {
+	uint8_t value = (pulse[0].length > 0 ? 0x01 : 0)
+			| (pulse[1].length > 0 ? 0x02 : 0)
+			| (triangle.length > 0 ? 0x04 : 0)
+			| (noise.length > 0 ? 0x08 : 0)
+			| (dmc.bytesRemaining > 0 ? 0x10 : 0)
+			| (frameIrq ? 0x40 : 0)
+			| (dmcIrq ? 0x80 : 0);
+
+	frameIrq = false;
+	setIrq(IRQ_FRAME, false);
+
+	return value;
+}
+
+void NES_APU::writeRegister(uint16_t address, uint8_t value) { //The caller has caught the APU up to the write
+	switch(address) {
+
+	case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+		pulse[0].write(address & 3, value);
+		break;
+
+	case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+		pulse[1].write(address & 3, value);
+		break;
+
+	case 0x4008: case 0x400a: case 0x400b:
+		triangle.write(address & 3, value);
+		break;
+
+	case 0x400c: case 0x400e: case 0x400f:
+		noise.write(address & 3, value);
+		break;
+
+	case 0x4010:
+		dmc.irqEnabled = value & 0x80;
+		dmc.loop = value & 0x40;
+		dmc.rateIndex = value & 0x0f;
+		if(!dmc.irqEnabled) {
+			dmcIrq = false;
+			setIrq(IRQ_DMC, false);
+		}
+		break;
+
+	case 0x4011:
+		dmc.level = value & 0x7f;
+		break;
+
+	case 0x4012:
+		dmc.sampleAddress = 0xc000 | (value << 6);
+		break;
+
+	case 0x4013:
+		dmc.sampleLength = (value << 4) | 1;
+		break;
+
+	case 0x4015:
+		pulse[0].enabled = value & 0x01;
+		pulse[1].enabled = value & 0x02;
+		triangle.enabled = value & 0x04;
+		noise.enabled = value & 0x08;
+		if(!pulse[0].enabled) pulse[0].length = 0;
+		if(!pulse[1].enabled) pulse[1].length = 0;
+		if(!triangle.enabled) triangle.length = 0;
+		if(!noise.enabled) noise.length = 0;
+
+		if(value & 0x10) {
+			if(dmc.bytesRemaining == 0) {
+				dmc.currentAddress = dmc.sampleAddress;
+				dmc.bytesRemaining = dmc.sampleLength;
+			}
+			fetchDMC();
+		} else dmc.bytesRemaining = 0;
+
+		dmcIrq = false;
+		setIrq(IRQ_DMC, false);
+		break;
+
+	case 0x4017: //restarts the frame counter, the 5 step sequence clocks everything right away
+		fiveStep = value & 0x80;
+		irqInhibit = value & 0x40;
+		if(irqInhibit) {
+			frameIrq = false;
+			setIrq(IRQ_FRAME, false);
+		}
+
+		frameStep = 0;
+		frameStart = clock;
+		nextFrameEvent = frameStart + frameSteps[fiveStep][0];
+		if(fiveStep) {
+			quarterFrame();
+			halfFrame();
+		}
+		break;
+
+	default:
+		return;
+	}
+
+	schedule();
+	mix(clock);
+}
+
+
+static inline void startOrStop(uint64_t& nextStep, bool running, uint32_t period, uint64_t now) {
+	if(!running) nextStep = APU_NEVER;
+	else if(nextStep == APU_NEVER) nextStep = now + period;
+}
+
+void NES_APU::schedule() {
+	/*
+	 * A timer only runs while its steps change something: without audio output that is only the DMC,
+	 * which fetches bytes and raises its IRQ
+	 */
+	bool audio = sampleRate != 0;
+
+	startOrStop(pulse[0].nextStep, audio && pulse[0].audible(), pulse[0].period(), clock);
+	startOrStop(pulse[1].nextStep, audio && pulse[1].audible(), pulse[1].period(), clock);
+	startOrStop(triangle.nextStep, audio && triangle.audible(), triangle.period(), clock);
+	startOrStop(noise.nextStep, audio && noise.audible(), noise.period(), clock);
+	startOrStop(dmc.nextStep, dmc.busy() || (audio && !dmc.silence), dmc.period(), clock);
+}
+
+void NES_APU::mix(uint64_t cpuCycle) {
+	if(sampleRate == 0) return;
+
+	int level = apuTables.pulseMix[pulse[0].output() + pulse[1].output()]
+			+ apuTables.tndMix[3 * triangle.output() + 2 * noise.output() + dmc.level];
+
+	if(level == amplitude) return;
+	addDelta(cpuCycle, level - amplitude);
+	amplitude = level;
+}
+
+void NES_APU::resetSynthesis() { //Starts a new block at clock at the current level, so that there is no pop
+	if(sampleRate == 0) return;
+
+	blockCycle = clock;
+	blockFraction = 0;
+	memset(blip, 0, (BLIP_BUFFER_SIZE + BLIP_TAPS) * sizeof(int32_t));
+
+	amplitude = apuTables.pulseMix[pulse[0].output() + pulse[1].output()]
+			+ apuTables.tndMix[3 * triangle.output() + 2 * noise.output() + dmc.level];
+	integrator = amplitude << BLIP_KERNEL_BITS;
+	highpass = (int64_t) amplitude << 16;
+}
+
+void NES_APU::addDelta(uint64_t cpuCycle, int delta) {
+	uint64_t position = (cpuCycle - blockCycle) * timeFactor + blockFraction;
+	const int16_t* kernel = apuTables.kernel[(position >> (BLIP_FRACTION_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+	int32_t* out = &blip[position >> BLIP_FRACTION_BITS];
+
+	for(int i = 0; i < BLIP_TAPS; ++i) out[i] += kernel[i] * delta;
+}
+
+void NES_APU::flushBlock(uint64_t cpuCycle) {
+	run(cpuCycle);
+
+	uint64_t end = (cpuCycle - blockCycle) * timeFactor + blockFraction;
+	uint32_t count = end >> BLIP_FRACTION_BITS;
+
+	for(uint32_t i = 0; i < count; ++i) {
+		integrator += blip[i];
+
+		int32_t level = integrator >> BLIP_KERNEL_BITS;
+		int32_t sample = level - (int32_t) (highpass >> 16);
+		highpass += (int64_t) sample * highpassFactor;
+
+		if(sample > 32767) sample = 32767;
+		if(sample < -32768) sample = -32768;
+
+		ring[ringWrite & ringMask] = sample;
+		if(++ringWrite - ringRead > ringMask + 1) ringRead++; //a full ring drops the oldest sample
+	}
+
+	//the tails of the last steps carry over into the next block
+	memmove(blip, &blip[count], (BLIP_BUFFER_SIZE + BLIP_TAPS - count) * sizeof(int32_t));
+	memset(&blip[BLIP_BUFFER_SIZE + BLIP_TAPS - count], 0, count * sizeof(int32_t));
+
+	blockCycle = cpuCycle;
+	blockFraction = end & ((1 << BLIP_FRACTION_BITS) - 1);
+}
@@ -0,0 +1,222 @@
+#ifndef NES_APU_H_
+#define NES_APU_H_
+
+#include "NES_BUS.h"
+
+class NES_CPU;
+class NES_STATE;
+class NES_ARENA;
+
+#define APU_CPU_CLOCK 1789773 //NTSC
+#define APU_NEVER UINT64_MAX
+
+//Band-limited step synthesis
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+#define BLIP_FRACTION_BITS 20
+#define BLIP_KERNEL_BITS 15
+#define BLIP_BUFFER_SIZE 4096 //samples one block can hold, longer stretches are split
+
+struct NES_APU_ENVELOPE {
+	bool start;
+	bool loop; //also halts the length counter
+	bool constant;
+	uint8_t period; //also the constant volume
+	uint8_t divider;
+	uint8_t decay;
+
+	void clock();
+	void serialize(NES_STATE& state);
+	inline uint8_t volume() { return constant ? period : decay; }
+};
+
+struct NES_APU_PULSE {
+	NES_APU_ENVELOPE envelope;
+	uint8_t duty;
+	uint8_t sequence;
+	uint16_t timer;
+	uint8_t length;
+	bool enabled;
+
+	bool sweepEnabled;
+	bool sweepNegate;
+	bool sweepReload;
+	uint8_t sweepPeriod;
+	uint8_t sweepShift;
+	uint8_t sweepDivider;
+	bool onesComplement; //pulse 1 negates with one's complement
+
+	uint64_t nextStep; //CPU cycle of the next sequencer step, APU_NEVER while stopped
+
+	void write(uint8_t reg, uint8_t value);
+	void serialize(NES_STATE& state);
+	int sweepTarget();
+	void clockSweep();
+	void clockLength();
+	void step();
+
+	inline uint32_t period() { return (timer + 1) * 2; }
+	inline bool audible() { return length > 0 && timer >= 8 && sweepTarget() <= 0x7ff; }
+	uint8_t output();
+};
+
+struct NES_APU_TRIANGLE {
+	bool control; //also halts the length counter
+	uint8_t linearReloadValue;
+	uint8_t linear;
+	bool linearReload;
+	uint16_t timer;
+	uint8_t length;
+	uint8_t sequence;
+	bool enabled;
+
+	uint64_t nextStep;
+
+	void write(uint8_t reg, uint8_t value);
+	void serialize(NES_STATE& state);
+	void clockLinear();
+	void clockLength();
+	void step();
+
+	inline uint32_t period() { return timer + 1; }
+	inline bool audible() { return length > 0 && linear > 0 && timer >= 2; } //ultrasonic periods hold the output instead of stepping
+	uint8_t output();
+};
+
+struct NES_APU_NOISE {
+	NES_APU_ENVELOPE envelope;
+	bool mode;
+	uint8_t periodIndex;
+	uint8_t length;
+	uint16_t lfsr;
+	bool enabled;
+
+	uint64_t nextStep;
+
+	void write(uint8_t reg, uint8_t value);
+	void serialize(NES_STATE& state);
+	void clockLength();
+	void step();
+
+	uint32_t period();
+	inline bool audible() { return length > 0; }
+	inline uint8_t output() { return audible() && !(lfsr & 1) ? envelope.volume() : 0; }
+};
+
+struct NES_APU_DMC {
+	bool irqEnabled;
+	bool loop;
+	uint8_t rateIndex;
+	uint8_t level;
+	uint16_t sampleAddress;
+	uint16_t sampleLength;
+
+	uint16_t currentAddress;
+	uint16_t bytesRemaining;
+	uint8_t shift;
+	uint8_t bitsRemaining;
+	uint8_t buffer;
+	bool bufferEmpty;
+	bool silence;
+
+	uint64_t nextStep;
+
+	void serialize(NES_STATE& state);
+	uint32_t period();
+	inline bool busy() { return !bufferEmpty || bytesRemaining > 0; }
+};
+
+/*
+ * The audio processing unit
+ * Like the PPU, the APU is caught up lazily: channels only run when a register is accessed, an audio block is
+ * requested or an IRQ is due (see nextEventCycle). Catching up jumps from one timer step to the next instead of
+ * stepping every cycle, and without audio output only the parts that can be observed by the CPU are run.
+ * Level changes are turned into band-limited steps and delivered to a ring buffer of int16 samples block by block.
+ */
+class NES_APU {
+public:
+	NES_CPU* cpu;
+	NES_BUS* bus;
+
+	NES_APU_PULSE pulse[2];
+	NES_APU_TRIANGLE triangle;
+	NES_APU_NOISE noise;
+	NES_APU_DMC dmc;
+
+	uint64_t clock; //CPU cycle the APU has been run to
+
+	//Frame counter
+	bool fiveStep;
+	bool irqInhibit;
+	bool frameIrq;
+	bool dmcIrq;
+	uint8_t frameStep;
+	uint64_t frameStart; //CPU cycle the current frame counter sequence started at
+	uint64_t nextFrameEvent;
+
+	//Synthesis, only active with a sample rate set
+	uint32_t sampleRate;
+	uint64_t timeFactor; //samples per CPU cycle, BLIP_FRACTION_BITS fixed point
+	uint64_t maxBlockCycles;
+	uint64_t blockCycle; //CPU cycle of the first sample in blip
+	uint64_t blockFraction; //sample position of blockCycle
+	int32_t* blip;
+	int amplitude;
+	int32_t integrator;
+	int64_t highpass;
+	int32_t highpassFactor;
+
+	//Output ring, drained by the host with readSamples
+	int16_t* ring;
+	uint32_t ringMask;
+	uint32_t ringRead;
+	uint32_t ringWrite;
+
+	NES_ARENA* arena; //where setOutput takes its buffers from, NULL or full for the heap
+	bool heapBuffers; //ring and blip came from the heap
+	bool muted;
+	uint32_t mutedRate; //sampleRate to go back to, sampleRate is 0 while muted
+
+
+	NES_APU();
+	~NES_APU();
+
+	void init(NES_CPU* cpu, NES_BUS* bus);
+	bool setOutput(uint32_t sampleRate, uint32_t ringSamples); //ringSamples is rounded up to a power of two, 0 disables audio, while muted it is heard from setMuted(false)
+	void releaseOutput();
+	void setMuted(bool muted); //stops synthesis, but keeps the output set up
+	void serialize(NES_STATE& state); //synthesis restarts at the loaded clock, the ring is left alone
+
+	void catchUp(uint64_t cpuCycle);
+	uint64_t nextEventCycle();
+	void endBlock(uint64_t cpuCycle); //synthesises everything up to cpuCycle into the ring
+
+	uint32_t samplesAvailable();
+	uint32_t readSamples(int16_t* out, uint32_t count);
+
+	uint8_t readStatus(); //0x4015
+	void writeRegister(uint16_t address, uint8_t value);
+
+private:
+	void run(uint64_t cpuCycle);
+	void clockFrameCounter();
+	void quarterFrame();
+	void halfFrame();
+	void stepDMC();
+	void fetchDMC();
+	void setIrq(uint8_t line, bool value);
+
+	void schedule(); //starts or stops channel timers after anything changed at clock
+	void mix(uint64_t cpuCycle);
+	void resetSynthesis();
+	void addDelta(uint64_t cpuCycle, int delta);
+	void flushBlock(uint64_t cpuCycle);
+
+	NES_APU(const NES_APU&);
+	NES_APU& operator=(const NES_APU&);
+};
+
+
+
+#endif /* NES_APU_H_ */
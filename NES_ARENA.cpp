@@ -0,0 +1,82 @@
+#include "header.h"
+
+#include <string.h>
+
+#include "NES_ARENA.h"
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+NES_ARENA::NES_ARENA() {
+	base = NULL;
+	capacity = 0;
+	used = 0;
+	hugePages = false;
+}
+
+NES_ARENA::~NES_ARENA() { release(); }
+
+bool NES_ARENA::reserve(size_t size, bool _hugePages) {
+	if(base != NULL && size <= capacity && _hugePages == hugePages) {
+		used = 0;
+		return true;
+	}
+
+	release();
+
+	size = (size + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+	if(_hugePages) size = (size + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t) (ARENA_HUGE_PAGE_SIZE - 1);
+
+#ifdef _WIN32
+	base = (uint8_t*) _aligned_malloc(size, CACHE_LINE_SIZE); //huge pages need a privilege Windows rarely grants, so they are not tried
+#else
+	void* mapping = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if(_hugePages) mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+	if(mapping == MAP_FAILED) {
+		mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+		if(mapping != MAP_FAILED && _hugePages) madvise(mapping, size, MADV_HUGEPAGE);
+#endif
+	}
+	base = mapping == MAP_FAILED ? NULL : (uint8_t*) mapping;
+#endif
+
+	if(base == NULL) {
+		printf("ERROR: Arena of %lu bytes could not be allocated\n", (unsigned long) size);
+		return false;
+	}
+
+	capacity = size;
+	used = 0;
+	hugePages = _hugePages;
+	return true;
+}
+
+void NES_ARENA::release() {
+	if(base != NULL) {
+#ifdef _WIN32
+		_aligned_free(base);
+#else
+		munmap(base, capacity);
+#endif
+	}
+
+	base = NULL;
+	capacity = 0;
+	used = 0;
+}
+
+void* NES_ARENA::allocate(size_t size) {
+	size = (size + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1);
+	if(base == NULL || size > capacity - used) return NULL;
+
+	uint8_t* allocation = base + used;
+	used += size;
+	memset(allocation, 0, size); //a reused arena still holds the previous cartridge's data
+	return allocation;
+}
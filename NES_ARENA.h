@@ -0,0 +1,36 @@
+#ifndef NES_ARENA_H_
+#define NES_ARENA_H_
+
+#define ARENA_HUGE_PAGE_SIZE (2 << 20)
+
+/*
+ * Bump allocator for the buffers of one NES instance
+ * One mapping holds everything sized by the cartridge, allocations are cache line aligned and zeroed and are
+ * never freed one by one. reserve drops them all at once, keeping the mapping when it is large enough, and
+ * the mapping is returned with a single unmap. With huge pages the size is rounded up to ARENA_HUGE_PAGE_SIZE
+ * and backed by explicit huge pages where the system has them, transparent huge pages otherwise.
+ */
+class NES_ARENA {
+public:
+	size_t capacity;
+	size_t used;
+	bool hugePages;
+
+	NES_ARENA();
+	~NES_ARENA();
+
+	bool reserve(size_t size, bool hugePages); //drops every allocation, false if no memory could be mapped
+	void release();
+
+	void* allocate(size_t size); //NULL if the arena is full
+
+private:
+	uint8_t* base;
+
+	NES_ARENA(const NES_ARENA&);
+	NES_ARENA& operator=(const NES_ARENA&);
+};
+
+
+
+#endif /* NES_ARENA_H_ */
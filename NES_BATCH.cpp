@@ -0,0 +1,171 @@
+#include "header.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+#include "NES.h"
+#include "NES_BATCH.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+NES_BATCH::NES_BATCH() { seconds = 0; }
+
+NES_BATCH::~NES_BATCH() {
+	for(size_t i = 0; i < queues.size(); ++i) delete queues[i];
+}
+
+bool NES_BATCH::loadJobs(const char* path) {
+	/*
+	 * One job per line: <rom> <cycles> [<input>], the input a movie, FM2 or event script, see NES_MOVIE::loadAny
+	 * Blank lines and lines starting with # are ignored
+	 */
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("ERROR: Job list %s could not be opened\n", path);
+		return false;
+	}
+
+	char line[4096];
+	int lineNumber = 0;
+	bool ok = true;
+
+	while(ok && fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+
+		char rom[4096];
+		char input[4096];
+		unsigned long long cycles;
+		int fields = sscanf(line, "%4095s %llu %4095s", rom, &cycles, input);
+
+		if(fields <= 0 || rom[0] == '#') continue;
+		if(fields < 2) {
+			printf("ERROR: %s:%i needs a ROM and a cycle budget\n", path, lineNumber);
+			ok = false;
+			break;
+		}
+
+		NES_BATCH_JOB job;
+		job.romPath = rom;
+		job.cycles = cycles;
+		if(fields == 3 && !job.input.loadAny(input)) ok = false;
+
+		jobs.push_back(job);
+	}
+
+	fclose(file);
+	return ok;
+}
+
+void NES_BATCH::run(unsigned threads) {
+	if(threads == 0) threads = std::thread::hardware_concurrency();
+	if(threads == 0) threads = 1;
+	if(threads > jobs.size()) threads = jobs.size() > 0 ? jobs.size() : 1;
+
+	results.assign(jobs.size(), NES_BATCH_RESULT());
+
+	for(size_t i = 0; i < queues.size(); ++i) delete queues[i];
+	queues.clear();
+	for(unsigned i = 0; i < threads; ++i) queues.push_back(new NES_BATCH_QUEUE());
+	for(uint32_t i = 0; i < jobs.size(); ++i) queues[i % threads]->jobs.push_back(i);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> workers;
+	for(unsigned i = 1; i < threads; ++i) workers.push_back(std::thread(&NES_BATCH::work, this, i));
+	work(0);
+	for(size_t i = 0; i < workers.size(); ++i) workers[i].join();
+
+	seconds = secondsSince(start);
+}
+
+bool NES_BATCH::take(unsigned worker, uint32_t& job) {
+	{
+		NES_BATCH_QUEUE* own = queues[worker];
+		std::lock_guard<std::mutex> guard(own->lock);
+		if(!own->jobs.empty()) {
+			job = own->jobs.back();
+			own->jobs.pop_back();
+			return true;
+		}
+	}
+
+	for(size_t i = 1; i < queues.size(); ++i) {
+		NES_BATCH_QUEUE* victim = queues[(worker + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(victim->lock);
+		if(!victim->jobs.empty()) {
+			job = victim->jobs.front();
+			victim->jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false; //nothing is ever added during a run, so empty queues mean done
+}
+
+void NES_BATCH::work(unsigned worker) {
+	uint32_t job;
+	while(take(worker, job)) runJob(jobs[job], results[job]);
+}
+
+void NES_BATCH::runJob(const NES_BATCH_JOB& job, NES_BATCH_RESULT& result) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	memset(&result, 0, sizeof(result));
+
+	NES* nes = new NES(); //too big for a worker's stack
+	result.loaded = nes->init(job.romPath.c_str());
+
+	if(result.loaded) {
+		for(;;) {
+			NES_RUN_STATUS status = job.input.runUntil(*nes, job.cycles);
+			if(status.reason == STOP_FRAME) continue;
+
+			result.reason = status.reason;
+			result.faultOpcode = status.faultOpcode;
+			result.faultPC = status.faultPC;
+			break;
+		}
+
+		result.cycles = nes->cpu.cycles;
+		result.frames = nes->frame;
+
+		result.ramHash = nes->ramHash();
+	}
+
+	delete nes;
+	result.seconds = secondsSince(start);
+}
+
+void NES_BATCH::printResults(FILE* out) {
+	static const char* reasons[3] = { "done", "frame", "fault" };
+
+	uint64_t totalCycles = 0;
+	uint32_t failed = 0;
+
+	for(size_t i = 0; i < results.size(); ++i) {
+		const NES_BATCH_RESULT& result = results[i];
+
+		if(!result.loaded) {
+			fprintf(out, "%5lu  error  %s\n", (unsigned long) i, jobs[i].romPath.c_str());
+			failed++;
+			continue;
+		}
+
+		fprintf(out, "%5lu  %-5s  %12llu cycles  %7u frames  ram %08x  %8.3fs  %s",
+				(unsigned long) i, reasons[result.reason], (unsigned long long) result.cycles, result.frames,
+				result.ramHash, result.seconds, jobs[i].romPath.c_str());
+		if(result.reason == STOP_FAULT) fprintf(out, "  (opcode %02x at %04x)", result.faultOpcode, result.faultPC);
+		fprintf(out, "\n");
+
+		if(result.reason == STOP_FAULT) failed++;
+		totalCycles += result.cycles;
+	}
+
+	fprintf(out, "%lu jobs, %u failed, %llu cycles in %.3fs, %.1f emulated MHz\n",
+			(unsigned long) results.size(), failed, (unsigned long long) totalCycles, seconds,
+			seconds > 0 ? totalCycles / seconds / 1e6 : 0);
+}
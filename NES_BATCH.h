@@ -0,0 +1,67 @@
+#ifndef NES_BATCH_H_
+#define NES_BATCH_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+#include "NES_MOVIE.h"
+
+struct NES_BATCH_JOB {
+	std::string romPath;
+	uint64_t cycles; //CPU cycle budget
+	NES_MOVIE input; //empty without an input file, nothing pressed
+};
+
+struct NES_BATCH_RESULT {
+	bool loaded;
+	uint8_t reason; //NES_STOP_REASON, STOP_CYCLES when the budget ran out
+	uint64_t cycles;
+	uint32_t frames;
+	uint8_t faultOpcode;
+	uint16_t faultPC;
+	uint32_t ramHash; //FNV-1a of the 2KB RAM at the end, for comparing runs
+	double seconds;
+};
+
+/*
+ * Runs independent NES instances on a pool of worker threads
+ * Jobs are dealt round robin into one queue per worker. A worker takes from the back of its own queue
+ * and, once that is empty, steals from the front of the others, so long jobs do not leave threads idle.
+ * Every job gets its own NES, results go to a slot per job, nothing else is shared.
+ */
+class NES_BATCH {
+public:
+	std::vector<NES_BATCH_JOB> jobs;
+	std::vector<NES_BATCH_RESULT> results;
+	double seconds; //wall time of the last run
+
+	NES_BATCH();
+	~NES_BATCH();
+
+	bool loadJobs(const char* path);
+
+	void run(unsigned threads); //0 uses every core
+	void printResults(FILE* out);
+
+	static void runJob(const NES_BATCH_JOB& job, NES_BATCH_RESULT& result);
+
+private:
+	struct NES_BATCH_QUEUE {
+		std::mutex lock;
+		std::deque<uint32_t> jobs;
+	};
+
+	std::vector<NES_BATCH_QUEUE*> queues;
+
+	bool take(unsigned worker, uint32_t& job);
+	void work(unsigned worker);
+
+	NES_BATCH(const NES_BATCH&);
+	NES_BATCH& operator=(const NES_BATCH&);
+};
+
+
+
+#endif /* NES_BATCH_H_ */
@@ -0,0 +1,370 @@
+#include "header.h"
+
+#include <string.h>
+#include <chrono>
+
+#include "NES.h"
+#include "NES_BENCH.h"
+#include "NES_JIT.h"
+#include "NES_SNAPSHOT.h"
+#include "helper.h"
+
+#define BENCH_CHUNK 100000 //instructions, cycles or calls between looks at the clock
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::vector<uint8_t> mixedProgram(bool render) {
+	/*
+	 * 0x8000 setup, optionally turning on NMI and rendering
+	 * 0x8100 the loop: an indexed read-modify-write of RAM, (zp),Y, compare and a branch
+	 * 0x8200 the NMI handler, a bare RTI
+	 */
+	std::vector<uint8_t> code(0x201, 0xea);
+
+	static const uint8_t setup[] = {
+		0x78, //SEI
+		0xa9, 0x80, 0x8d, 0x00, 0x20, //LDA #$80, STA $2000
+		0xa9, 0x1e, 0x8d, 0x01, 0x20, //LDA #$1E, STA $2001
+	};
+	static const uint8_t start[] = { 0xa2, 0x00, 0xa0, 0x00, 0x4c, 0x00, 0x81 }; //LDX #0, LDY #0, JMP $8100
+	static const uint8_t loop[] = {
+		0xbd, 0x00, 0x04, 0x69, 0x03, 0x9d, 0x00, 0x04, //LDA $0400,X  ADC #3  STA $0400,X
+		0xe8, 0xc8, //INX  INY
+		0xb1, 0x20, 0x29, 0x0f, 0xc9, 0x07, //LDA ($20),Y  AND #$0F  CMP #7
+		0xd0, 0x02, 0xe6, 0x30, //BNE +2  INC $30
+		0x4c, 0x00, 0x81, //JMP $8100
+	};
+
+	size_t at = 0;
+	if(render) {
+		memcpy(&code[at], setup, sizeof(setup));
+		at += sizeof(setup);
+	}
+	memcpy(&code[at], start, sizeof(start));
+	memcpy(&code[0x100], loop, sizeof(loop));
+	code[0x200] = 0x40; //RTI
+	return code;
+}
+
+static std::vector<uint8_t> callProgram() {
+	/*
+	 * 0x8000 the loop: a subroutine call and a branch
+	 * 0x8100 the subroutine: the stack, absolute indexed reads and writes of RAM, reads of PRG through
+	 *        (zp),Y and (zp,X), and BIT
+	 */
+	std::vector<uint8_t> code(0x100, 0xea);
+
+	static const uint8_t loop[] = {
+		0xa2, 0x00, 0xa0, 0x00, //LDX #0  LDY #0
+		0x20, 0x00, 0x81, //JSR $8100
+		0xe8, 0xd0, 0xfa, //INX  BNE -6
+		0x4c, 0x04, 0x80, //JMP $8004
+	};
+	static const uint8_t subroutine[] = {
+		0x48, 0x08, //PHA  PHP
+		0xbd, 0x00, 0x04, 0x18, 0x79, 0x00, 0x05, 0x9d, 0x00, 0x04, //LDA $0400,X  CLC  ADC $0500,Y  STA $0400,X
+		0xb1, 0x20, 0x41, 0x1f, 0x24, 0x30, //LDA ($20),Y  EOR ($1F,X)  BIT $30
+		0x28, 0x68, 0xc8, 0x60, //PLP  PLA  INY  RTS
+	};
+
+	memcpy(&code[0], loop, sizeof(loop));
+	code.insert(code.end(), subroutine, subroutine + sizeof(subroutine));
+	return code;
+}
+
+static std::vector<uint8_t> addressingProgram(const uint8_t* instruction, uint8_t bytes) { //16 times, then JMP $8000
+	std::vector<uint8_t> code;
+	for(int i = 0; i < 16; ++i) code.insert(code.end(), instruction, instruction + bytes);
+	code.push_back(0x4c);
+	code.push_back(0x00);
+	code.push_back(0x80);
+	return code;
+}
+
+static NES* createNES(const std::vector<uint8_t>& code) {
+	std::vector<uint8_t> image = NES_BENCH::buildImage(code, 0x8200);
+
+	NES* nes = new NES();
+	if(!nes->init(image.data(), image.size())) {
+		delete nes;
+		return NULL;
+	}
+
+	//Pointers for the indirect modes: ($20) and ($0300) both point to 0x8000
+	nes->bus.ram[0x20] = 0x00;
+	nes->bus.ram[0x21] = 0x80;
+	nes->bus.ram[0x300] = 0x00;
+	nes->bus.ram[0x301] = 0x80;
+	return nes;
+}
+
+
+NES_BENCH::NES_BENCH() { minSeconds = 0.25; }
+
+std::vector<uint8_t> NES_BENCH::buildImage(const std::vector<uint8_t>& code, uint16_t nmi) {
+	std::vector<uint8_t> image(INES_HEADER_SIZE + 2 * KB16 + KB8, 0);
+
+	memcpy(&image[0], "NES\x1a", 4);
+	image[4] = 2; //PRG in 16KB units
+	image[5] = 1; //CHR in 8KB units
+
+	uint8_t* prg = &image[INES_HEADER_SIZE];
+	memcpy(prg, code.data(), code.size() < 2 * KB16 - 6 ? code.size() : 2 * KB16 - 6);
+
+	prg[0x7ffa] = nmi & 0xff;
+	prg[0x7ffb] = nmi >> 8;
+	prg[0x7ffc] = 0x00; //reset at 0x8000
+	prg[0x7ffd] = 0x80;
+	prg[0x7ffe] = nmi & 0xff;
+	prg[0x7fff] = nmi >> 8;
+	return image;
+}
+
+void NES_BENCH::add(const char* name, const char* unit, uint64_t iterations, uint64_t cycles, double seconds) {
+	NES_BENCH_RESULT result;
+	result.name = name;
+	result.unit = unit;
+	result.iterations = iterations;
+	result.cycles = cycles;
+	result.seconds = seconds;
+	results.push_back(result);
+}
+
+void NES_BENCH::runAll() {
+	results.clear();
+
+	std::vector<uint8_t> mixed = mixedProgram(false);
+	benchRunOp("cpu/runOp/mixed", mixed);
+	benchRunUntil("cpu/runUntil/mixed", mixed, false);
+#if NES_JIT_NATIVE
+	benchRunUntil("cpu/jit/mixed", mixed, true);
+#endif
+	std::vector<uint8_t> calls = callProgram();
+	benchRunUntil("cpu/runUntil/calls", calls, false);
+#if NES_JIT_NATIVE
+	benchRunUntil("cpu/jit/calls", calls, true);
+#endif
+
+	static const struct {
+		const char* name;
+		uint8_t instruction[3];
+		uint8_t bytes;
+	} modes[] = {
+		{ "addressing/IMM", { 0xa9, 0x01 }, 2 }, //LDA #$01
+		{ "addressing/ZP0", { 0xa5, 0x10 }, 2 }, //LDA $10
+		{ "addressing/ZPX", { 0xb5, 0x10 }, 2 }, //LDA $10,X
+		{ "addressing/ZPY", { 0xb6, 0x10 }, 2 }, //LDX $10,Y
+		{ "addressing/ABS", { 0xad, 0x00, 0x02 }, 3 }, //LDA $0200
+		{ "addressing/ABX", { 0xbd, 0x00, 0x02 }, 3 }, //LDA $0200,X
+		{ "addressing/ABY", { 0xb9, 0x00, 0x02 }, 3 }, //LDA $0200,Y
+		{ "addressing/IND", { 0x6c, 0x00, 0x03 }, 3 }, //JMP ($0300), which is back to 0x8000
+		{ "addressing/IZX", { 0xa1, 0x20 }, 2 }, //LDA ($20,X)
+		{ "addressing/IZY", { 0xb1, 0x20 }, 2 }, //LDA ($20),Y
+	};
+	for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+		benchRunOp(modes[i].name, addressingProgram(modes[i].instruction, modes[i].bytes));
+	}
+
+	benchHelpers();
+	benchFrames("frame/render", mixedProgram(true));
+	benchSnapshots(mixedProgram(true));
+}
+
+void NES_BENCH::benchRunOp(const char* name, const std::vector<uint8_t>& code) {
+	NES* nes = createNES(code);
+	if(nes == NULL) return;
+
+	for(int i = 0; i < BENCH_CHUNK; ++i) nes->cpu.runOp(); //warm up
+
+	uint64_t instructions = 0;
+	uint64_t startCycle = nes->cpu.cycles;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double seconds;
+
+	do {
+		for(int i = 0; i < BENCH_CHUNK; ++i) nes->cpu.runOp();
+		instructions += BENCH_CHUNK;
+	} while((seconds = secondsSince(start)) < minSeconds);
+
+	add(name, "instruction", instructions, nes->cpu.cycles - startCycle, seconds);
+	delete nes;
+}
+
+void NES_BENCH::benchRunUntil(const char* name, const std::vector<uint8_t>& code, bool useJit) {
+	//The devices are never caught up, the program does not touch them
+	NES* nes = createNES(code);
+	if(nes == NULL) return;
+
+	NES_JIT jit;
+	if(useJit) {
+		if(!jit.init(false)) {
+			delete nes;
+			return;
+		}
+		nes->cpu.jit = &jit;
+	}
+
+	nes->cpu.runUntil(nes->cpu.cycles + BENCH_CHUNK); //warm up, decodes and compiles the blocks
+
+	uint64_t startCycle = nes->cpu.cycles;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double seconds;
+
+	do {
+		nes->cpu.runUntil(nes->cpu.cycles + BENCH_CHUNK);
+	} while((seconds = secondsSince(start)) < minSeconds);
+
+	uint64_t cycles = nes->cpu.cycles - startCycle;
+	add(name, "cycle", cycles, cycles, seconds);
+	delete nes;
+}
+
+void NES_BENCH::benchHelpers() {
+	//The helpers live in helper.cpp, so without link time optimisation every call is a real call
+	volatile uint32_t sink = 0;
+	std::chrono::steady_clock::time_point start;
+	double seconds;
+	uint64_t calls;
+
+	calls = 0;
+	start = std::chrono::steady_clock::now();
+	do {
+		uint32_t set = 0;
+		for(uint32_t i = 0; i < BENCH_CHUNK; ++i) set += isBitSet(i, i & 7);
+		sink += set;
+		calls += BENCH_CHUNK;
+	} while((seconds = secondsSince(start)) < minSeconds);
+	add("helper/isBitSet", "call", calls, 0, seconds);
+
+	calls = 0;
+	start = std::chrono::steady_clock::now();
+	do {
+		uint8_t byte = 0;
+		for(uint32_t i = 0; i < BENCH_CHUNK; ++i) setBit(&byte, i & 7, (i & 8) != 0);
+		sink += byte;
+		calls += BENCH_CHUNK;
+	} while((seconds = secondsSince(start)) < minSeconds);
+	add("helper/setBit", "call", calls, 0, seconds);
+
+	calls = 0;
+	start = std::chrono::steady_clock::now();
+	do {
+		uint32_t sum = 0;
+		for(uint32_t i = 0; i < BENCH_CHUNK; ++i) sum += combineLowHigh(i, i >> 8);
+		sink += sum;
+		calls += BENCH_CHUNK;
+	} while((seconds = secondsSince(start)) < minSeconds);
+	add("helper/combineLowHigh", "call", calls, 0, seconds);
+}
+
+void NES_BENCH::benchFrames(const char* name, const std::vector<uint8_t>& code) {
+	NES* nes = createNES(code);
+	if(nes == NULL) return;
+
+	std::vector<uint8_t> framebuffer(256 * 240);
+	nes->ppu.setFramebuffer(framebuffer.data(), PPU_FORMAT_INDEXED);
+
+	nes->runFrame(); //warm up, and rendering is on from here
+
+	uint32_t startFrame = nes->frame;
+	uint64_t startCycle = nes->cpu.cycles;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double seconds;
+
+	do {
+		nes->runFrame();
+	} while((seconds = secondsSince(start)) < minSeconds);
+
+	add(name, "frame", nes->frame - startFrame, nes->cpu.cycles - startCycle, seconds);
+	delete nes;
+}
+
+void NES_BENCH::benchSnapshots(const std::vector<uint8_t>& code) {
+	//The console comes from an in-memory image, so forks attach to the cached image rather than a file
+	NES* nes = createNES(code);
+	if(nes == NULL) return;
+
+	NES_REWIND rewind;
+	if(!rewind.open(600)) { //10 seconds, which the ring wraps around while capturing
+		delete nes;
+		return;
+	}
+	rewind.push(*nes);
+
+	std::chrono::steady_clock::time_point start;
+	double seconds;
+	uint64_t calls;
+
+	uint32_t startFrame = nes->frame;
+	uint64_t startCycle = nes->cpu.cycles;
+	start = std::chrono::steady_clock::now();
+	do {
+		nes->runFrame();
+		rewind.push(*nes);
+	} while((seconds = secondsSince(start)) < minSeconds);
+	add("snapshot/capture", "frame", nes->frame - startFrame, nes->cpu.cycles - startCycle, seconds);
+
+	calls = 0;
+	start = std::chrono::steady_clock::now();
+	do {
+		for(int i = 0; i < 100; ++i) rewind.get(0)->restore(*nes);
+		calls += 100;
+	} while((seconds = secondsSince(start)) < minSeconds);
+	add("snapshot/restore", "call", calls, 0, seconds);
+
+	NES* children = new NES[8];
+	calls = 0;
+	start = std::chrono::steady_clock::now();
+	do {
+		NES_SNAPSHOT* snapshot = NES_SNAPSHOT::fork(*nes, children, 8);
+		if(snapshot == NULL) break;
+		snapshot->release();
+		calls++;
+	} while((seconds = secondsSince(start)) < minSeconds);
+	if(calls != 0) add("snapshot/fork", "call", calls, 0, seconds);
+
+	delete[] children;
+	delete nes;
+}
+
+void NES_BENCH::printTable(FILE* out) {
+	fprintf(out, "%-24s %14s %12s %16s %14s\n", "benchmark", "iterations", "ns/iter", "iter/s", "emulated MHz");
+	for(size_t i = 0; i < results.size(); ++i) {
+		const NES_BENCH_RESULT& result = results[i];
+		fprintf(out, "%-24s %14llu %12.3f %16.0f", result.name.c_str(), (unsigned long long) result.iterations,
+				result.seconds * 1e9 / result.iterations, result.iterations / result.seconds);
+		if(result.cycles != 0) fprintf(out, " %14.2f", result.cycles / result.seconds / 1e6);
+		fprintf(out, "\n");
+	}
+}
+
+bool NES_BENCH::writeJson(const char* path) {
+	FILE* out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+	if(out == NULL) {
+		printf("ERROR: Benchmark results could not be written to %s\n", path);
+		return false;
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"context\": { \"cpu_blocks\": %d, \"cpu_threaded\": %d, \"cpu_trace\": %d, \"jit_native\": %d },\n",
+			CPU_BLOCKS, CPU_THREADED, CPU_TRACE, NES_JIT_NATIVE);
+	fprintf(out, "  \"benchmarks\": [\n");
+	for(size_t i = 0; i < results.size(); ++i) {
+		const NES_BENCH_RESULT& result = results[i];
+		fprintf(out, "    { \"name\": \"%s\", \"unit\": \"%s\", \"iterations\": %llu, \"seconds\": %.6f, "
+				"\"ns_per_iteration\": %.4f, \"iterations_per_second\": %.1f",
+				result.name.c_str(), result.unit, (unsigned long long) result.iterations, result.seconds,
+				result.seconds * 1e9 / result.iterations, result.iterations / result.seconds);
+		if(result.cycles != 0) {
+			fprintf(out, ", \"cycles\": %llu, \"emulated_mhz\": %.3f", (unsigned long long) result.cycles,
+					result.cycles / result.seconds / 1e6);
+		}
+		fprintf(out, " }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+
+	if(out != stdout) fclose(out);
+	return true;
+}
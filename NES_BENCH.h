@@ -0,0 +1,51 @@
+#ifndef NES_BENCH_H_
+#define NES_BENCH_H_
+
+#include <string>
+#include <vector>
+
+struct NES_BENCH_RESULT {
+	std::string name;
+	const char* unit; //what one iteration is: instruction, cycle, call or frame
+	uint64_t iterations;
+	uint64_t cycles; //emulated CPU cycles, 0 where the benchmark does not emulate
+	double seconds;
+};
+
+/*
+ * Microbenchmarks of the CPU core, its addressing, the helpers and whole frames
+ * Everything runs on PRG images built in memory, so no ROM is needed and results compare across machines
+ * only as far as the host does. Each benchmark repeats until it has run for minSeconds.
+ *   cpu/         an instruction loop through runOp, runUntil (blocks or threaded) and the JIT if available,
+ *                and a subroutine call loop through runUntil and the JIT
+ *   addressing/  runOp on a LDA (LDX for ZPY, JMP for IND) of each addressing mode, X = Y = 0
+ *   helper/      isBitSet, setBit and combineLowHigh
+ *   frame/       whole frames with rendering and an NMI every frame, through NES::runFrame
+ *   snapshot/    a frame without framebuffer plus a rewind capture, restoring the newest snapshot, forking 8 children
+ */
+class NES_BENCH {
+public:
+	std::vector<NES_BENCH_RESULT> results;
+	double minSeconds;
+
+	NES_BENCH();
+
+	void runAll();
+	void printTable(FILE* out);
+	bool writeJson(const char* path); //"-" writes to stdout
+
+	//A mapper 0 image with 32KB PRG, code is placed at 0x8000 and the NMI and IRQ vectors point to nmi
+	static std::vector<uint8_t> buildImage(const std::vector<uint8_t>& code, uint16_t nmi);
+
+private:
+	void benchRunOp(const char* name, const std::vector<uint8_t>& code);
+	void benchRunUntil(const char* name, const std::vector<uint8_t>& code, bool useJit);
+	void benchHelpers();
+	void benchFrames(const char* name, const std::vector<uint8_t>& code);
+	void benchSnapshots(const std::vector<uint8_t>& code);
+	void add(const char* name, const char* unit, uint64_t iterations, uint64_t cycles, double seconds);
+};
+
+
+
+#endif /* NES_BENCH_H_ */
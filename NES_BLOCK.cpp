@@ -0,0 +1,182 @@
+#include "header.h"
+
+#include <new>
+
+#include "NES_CPU.h"
+#include "NES_BLOCK.h"
+#include "helper.h"
+
+static bool endsBlock(const NES_OPCODE& op) { //anything that does not continue at the next instruction
+	NES_HANDLER handler = op.handler;
+	return op.mode == REL || handler == &NES_CPU::JMP || handler == &NES_CPU::JSR ||
+			handler == &NES_CPU::RTS || handler == &NES_CPU::RTI || handler == &NES_CPU::BRK;
+}
+
+static bool writesMemory(const NES_OPCODE& op) {
+	NES_HANDLER handler = op.handler;
+	if(op.mode == ACC) return false;
+	return handler == &NES_CPU::STA || handler == &NES_CPU::STX || handler == &NES_CPU::STY ||
+			handler == &NES_CPU::INC || handler == &NES_CPU::DEC ||
+			handler == &NES_CPU::ASL || handler == &NES_CPU::LSR || handler == &NES_CPU::ROL || handler == &NES_CPU::ROR ||
+			handler == &NES_CPU::PHA || handler == &NES_CPU::PHP ||
+			handler == &NES_CPU::SLO || handler == &NES_CPU::RLA || handler == &NES_CPU::SRE || handler == &NES_CPU::RRA ||
+			handler == &NES_CPU::SAX || handler == &NES_CPU::DCP || handler == &NES_CPU::ISB ||
+			handler == &NES_CPU::AHX || handler == &NES_CPU::SHX || handler == &NES_CPU::SHY || handler == &NES_CPU::TAS;
+}
+
+
+NES_BLOCK_PAGE::NES_BLOCK_PAGE(const uint8_t* _source, uint8_t _busPage, bool _writable) {
+	source = _source;
+	busPage = _busPage;
+	writable = _writable;
+	for(int i = 0; i < CPU_PAGE_SIZE; ++i) entries[i] = NULL;
+}
+
+
+NES_BLOCK_CACHE::NES_BLOCK_CACHE() {
+	bus = NULL;
+	decoded = 0;
+	slab = 0;
+	for(int i = 0; i < CPU_PAGES; ++i) {
+		current[i] = NULL;
+		currentSource[i] = NULL;
+	}
+}
+
+NES_BLOCK_CACHE::~NES_BLOCK_CACHE() {
+	for(size_t i = 0; i < slabs.size(); ++i) delete slabs[i];
+}
+
+void NES_BLOCK_CACHE::init(NES_BUS* _bus) {
+	clear();
+	bus = _bus;
+	decoded = 0;
+}
+
+void NES_BLOCK_CACHE::clear() { //pages and blocks are trivially destructible, dropping the slabs is all it takes
+	pages.clear();
+	slab = 0;
+	if(!slabs.empty()) slabs[0]->reserve(BLOCK_SLAB_SIZE, false);
+
+	for(int i = 0; i < CPU_PAGES; ++i) {
+		current[i] = NULL;
+		currentSource[i] = NULL;
+	}
+}
+
+void* NES_BLOCK_CACHE::allocate(size_t size) {
+	for(;;) {
+		if(slab < slabs.size()) {
+			void* allocation = slabs[slab]->allocate(size);
+			if(allocation != NULL) return allocation;
+
+			if(++slab < slabs.size()) {
+				slabs[slab]->reserve(BLOCK_SLAB_SIZE, false); //still holds blocks from before the last clear
+				continue;
+			}
+		}
+
+		NES_ARENA* arena = new NES_ARENA();
+		if(!arena->reserve(BLOCK_SLAB_SIZE, false)) {
+			delete arena;
+			return NULL;
+		}
+		slabs.push_back(arena);
+	}
+}
+
+bool NES_BLOCK_CACHE::selectPage(uint8_t index, const uint8_t* source) { //the mapping of a bus page changed since its last lookup
+	std::pair<const uint8_t*, uint8_t> key(source, index);
+	NES_BLOCK_PAGE*& page = pages[key];
+
+	if(page == NULL) {
+		void* memory = allocate(sizeof(NES_BLOCK_PAGE));
+		if(memory == NULL) return false;
+
+		//Below 0x8000 is RAM or PRG RAM, which may be written through the handlers even without a write pointer
+		bool writable = index < (0x8000 >> CPU_PAGE_SHIFT) || bus->writeMap[index] != NULL;
+		page = new(memory) NES_BLOCK_PAGE(source, index, writable);
+	}
+
+	current[index] = page;
+	currentSource[index] = source;
+	return true;
+}
+
+NES_BLOCK* NES_BLOCK_CACHE::decode(NES_BLOCK_PAGE* page, uint16_t offset, NES_BLOCK* block) {
+	if(block == NULL) {
+		void* memory = allocate(sizeof(NES_BLOCK));
+		if(memory == NULL) return NULL;
+
+		block = new(memory) NES_BLOCK();
+		page->entries[offset] = block;
+	}
+	decoded++;
+
+	block->length = 0;
+	block->byteCount = 0;
+	block->cycles = 0;
+	block->writable = page->writable;
+	block->jitGeneration = 0;
+	block->hits = 0;
+	block->jitSplit = false;
+	block->nativeOps = 0;
+	block->nativeCycles = 0;
+	block->native = NULL;
+
+	uint16_t pageStart = page->busPage << CPU_PAGE_SHIFT;
+
+	while(block->length < BLOCK_MAX_OPS) {
+		uint16_t at = offset + block->byteCount;
+		if(at >= CPU_PAGE_SIZE) break;
+
+		const uint8_t* code = &page->source[at];
+		const NES_OPCODE& op = NES_CPU::opcodes[code[0]];
+
+		if(op.handler == &NES_CPU::KIL) break; //faults are reported by runOp
+		if(at + op.bytes > CPU_PAGE_SIZE) break; //operand on the next page, which may be banked separately
+
+		NES_DECODED_OP& decodedOp = block->ops[block->length++];
+		decodedOp.handler = op.handler;
+		decodedOp.PC = pageStart + at;
+		decodedOp.opcode = code[0];
+		decodedOp.mode = op.mode;
+		decodedOp.bytes = op.bytes;
+		decodedOp.cycles = op.cycles;
+		decodedOp.pagePenalty = op.pagePenalty;
+		decodedOp.writes = writesMemory(op);
+
+		//Same addresses resolveAddress would compute, for the modes that do not depend on registers or memory
+		decodedOp.resolved = true;
+		switch(op.mode) {
+		case IMP:
+		case ACC:
+			decodedOp.addr = 0;
+			break;
+		case IMM:
+			decodedOp.addr = decodedOp.PC + 1;
+			break;
+		case ZP0:
+			decodedOp.addr = code[1];
+			break;
+		case ABS:
+			decodedOp.addr = combineLowHigh(code[1], code[2]);
+			break;
+		case REL:
+			decodedOp.addr = decodedOp.PC + 2 + (int8_t) code[1];
+			break;
+		default:
+			decodedOp.addr = 0;
+			decodedOp.resolved = false;
+			break;
+		}
+
+		memcpy(&block->raw[block->byteCount], code, op.bytes);
+		block->byteCount += op.bytes;
+		block->cycles += op.cycles + op.pagePenalty + (op.mode == REL ? 2 : 0);
+
+		if(endsBlock(op)) break;
+	}
+
+	return block;
+}
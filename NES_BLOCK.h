@@ -0,0 +1,127 @@
+#ifndef NES_BLOCK_H_
+#define NES_BLOCK_H_
+
+#include <map>
+#include <vector>
+#include <string.h>
+
+#include "NES_BUS.h"
+#include "NES_ARENA.h"
+
+class NES_CPU;
+
+typedef uint8_t (NES_CPU::*NES_HANDLER)();
+
+#define BLOCK_MAX_OPS 32
+#define BLOCK_SLAB_SIZE (1 << 20) //pages and blocks are carved from slabs of this size, about a thousand blocks each
+
+//One instruction of a block, decoded once
+struct NES_DECODED_OP {
+	NES_HANDLER handler;
+	uint16_t PC; //address of the opcode
+	uint16_t addr; //effective address for IMM, ZP0, ABS and REL, resolved by runOp's path otherwise
+	uint8_t opcode;
+	uint8_t mode;
+	uint8_t bytes;
+	uint8_t cycles;
+	uint8_t pagePenalty;
+	bool resolved; //addr is final
+	bool writes; //may write memory, so the block may have banked or overwritten itself
+};
+
+/*
+ * A straight-line run of instructions ending at the first branch, jump, call, return or BRK,
+ * at the end of its bus page or after BLOCK_MAX_OPS instructions
+ */
+struct NES_BLOCK {
+	uint8_t length; //0 if the first instruction cannot be run from a block, runOp handles it
+	uint8_t byteCount;
+	uint16_t cycles; //worst case cycles of the whole block, with every page and branch penalty
+	bool writable; //decoded from RAM or PRG RAM
+	uint8_t raw[BLOCK_MAX_OPS * 3]; //the bytes it was decoded from, checked on entry when the page is writable
+
+	//NES_JIT state, native is only valid while jitGeneration matches the JIT's
+	uint32_t jitGeneration;
+	uint8_t hits;
+	bool jitSplit; //the first instruction cannot be compiled but the rest can, so only it is interpreted
+	uint8_t nativeOps; //instructions covered by native, a prefix of ops
+	uint16_t nativeCycles; //worst case cycles of that prefix
+	void* native; //NULL if the block could not be compiled
+	NES_DECODED_OP ops[BLOCK_MAX_OPS];
+};
+
+//Blocks decoded from one source page mapped at one bus page, placed in the cache's slabs like its blocks
+struct NES_BLOCK_PAGE {
+	const uint8_t* source;
+	uint8_t busPage;
+	bool writable; //RAM or PRG RAM, code there is checked against raw before every use
+	NES_BLOCK* entries[CPU_PAGE_SIZE]; //by offset of the first instruction, NULL until decoded
+
+	NES_BLOCK_PAGE(const uint8_t* source, uint8_t busPage, bool writable);
+};
+
+/*
+ * Pre-decoded basic blocks for NES_CPU::runUntil
+ * Blocks are keyed by the memory a bus page maps, so a bank switch simply makes the CPU look up blocks of
+ * the newly mapped bank and switching back finds the old ones still decoded. Blocks never cross a bus page,
+ * since the next page may be banked independently. ROM never changes; blocks in RAM are compared against the
+ * bytes they were decoded from on every entry and re-decoded when code has been overwritten.
+ * Pages and blocks are bump allocated from a chain of NES_ARENA slabs that clear drops in O(1) and that the
+ * next init reuses, so a console is created and destroyed without a heap allocation per block.
+ */
+class NES_BLOCK_CACHE {
+public:
+	uint64_t decoded; //blocks decoded since init, including re-decodes of overwritten code
+
+	NES_BLOCK_CACHE();
+	~NES_BLOCK_CACHE();
+
+	void init(NES_BUS* bus);
+	void clear();
+
+	inline NES_BLOCK* lookup(uint16_t address) { //NULL if the instruction at address has to go through runOp
+		uint8_t index = address >> CPU_PAGE_SHIFT;
+		const uint8_t* source = bus->readMap[index];
+		if(source == NULL) return NULL;
+		if(source != currentSource[index] && !selectPage(index, source)) return NULL;
+
+		uint16_t offset = address & (CPU_PAGE_SIZE - 1);
+		NES_BLOCK_PAGE* page = current[index];
+		NES_BLOCK* block = page->entries[offset];
+
+		if(block == NULL || (page->writable && !matches(block, source + offset))) {
+			block = decode(page, offset, block);
+			if(block == NULL) return NULL; //out of memory, runOp still works
+		}
+		return block->length > 0 ? block : NULL;
+	}
+
+	inline bool isMapped(uint16_t address, const NES_BLOCK* block) { //false once a write has banked or changed the block's code
+		uint8_t index = address >> CPU_PAGE_SHIFT;
+		const uint8_t* source = bus->readMap[index];
+		if(source != currentSource[index]) return false;
+		return !current[index]->writable || matches(block, source + (address & (CPU_PAGE_SIZE - 1)));
+	}
+
+private:
+	NES_BUS* bus;
+
+	NES_BLOCK_PAGE* current[CPU_PAGES];
+	const uint8_t* currentSource[CPU_PAGES];
+	std::map<std::pair<const uint8_t*, uint8_t>, NES_BLOCK_PAGE*> pages;
+
+	std::vector<NES_ARENA*> slabs; //kept across clear, only the destructor unmaps them
+	size_t slab; //the one allocations come from
+
+	void* allocate(size_t size); //zeroed, NULL if no slab could be mapped
+	bool selectPage(uint8_t index, const uint8_t* source); //false if no memory was left for a new page
+	NES_BLOCK* decode(NES_BLOCK_PAGE* page, uint16_t offset, NES_BLOCK* reuse); //NULL if no memory was left for a new block
+	inline bool matches(const NES_BLOCK* block, const uint8_t* code) { return memcmp(block->raw, code, block->byteCount) == 0; }
+
+	NES_BLOCK_CACHE(const NES_BLOCK_CACHE&);
+	NES_BLOCK_CACHE& operator=(const NES_BLOCK_CACHE&);
+};
+
+
+
+#endif /* NES_BLOCK_H_ */
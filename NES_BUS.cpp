@@ -0,0 +1,47 @@
+#include "header.h"
+
+#include "NES_BUS.h"
+#include "NES_STATE.h"
+
+NES_BUS::NES_BUS() { init(); }
+
+void NES_BUS::init() { //Clears RAM and maps it to 0x0000-0x1fff, everything else reads as open bus until a device claims it
+	for(int i = 0; i < CPU_RAM_SIZE; ++i) ram[i] = 0;
+
+	mapIO(0x0000, 0xffff, openBusRead, ignoreWrite, NULL);
+	mapMemory(0x0000, 0x1fff, ram, ram);
+}
+
+void NES_BUS::serialize(NES_STATE& state) { state.bytes(ram, CPU_RAM_SIZE); } //the page tables belong to whoever mapped them
+
+void NES_BUS::mapMemory(uint16_t start, uint16_t end, const uint8_t* read, uint8_t* write) {
+	//every page in the range points at the same 2KB, which is how RAM gets mirrored
+	for(int page = start >> CPU_PAGE_SHIFT; page <= end >> CPU_PAGE_SHIFT; ++page) {
+		readMap[page] = read;
+		writeMap[page] = write;
+	}
+}
+
+void NES_BUS::mapIO(uint16_t start, uint16_t end, NES_IO_READ read, NES_IO_WRITE write, void* device) {
+	mapIORead(start, end, read, device);
+	mapIOWrite(start, end, write, device);
+}
+
+void NES_BUS::mapIORead(uint16_t start, uint16_t end, NES_IO_READ read, void* device) {
+	for(int page = start >> CPU_PAGE_SHIFT; page <= end >> CPU_PAGE_SHIFT; ++page) {
+		readMap[page] = NULL;
+		ioRead[page] = read;
+		ioReadDevice[page] = device;
+	}
+}
+
+void NES_BUS::mapIOWrite(uint16_t start, uint16_t end, NES_IO_WRITE write, void* device) {
+	for(int page = start >> CPU_PAGE_SHIFT; page <= end >> CPU_PAGE_SHIFT; ++page) {
+		writeMap[page] = NULL;
+		ioWrite[page] = write;
+		ioWriteDevice[page] = device;
+	}
+}
+
+uint8_t NES_BUS::openBusRead(void*, uint16_t address) { return address >> 8; } //the last byte on the bus is usually the high byte of the address
+void NES_BUS::ignoreWrite(void*, uint16_t, uint8_t) {}
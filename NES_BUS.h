@@ -0,0 +1,73 @@
+#ifndef NES_BUS_H_
+#define NES_BUS_H_
+
+//The CPU address space is split into 2KB pages, the smallest unit anything is mirrored or banked in
+#define CPU_PAGE_SHIFT 11
+#define CPU_PAGE_SIZE 0x800
+#define CPU_PAGES 32
+
+#define CPU_RAM_SIZE 0x800
+
+class NES_STATE;
+
+typedef uint8_t (*NES_IO_READ)(void* device, uint16_t address);
+typedef void (*NES_IO_WRITE)(void* device, uint16_t address, uint8_t value);
+
+/*
+ * The CPU address bus
+ * Pages backed by memory (RAM, PRG ROM, PRG RAM) have a pointer in readMap/writeMap and are accessed inline.
+ * Only pages without a pointer, the I/O registers and the mapper registers, go through the handler callbacks.
+ * The page tables and RAM come first and are cache line aligned, the handler tables are only read on I/O.
+ */
+class NES_BUS {
+public:
+	alignas(CACHE_LINE_SIZE) const uint8_t* readMap[CPU_PAGES]; //NULL where reads go to ioRead
+	uint8_t* writeMap[CPU_PAGES]; //NULL where writes go to ioWrite
+
+	uint8_t ram[CPU_RAM_SIZE];
+
+	NES_IO_READ ioRead[CPU_PAGES];
+	void* ioReadDevice[CPU_PAGES];
+	NES_IO_WRITE ioWrite[CPU_PAGES];
+	void* ioWriteDevice[CPU_PAGES];
+
+	NES_BUS();
+
+	void init();
+	void serialize(NES_STATE& state);
+
+	void mapMemory(uint16_t start, uint16_t end, const uint8_t* read, uint8_t* write); //end is inclusive, NULL leaves that direction to the handlers
+	void mapIO(uint16_t start, uint16_t end, NES_IO_READ read, NES_IO_WRITE write, void* device);
+	void mapIORead(uint16_t start, uint16_t end, NES_IO_READ read, void* device);
+	void mapIOWrite(uint16_t start, uint16_t end, NES_IO_WRITE write, void* device);
+
+	inline uint8_t read(uint16_t address) {
+		const uint8_t* page = readMap[address >> CPU_PAGE_SHIFT];
+		if(page != NULL) return page[address & (CPU_PAGE_SIZE - 1)];
+
+		uint8_t index = address >> CPU_PAGE_SHIFT;
+		return ioRead[index](ioReadDevice[index], address);
+	}
+
+	inline void write(uint16_t address, uint8_t value) {
+		uint8_t* page = writeMap[address >> CPU_PAGE_SHIFT];
+		if(page != NULL) {
+			page[address & (CPU_PAGE_SIZE - 1)] = value;
+			return;
+		}
+
+		uint8_t index = address >> CPU_PAGE_SHIFT;
+		ioWrite[index](ioWriteDevice[index], address, value);
+	}
+
+	static uint8_t openBusRead(void* device, uint16_t address);
+	static void ignoreWrite(void* device, uint16_t address, uint8_t value);
+
+private:
+	NES_BUS(const NES_BUS&);
+	NES_BUS& operator=(const NES_BUS&);
+};
+
+
+
+#endif /* NES_BUS_H_ */
@@ -1,25 +1,45 @@
 #include "header.h"
 
 #include "NES_CPU.h"
+#include "NES_JIT.h"
+#include "NES_PROFILE.h"
+#include "NES_STATE.h"
 #include "helper.h"
 
-#define CPU_DEBUG 1
+/*
+ * The opcode table is expanded from NES_OPCODES so that every opcode is
+ * described in exactly one place. runOp decodes an instruction once through it.
+ */
+#define NES_OPCODE_ENTRY(code, handler, mode, cycles, penalty, official) \
+	{ &NES_CPU::handler, mode, NES_MODE_BYTES(mode), cycles, penalty, official, #handler },
 
-#define NESTEST 1
+const NES_OPCODE NES_CPU::opcodes[256] = {
+	NES_OPCODES(NES_OPCODE_ENTRY)
+};
 
-#if CPU_DEBUG
-	int d_totalInstructions = 0;
-#endif
+#undef NES_OPCODE_ENTRY
 
+//Make sure NES_OPCODES stays complete and in order, otherwise the table index would not match the opcode
+#define NES_OPCODE_NUMBER(code, handler, mode, cycles, penalty, official) code,
+static constexpr uint8_t opcodeOrder[] = { NES_OPCODES(NES_OPCODE_NUMBER) };
+#undef NES_OPCODE_NUMBER
+
+static constexpr bool isOpcodeTableOrdered(int i) {
+	return i == 256 || (opcodeOrder[i] == i && isOpcodeTableOrdered(i + 1));
+}
 
-void NES_CPU::init(NES_ROM* _rom) {
-	memory = new uint8_t[0x10000]();
+static_assert(sizeof(opcodeOrder) == 256, "NES_OPCODES must list all 256 opcodes");
+static_assert(isOpcodeTableOrdered(0), "NES_OPCODES must be in opcode order");
+
+
+void NES_CPU::init(NES_ROM* _rom, NES_BUS* _bus, NES_MAPPER* _mapper) {
 	PC = 0xfffc;
-	SP = 0; //Stack at 0x0100
+	SP = 0xfd; //Stack at 0x0100
 	A = 0;
 	X = 0;
 	Y = 0;
-	P = 0;
+	setP(0x24);
+	cycles = 0;
 
 	/*
 	 * Bits of P:
@@ -33,49 +53,61 @@ void NES_CPU::init(NES_ROM* _rom) {
 	 * 7: Negative Flag
 	 */
 
-	rom = _rom;
+	opcode = 0;
+	mode = IMP;
+	addr = 0;
 
-	for(int i = 0; i < KB16; ++i) {
-		memory[0x8000+i] = rom->prg_rom[i];
-	}
+	trace = NULL;
+	profile = NULL;
+	jit = NULL;
+	irqLines = 0;
+	nmiPending = false;
+
+	rom = _rom;
+	bus = _bus;
+	blocks.init(bus);
 
-	if(rom->prg_banks <= 1)
-		for(int i = 0; i < KB16; ++i)
-			memory[0xC000+i] = rom->prg_rom[i];
-	else
-		for(int i = 0; i < KB16; ++i)
-			memory[0xC000+i] = rom->prg_rom[KB16+i];
+	_mapper->attach(this); //maps PRG RAM and PRG ROM
 
-	uint8_t startPClow = memory[PC];
-	uint8_t startPChigh = memory[PC+1];
+	uint8_t startPClow = read(PC);
+	uint8_t startPChigh = read(PC+1);
 
 #if CPU_DEBUG
 		printf("Constructing PC out of %02x and %02x\n", startPClow, startPChigh);
-		printf("Found at %04x which should be %04x in the PRG\n", PC, rom->prg_banks <= 1 ? PC-0xC000 : PC-0x8000);
-		printf("Which should be %04x in the ROM\n", rom->prg_banks <= 1 ? PC-0xC000+16 : PC-0x8000+16);
 #endif
 
 	PC = combineLowHigh(startPClow, startPChigh);
 
-#if NESTEST
-		PC = 0xc000;
-#endif
-
 #if CPU_DEBUG
 		printf("PC is now %04x\n", PC);
 #endif
 
 }
 
+void NES_CPU::serialize(NES_STATE& state) {
+	state.value(PC);
+	state.value(SP);
+	state.value(A);
+	state.value(X);
+	state.value(Y);
+	uint8_t status = getP(); //the flags are saved materialized, the format does not know about nzResult
+	state.value(status);
+	setP(status);
+	state.value(cycles);
+	state.value(irqLines);
+	state.value(nmiPending);
+}
+
+inline uint8_t NES_CPU::read(uint16_t address) { return bus->read(address); }
+inline void NES_CPU::write(uint16_t address, uint8_t value) { bus->write(address, value); }
+
 
 void NES_CPU::pushPCtoStack() {
 	uint8_t high = (PC & 0xff00) >> 8;
 	uint8_t low = PC & 0x00ff;
 
-	SP--;
-	memory[0x0100 + SP] = high;
-	SP--;
-	memory[0x0100 + SP] = low;
+	pushToStack(high);
+	pushToStack(low);
 
 #if CPU_DEBUG
 		printf("Pushed PC (%04x) to Stack\n", PC);
@@ -83,8 +115,8 @@ void NES_CPU::pushPCtoStack() {
 }
 
 void NES_CPU::retrievePCfromStack() {
-	uint8_t low = memory[0x0100 + SP++];
-	uint8_t high = memory[0x0100 + SP++];
+	uint8_t low = pullFromStack();
+	uint8_t high = pullFromStack();
 
 #if CPU_DEBUG
 		printf("PC is now %04x, retrieving from stack...\n", PC);
@@ -97,1330 +129,698 @@ void NES_CPU::retrievePCfromStack() {
 #endif
 }
 
-inline void NES_CPU::pushToStack(uint8_t value) { memory[--SP] = value; }
-inline uint8_t NES_CPU::pullFromStack() { return memory[SP++]; }
+inline void NES_CPU::pushToStack(uint8_t value) { write(0x0100 + SP--, value); }
+inline uint8_t NES_CPU::pullFromStack() { return read(0x0100 + ++SP); }
 
 
-uint8_t NES_CPU::ADC() {
-	/*
-	 * Add with Carry
-	 * A += target + Carry
-	 * Sets Carry Flag if Overflow occurs
-	 * Sets Overflow Flag if Overflow occurs
-	 * Sets Zero Flag if A==0
-	 * Sets Negative if bit 7 of A is set
-	 */
+uint8_t NES_CPU::runOp() {
 
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0x69:
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0x65:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0x75:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0x6d:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0x7d:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteXValue();
-		break;
-
-	case 0x79:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteYValue();
-		break;
-
-	case 0x61:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0x71:
-		bytes = 2;
-		cycles = 5; //TODO: +1 if page crossed
-		target = getIndirectYValue();
-		break;
-
-	default:
-		printf("ADC code %02x not implemented yet\n", memory[PC]);
-		return 0;
+	if(nmiPending || (irqLines != 0 && !isSetInterruptDisable())) {
+#if CPU_PROFILE
+		if(profile != NULL) profile->interrupts++;
+#endif
+		if(!nmiPending) return interrupt(0xfffe);
+		nmiPending = false;
+		return interrupt(0xfffa);
 	}
 
-	bool bit7before = isBitSet(A,7);
+#if CPU_PROFILE
+	uint16_t opPC = PC;
+#endif
+	opcode = read(PC);
+	const NES_OPCODE& op = opcodes[opcode];
 
-	A += target;
-	if(isSetCarryFlag()) A++;
+#if CPU_DEBUG
+	printf("Executing %02x %02x (%s) at %04x, cycle %llu\n", opcode, read(PC+1), op.name, PC, (unsigned long long) cycles);
+#endif
 
-	bool overflow = bit7before != isBitSet(A,7);
+#if CPU_TRACE
+	NES_TRACE_RECORD* record = NULL;
+	if(trace != NULL) {
+		record = trace->next();
+		record->PC = PC;
+		record->opcode = opcode;
+		record->operand1 = read(PC+1);
+		record->operand2 = read(PC+2);
+		record->A = A;
+		record->X = X;
+		record->Y = Y;
+		record->P = getP();
+		record->SP = SP;
+	}
+#endif
 
-	setCarryFlag(overflow);
-	setOverflow(overflow);
-	setZeroFlag(A==0);
-	setNegative(isBitSet(A,7));
+	mode = op.mode;
+	uint8_t pageCrossed = resolveAddress();
+	PC += op.bytes;
 
-	PC += bytes;
-	return cycles;
-}
+	uint8_t opCycles = op.cycles + (pageCrossed & op.pagePenalty) + (this->*op.handler)();
 
-uint8_t NES_CPU::AND() { //performs & on A, setting Zero and Negative when Appropriate
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0x21:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0x25:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0x29:
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0x2d:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0x31:
-		bytes = 2;
-		cycles = 5; //TODO: +1 if page crossed
-		target = getIndirectYValue();
-		break;
-
-	case 0x35:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0x39:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteYValue();
-		break;
-
-	case 0x3d:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteXValue();
-		break;
-
-	default:
-		printf("AND code %02x not implemented yet\n", memory[PC]);
+#if CPU_TRACE
+	if(record != NULL) record->cycles = opCycles;
+#endif
+
+	if(op.handler == &NES_CPU::KIL) {
+		PC -= op.bytes;
+		reportJam();
 		return 0;
 	}
 
-	A &= target;
-	setZeroFlag(A == 0);
-	setNegative(isBitSet(A, 7));
+#if CPU_PROFILE
+	if(profile != NULL) profile->record(opPC, opcode, opCycles);
+#endif
 
-	PC += bytes;
-	return cycles;
+	cycles += opCycles;
+	return opCycles;
 }
 
-uint8_t NES_CPU::ASL() { //Shifts target one bit to the left, places bit 7 in the carry flag
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t* target = NULL;
-	switch(memory[PC]) {
+void NES_CPU::reportJam() { //PC is at the jamming opcode
+	printf("Opcode %02x jammed the CPU\n", opcode);
+	if(PC >= 0x8000) {
+		long prgOffset = &bus->readMap[PC >> CPU_PAGE_SHIFT][PC & (CPU_PAGE_SIZE - 1)] - rom->prg_rom;
+		printf("Found at %04x which is %05lx in the PRG\n", PC, prgOffset);
+		printf("Which is %05lx in the ROM\n", prgOffset + (long) (rom->prg_rom - rom->romContents));
+	}
+}
 
-	case 0x06:
-		bytes = 2;
-		cycles = 5;
-		target = &memory[memory[PC+1]];
-		break;
+uint8_t NES_CPU::interrupt(uint16_t vector) { //Pushes PC and P without the Break bit, then jumps through vector
+	pushPCtoStack();
+	pushToStack((getP() & 0xef) | 0x20);
+	setInterruptDisable(1);
+	PC = combineLowHigh(read(vector), read(vector + 1));
 
+	cycles += 7;
+	return 7;
+}
 
-	default:
-		printf("ASL code %02x not implemented yet\n", memory[PC]);
-		return 0;
+bool NES_CPU::runUntil(uint64_t targetCycle) { //Runs whole instructions until targetCycle is reached, returns false if the CPU jammed
+#if CPU_THREADED && !CPU_DEBUG
+	if(trace == NULL && profile == NULL && jit == NULL) return runThreaded(targetCycle);
+#endif
+	while(cycles < targetCycle) {
+#if CPU_BLOCKS && !CPU_DEBUG
+		if(trace == NULL && profile == NULL && !nmiPending && (irqLines == 0 || isSetInterruptDisable())) {
+			NES_BLOCK* block = blocks.lookup(PC);
+			if(block != NULL) {
+				if(jit == NULL || !jit->run(*this, *block, targetCycle)) runBlock(*block, targetCycle);
+				continue;
+			}
+		}
+#endif
+		if(runOp() == 0) return false;
 	}
+	return true;
+}
 
-#if CPU_DEBUG
-		printf("Doing ASL on %02x\n", *target);
+#if CPU_THREADED
+#if !defined(__GNUC__)
+#error CPU_THREADED needs computed goto (GCC or Clang)
 #endif
 
-	//if(isBitSet(*target, 7)) setBit(&P, 0, 1);
-	//else setBit(&P, 0, 0);
-	setCarryFlag(isBitSet(*target, 7));
-	(*target) = (*target) << 1;
-	setNegative(isBitSet(*target, 7));
+bool NES_CPU::runThreaded(uint64_t targetCycle) {
+	/*
+	 * The same instructions as runOp, expanded from NES_OPCODES with the addressing mode as a constant
+	 * Every opcode ends in its own indirect jump to the next one, so the host predicts each jump from
+	 * the opcode before it instead of sharing one jump between all of them.
+	 * Interrupts go through runOp.
+	 */
+#define NES_THREADED_LABEL(code, handler, mode, cycles, penalty, official) &&op_##code,
+	static void* const dispatch[256] = { NES_OPCODES(NES_THREADED_LABEL) };
+#undef NES_THREADED_LABEL
+
+#define NES_THREADED_NEXT \
+	if(cycles >= targetCycle) return true; \
+	if(nmiPending || (irqLines != 0 && !isSetInterruptDisable())) goto interruptPending; \
+	opcode = read(PC); \
+	goto *dispatch[opcode];
+
+#define NES_THREADED_OP(code, handler, opMode, opCycles, penalty, official) \
+	op_##code: { \
+		if(&NES_CPU::handler == &NES_CPU::KIL) { /* the opcode may have been read from a register, so not again through runOp */ \
+			reportJam(); \
+			return false; \
+		} \
+		mode = opMode; \
+		uint8_t pageCrossed = resolveAddress(); \
+		PC += NES_MODE_BYTES(opMode); \
+		uint8_t opTotal = opCycles + (pageCrossed & penalty) + handler(); /* the handler may add OAM DMA cycles */ \
+		cycles += opTotal; \
+		NES_THREADED_NEXT \
+	}
 
-#if CPU_DEBUG
-		printf("Did ASL, P is now %02x\n", P);
-#endif
+	NES_THREADED_NEXT
 
+interruptPending:
+	runOp();
+	NES_THREADED_NEXT
 
-	PC+=bytes;
-	return cycles;
-}
+	NES_OPCODES(NES_THREADED_OP)
 
+#undef NES_THREADED_OP
+#undef NES_THREADED_NEXT
+}
+#endif
 
-uint8_t NES_CPU::BIT() {
+void NES_CPU::runBlock(const NES_BLOCK& block, uint64_t targetCycle) {
 	/*
-	 * A & target in memory (does NOT change A)
-	 * Sets Zero if the result is 0
-	 * Sets Overflow to bit 6 of the memory value
-	 * Sets Negative to bit 7 of the memory value
+	 * Runs a pre-decoded block with the same results as calling runOp for each of its instructions
+	 * Stops early where runOp would have to take over: at the budget, at a pending interrupt,
+	 * and after a write that banked out or overwrote the block. The budget only needs checking
+	 * when the block's worst case does not fit, or after a write, which may have started an OAM DMA.
 	 */
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0x2c:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0x24:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	default:
-		printf("BIT code %02x does not exist\n", memory[PC]);
-		return 0;
-	}
+	bool checkBudget = cycles + block.cycles >= targetCycle;
 
-	uint8_t result = A & target;
-	setZeroFlag(result == 0);
-	setOverflow(isBitSet(target, 6));
-	setNegative(isBitSet(target, 7));
+	for(uint8_t i = 0; i < block.length; ++i) {
+		const NES_DECODED_OP& op = block.ops[i];
 
-	PC += bytes;
-	return cycles;
-}
+		if(i > 0) {
+			if(checkBudget && cycles >= targetCycle) return;
+			if(nmiPending || (irqLines != 0 && !isSetInterruptDisable())) return;
+		}
 
+		opcode = op.opcode;
+		mode = op.mode;
+		PC = op.PC;
 
-uint8_t NES_CPU::BRK() {
+		uint8_t pageCrossed = 0;
+		if(op.resolved) addr = op.addr;
+		else pageCrossed = resolveAddress();
+
+		PC += op.bytes;
+		uint8_t opCycles = op.cycles + (pageCrossed & op.pagePenalty) + (this->*op.handler)(); //the handler may add OAM DMA cycles
+		cycles += opCycles;
+
+		if(op.writes) {
+			if(!blocks.isMapped(block.ops[0].PC, &block)) return;
+			checkBudget = true;
+		}
+	}
+}
+
+inline uint8_t NES_CPU::resolveAddress() {
 	/*
-	 * First pushes PC+2 to stack, then P
-	 * Loads Interrupt Vector from 0xfffe/f into PC
-	 * sets BRK
+	 * Sets addr to the effective address of the current instruction, PC still points at the opcode
+	 * Returns 1 if indexing crossed a page, the table decides whether that costs a cycle
 	 */
+	switch(mode) {
 
-	PC += 2;
+	case IMP:
+	case ACC:
+		return 0;
 
-	pushPCtoStack();
+	case IMM:
+		addr = getImmediateAddress();
+		return 0;
 
-	pushToStack(P);
+	case ZP0:
+		addr = getZeroPageAddress();
+		return 0;
 
-#if CPU_DEBUG
-		printf("Doing BRK, PC before was %04x\n", PC);
-#endif
+	case ZPX:
+		addr = getZeroPageXAddress();
+		return 0;
 
-	uint8_t low = memory[0xfffe];
-	uint8_t high = memory[0xffff];
+	case ZPY:
+		addr = getZeroPageYAddress();
+		return 0;
 
-	PC = combineLowHigh(low, high);
+	case ABS:
+		addr = getAbsoluteAddress();
+		return 0;
 
+	case ABX:
+		addr = getAbsoluteXAddress();
+		return isPageCrossed((uint16_t) (addr - X), addr);
 
-#if CPU_DEBUG
-		printf("PC is now %04x\n", PC);
-#endif
+	case ABY:
+		addr = getAbsoluteYAddress();
+		return isPageCrossed((uint16_t) (addr - Y), addr);
 
+	case IND:
+		addr = getIndirectAddress();
+		return 0;
 
-	setBRK(1);
+	case IZX:
+		addr = getIndirectXAddress();
+		return 0;
 
+	case IZY:
+		addr = getIndirectYAddress();
+		return isPageCrossed((uint16_t) (addr - Y), addr);
 
-	return 7;
+	case REL:
+		addr = getRelativeAddress();
+		return 0;
+	}
+
+	return 0;
 }
 
-/*uint8_t NES_CPU::BVC() { //Branch if overflow clear
+inline uint8_t NES_CPU::fetchOperand() { return mode == ACC ? A : read(addr); }
+inline void NES_CPU::storeOperand(uint8_t value) {
+	if(mode == ACC) A = value;
+	else write(addr, value);
+}
 
-	if(!isSetOverflow()) {
-		branchRelative();
-		PC += 2;
-		return 3; //TODO: +2 if new page
-	} else {
-		PC+=2;
-		return 2;
-	}
 
-}*/
+inline void NES_CPU::LDZ(uint8_t* Z) { //loads a byte into A, X or Y, setting Zero and Negative Flags when applicable
+	*Z = read(addr);
+	setZN(*Z);
+}
 
-uint8_t NES_CPU::CMP(uint8_t* Z) {
-	/*
-	 * Compares A to target
-	 * Sets Carry to A>=target
-	 * Sets Zero to A==target
-	 * Sets Negative if bit 7 of target is set
-	 */
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0xc1:
-		bytes = 2;
-		cycles = 6;
-		target =getIndirectXValue();
-		break;
-
-	case 0xc5:
-	case 0xe4:
-	case 0xc4:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0xc9:
-	case 0xe0:
-	case 0xc0:
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0xcd:
-	case 0xec:
-	case 0xcc:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0xd1:
-		bytes = 2;
-		cycles = 5; //TODO: +1 if page crossed
-		target =getIndirectYValue();
-		break;
-
-	case 0xd5:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0xd9:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteYValue();
-		break;
-
-	case 0xdd:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteXValue();
-		break;
-
-	default:
-		printf("CMP code %02x not implemented yet\n", memory[PC]);
-		return 0;
-	}
+inline void NES_CPU::STZ(uint8_t Z) { write(addr, Z); } //Stores Z into memory
 
-	setCarryFlag((*Z)>=target);
-	setZeroFlag((*Z)==target);
-	setNegative(isBitSet(target, 7));
+inline void NES_CPU::TZZ(uint8_t ZS, uint8_t* ZT) { //Transfers contents of ZS to ZT
+	*ZT = ZS;
+	setZN(*ZT);
+}
 
-	PC += bytes;
-	return cycles;
+inline void NES_CPU::INZ(uint8_t* Z) { //Increments Z, setting Zero and Negative when appropriate
+	(*Z)++;
+	setZN(*Z);
+}
 
+inline void NES_CPU::DEZ(uint8_t* Z) { //Decrements Z, setting Zero and Negative when appropriate
+	(*Z)--;
+	setZN(*Z);
 }
 
-uint8_t NES_CPU::DEZ(uint8_t* Z) { //Decrements Z, setting Zero and Negative when appropriate
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
+inline void NES_CPU::CPZ(uint8_t Z) { compareWith(Z, read(addr)); }
 
-	switch(memory[PC]) {
+inline void NES_CPU::compareWith(uint8_t Z, uint8_t target) {
+	/*
+	 * Compares Z to target
+	 * Sets Carry to Z>=target
+	 * Sets Zero to Z==target
+	 * Sets Negative if bit 7 of Z-target is set
+	 */
+	setCarryFlag(Z>=target);
+	setZN(Z - target);
+}
 
-	case 0xca:
-	case 0x88:
-		bytes = 1;
-		cycles = 2;
-		break;
+inline void NES_CPU::addWithCarry(uint8_t value) {
+	/*
+	 * A += value + Carry
+	 * Sets Carry Flag if the unsigned result does not fit into 8 bits
+	 * Sets Overflow Flag if the signed result does not fit into 8 bits
+	 * Sets Zero Flag if A==0
+	 * Sets Negative if bit 7 of A is set
+	 */
+	uint16_t sum = A + value + (isSetCarryFlag() ? 1 : 0);
+	uint8_t result = sum & 0xff;
 
-	case 0xce:
-		bytes = 3;
-		cycles = 6;
-		break;
+	setCarryFlag(sum > 0xff);
+	setOverflow(isBitSet(~(A ^ value) & (A ^ result), 7));
 
-	default:
-		printf("DEZZ code %02x not implemented yet\n", memory[PC]);
-		return 0;
-	}
+	A = result;
+	setZN(A);
+}
 
+/*
+ * Read-modify-write steps, each returns the byte it stored
+ * The unofficial combos pass that byte on instead of reading target again, which would touch an I/O register twice
+ */
+inline uint8_t NES_CPU::shiftLeft() { //Shifts target one bit to the left, places bit 7 in the carry flag
+	uint8_t target = fetchOperand();
 
-	(*Z)--;
-	setZeroFlag(*Z==0);
-	setNegative(isBitSet(*Z, 7));
+	setCarryFlag(isBitSet(target, 7));
+	target = target << 1;
+	setZN(target);
 
-	PC += bytes;
-	return cycles;
+	storeOperand(target);
+	return target;
 }
 
-uint8_t NES_CPU::EOR() { //performs bitwise XOR on A, setting Zero and Negative as appropriate
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0x49:
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0x45:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0x55:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0x4d:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0x5d:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteXValue();
-		break;
-
-	case 0x59:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteYValue();
-		break;
-
-	case 0x41:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0x51:
-		bytes = 2;
-		cycles = 5; //TODO: +1 if page crossed
-		target = getIndirectYValue();
-		break;
-
-	default:
-		printf("EOR code %02x not implemented yet\n", memory[PC]);
-	}
+inline uint8_t NES_CPU::shiftRight() {
+	/*
+	 * Shifts the target one to the right
+	 * sets Carry to old contents of bit 0
+	 * sets Zero Flag if result is 0
+	 * clears Negative Flag
+	 */
+	uint8_t target = fetchOperand();
+
+	setCarryFlag(isBitSet(target, 0));
+	target = target >> 1;
+	setZN(target);
 
-	A ^= target;
+	storeOperand(target);
+	return target;
+}
 
-	setZeroFlag(A==0);
-	setNegative(isBitSet(A, 7));
+inline uint8_t NES_CPU::rotateLeft() { //Rotates target one bit to the left through the carry flag
+	uint8_t target = fetchOperand();
+	bool carry = isSetCarryFlag();
 
-	PC+=bytes;
-	return cycles;
+	setCarryFlag(isBitSet(target, 7));
+	target = (target << 1) | (carry ? 1 : 0);
+	setZN(target);
 
+	storeOperand(target);
+	return target;
 }
 
-uint8_t NES_CPU::INZ(uint8_t* Z) { //Increments X, Y or a location in memory, setting Zero and Negative when appropriate
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
+inline uint8_t NES_CPU::rotateRight() { //Rotates target one bit to the right through the carry flag
+	uint8_t target = fetchOperand();
+	bool carry = isSetCarryFlag();
 
-	switch(memory[PC]) {
+	setCarryFlag(isBitSet(target, 0));
+	target = (target >> 1) | (carry ? 0x80 : 0);
+	setZN(target);
 
-	case 0xe8:
-	case 0xc8:
-		bytes = 1;
-		cycles = 2;
-		break;
+	storeOperand(target);
+	return target;
+}
 
-	case 0xf6:
-		bytes = 2;
-		cycles = 6;
-		break;
+inline uint8_t NES_CPU::incrementTarget() { //Increments a location in memory
+	uint8_t target = read(addr);
+	INZ(&target);
+	write(addr, target);
+	return target;
+}
 
-	case 0xfe:
-		bytes = 3;
-		cycles = 7;
-		break;
+inline uint8_t NES_CPU::decrementTarget() { //Decrements a location in memory
+	uint8_t target = read(addr);
+	DEZ(&target);
+	write(addr, target);
+	return target;
+}
 
-	default:
-		printf("INZ code %02x not implemented yet\n", memory[PC]);
+uint8_t NES_CPU::branchIfFlagSet(bool flag, bool isSet) {
+	bool branching = flag == isSet;
+	if(branching) { //a taken branch costs 1 cycle, 2 if the target is on another page than the next instruction
+		uint8_t extraCycles = 1 + isPageCrossed(PC, addr);
+		PC = addr;
+		return extraCycles;
+	} else {
 		return 0;
 	}
+}
 
-	(*Z)++;
-	setZeroFlag(*Z==0);
-	setNegative(isBitSet(*Z, 7));
 
-	PC += bytes;
-	return cycles;
+uint8_t NES_CPU::ADC() { addWithCarry(read(addr)); return 0; }
+
+uint8_t NES_CPU::AND() { //performs & on A, setting Zero and Negative when Appropriate
+	A &= read(addr);
+	setZN(A);
+	return 0;
 }
 
-uint8_t NES_CPU::JSR() { //Jump to Subroutine, takes 3 bytes but only pushes PC+2 onto stack
-	uint16_t addr = getAbsoluteAddress();
-	PC += 3; //6502 reference at obelisk says this should only be increased by 2, but in the nestest log it's increased by 3
-	pushPCtoStack();
-	PC = addr;
+uint8_t NES_CPU::ASL() { shiftLeft(); return 0; }
 
-	return 6;
+uint8_t NES_CPU::BCC() {return branchIfFlagSet(isSetCarryFlag(), false); }
+uint8_t NES_CPU::BCS() {return branchIfFlagSet(isSetCarryFlag(), true); }
+uint8_t NES_CPU::BEQ() {return branchIfFlagSet(isSetZeroFlag(), true); }
 
+uint8_t NES_CPU::BIT() {
+	/*
+	 * A & target in memory (does NOT change A)
+	 * Sets Zero if the result is 0
+	 * Sets Overflow to bit 6 of the memory value
+	 * Sets Negative to bit 7 of the memory value
+	 */
+	uint8_t target = read(addr);
+
+	setZeroFlag((A & target) == 0);
+	setOverflow(isBitSet(target, 6));
+	setNegative(isBitSet(target, 7));
+	return 0;
 }
 
-uint8_t NES_CPU::ORA() { //performs bitwise OR on A, setting Zero and Negative as appropriate
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0x09:
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0x05:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0x15:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0x0d:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0x1d:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteXValue();
-		break;
-
-	case 0x19:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteYValue();
-		break;
-
-	case 0x01:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0x11:
-		bytes = 2;
-		cycles = 5; //TODO: +1 if page crossed
-		target = getIndirectYValue();
-		break;
-
-	default:
-		printf("ORA code %02x not implemented yet\n", memory[PC]);
-	}
+uint8_t NES_CPU::BMI() {return branchIfFlagSet(isSetNegative(), true); }
+uint8_t NES_CPU::BNE() {return branchIfFlagSet(isSetZeroFlag(), false); }
+uint8_t NES_CPU::BPL() {return branchIfFlagSet(isSetNegative(), false); }
 
-	A |= target;
+uint8_t NES_CPU::BRK() {
+	/*
+	 * First pushes PC+2 to stack, then P with the Break bit set
+	 * Loads Interrupt Vector from 0xfffe/f into PC
+	 * sets Interrupt Disable
+	 */
 
-	setZeroFlag(A==0);
-	setNegative(isBitSet(A, 7));
+	PC++; //BRK skips a padding byte
 
-	PC+=bytes;
-	return cycles;
+	pushPCtoStack();
 
-}
+	pushToStack(getP() | 0x30);
 
-uint8_t NES_CPU::PLA() { //Pulls value from stack into A, setting Zero and Negative as appropriate
-	A = pullFromStack();
-	setZeroFlag(A==0);
-	setNegative(isBitSet(A,7));
-	PC++;
-	return 4;
-}
+#if CPU_DEBUG
+		printf("Doing BRK, PC before was %04x\n", PC);
+#endif
 
-uint8_t NES_CPU::JMP() { //Jumps to target
-	uint8_t cycles = 0;
-	uint16_t target = 0;
+	setInterruptDisable(1);
 
-	switch(memory[PC]) {
+	PC = combineLowHigh(read(0xfffe), read(0xffff));
 
-	case 0x4c:
-		cycles = 3;
-		target = getAbsoluteAddress();
-		break;
+#if CPU_DEBUG
+		printf("PC is now %04x\n", PC);
+#endif
 
-	case 0x6c:
-		cycles = 5;
-		target = getIndirectValue(); //TODO: Fix to Indirect Address
-		break;
+	return 0;
+}
 
-	default:
-		printf("JMP Code %02x does not exist\n", memory[PC]);
-		return 0;
-	}
+uint8_t NES_CPU::BVC() {return branchIfFlagSet(isSetOverflow(), false); }
+uint8_t NES_CPU::BVS() {return branchIfFlagSet(isSetOverflow(), true); }
+
+uint8_t NES_CPU::CLC() { setCarryFlag(0); return 0; }
+uint8_t NES_CPU::CLD() { setDecimalMode(0); return 0; }
+uint8_t NES_CPU::CLI() { setInterruptDisable(0); return 0; }
+uint8_t NES_CPU::CLV() { setOverflow(0); return 0; }
+
+uint8_t NES_CPU::CMP() { CPZ(A); return 0; }
+uint8_t NES_CPU::CPX() { CPZ(X); return 0; }
+uint8_t NES_CPU::CPY() { CPZ(Y); return 0; }
 
-	PC = target;
+uint8_t NES_CPU::DEC() { decrementTarget(); return 0; }
 
-	return cycles;
+uint8_t NES_CPU::DEX() { DEZ(&X); return 0; }
+uint8_t NES_CPU::DEY() { DEZ(&Y); return 0; }
 
+uint8_t NES_CPU::EOR() { //performs bitwise XOR on A, setting Zero and Negative as appropriate
+	A ^= read(addr);
+	setZN(A);
+	return 0;
 }
 
-uint8_t NES_CPU::LDZ(uint8_t* Z) { //loads a byte into A, X or Y, setting Zero and Negative Flags when applicable
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0xa1:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0xa5:
-	case 0xa6:
-	case 0xa4:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0xa9: //Immediate addressing mode
-	case 0xa2:
-	case 0xa0:
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0xad: //Absolute addressing mode
-	case 0xae:
-	case 0xac:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0xb1:
-		bytes = 2;
-		cycles = 5; //TODO: +1 if page crossed
-		target = getIndirectYValue();
-		break;
-
-	case 0xb5:
-	case 0xb4:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0xb6:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageYValue();
-		break;
-
-	case 0xb9:
-	case 0xbe:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteYValue();
-		break;
-
-	case 0xbd:
-	case 0xbc:
-		bytes = 3;
-		cycles = 4; //TODO: +1 if page crossed
-		target = getAbsoluteXValue();
-		break;
-
-	default:
-		printf("LDZ code %02x does not exist\n", memory[PC]);
-		return 0;
-	}
+uint8_t NES_CPU::INC() { incrementTarget(); return 0; }
 
-	*Z = target;
-	setZeroFlag(*Z==0);
-	setNegative(isBitSet(*Z, 7));
+uint8_t NES_CPU::INX() { INZ(&X); return 0; }
+uint8_t NES_CPU::INY() { INZ(&Y); return 0; }
 
-	PC += bytes;
-	return cycles;
+uint8_t NES_CPU::JMP() { PC = addr; return 0; } //Jumps to target
 
+uint8_t NES_CPU::JSR() { //Jump to Subroutine, pushes the address of the last byte of the JSR onto the stack
+	PC--;
+	pushPCtoStack();
+	PC = addr;
+	return 0;
 }
 
-uint8_t NES_CPU::LSR() {
-	/*
-	 * Shifts the target one to the right
-	 * sets Carry to old contents of bit 0
-	 * sets Zero Flag if result is 0
-	 * sets Negative Flag if bit 7 of result is set (should never happen)
-	 */
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t* target = NULL;
+uint8_t NES_CPU::LDA() { LDZ(&A); return 0; }
+uint8_t NES_CPU::LDX() { LDZ(&X); return 0; }
+uint8_t NES_CPU::LDY() { LDZ(&Y); return 0; }
 
-	switch(memory[PC]) {
+uint8_t NES_CPU::LSR() { shiftRight(); return 0; }
 
-	case 0x4a:
-		bytes = 1;
-		cycles = 2;
-		target = &A;
-		break;
-
-	default:
-		printf("LSR code %02x not implemented yet\n", memory[PC]);
-	}
+uint8_t NES_CPU::NOP() { //Unofficial NOPs with an operand still perform the read
+	if(mode != IMP) read(addr);
+	return 0;
+}
 
-	setCarryFlag(isBitSet(*target, 0));
-	(*target) = (*target) >> 1;
-	setZeroFlag(*target == 0);
-	if(isBitSet(*target, 7)) {
-		printf("ERROR: Bit 7 is set after LSR\n");
-		setNegative(1);
-	} else setNegative(0);
+uint8_t NES_CPU::ORA() { //performs bitwise OR on A, setting Zero and Negative as appropriate
+	A |= read(addr);
+	setZN(A);
+	return 0;
+}
 
-	PC += bytes;
-	return cycles;
+uint8_t NES_CPU::PHA() { pushToStack(A); return 0; } //Push A
+uint8_t NES_CPU::PHP() { pushToStack(getP() | 0x30); return 0; } //Push Processor Status, always with the Break bit set
 
+uint8_t NES_CPU::PLA() { //Pulls value from stack into A, setting Zero and Negative as appropriate
+	A = pullFromStack();
+	setZN(A);
+	return 0;
 }
 
-inline uint8_t NES_CPU::RTI() { P = pullFromStack(); retrievePCfromStack(); return 6; }
+uint8_t NES_CPU::PLP() { setP((pullFromStack() & 0xef) | 0x20); return 0; } //Pull Processor Status, Break bit does not exist in P
 
-uint8_t NES_CPU::SBC() {
-	/*
-	 * A-M-(1-C)
-	 * Subtracts the target and the NOT of the Carry bit from A
-	 * Clears the Carry Flag if an overflow occurs
-	 * Sets Zero Flag if A==0
-	 * Sets Overflow Flag if overflow occurs
-	 * Sets Negative Flag if bit 7 of A is set afterwards
-	 */
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint8_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0xe1:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0xe5:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0xe9:
-	case 0xeb: //Unofficial opcode
-		bytes = 2;
-		cycles = 2;
-		target = getImmediateValue();
-		break;
-
-	case 0xed:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0xf1:
-		bytes = 2;
-		cycles = 5; //TODO:Increase cycles if page is crossed
-		target = getIndirectYValue();
-		break;
-
-	case 0xf5:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0xf9:
-		bytes = 3;
-		cycles = 4; //TODO:Increase cycles if page crossed
-		target= getAbsoluteYValue();
-		break;
-
-	case 0xfd:
-		bytes = 3;
-		cycles = 4; //TODO:Increase cycles if page crossed
-		target= getAbsoluteXValue();
-		break;
-
-	default:
-		printf("SBC code %02x not implemented yet\n", memory[PC]);
-	}
+uint8_t NES_CPU::ROL() { rotateLeft(); return 0; }
+
+uint8_t NES_CPU::ROR() { rotateRight(); return 0; }
 
-	bool bit7before = isBitSet(A, 7);
+uint8_t NES_CPU::RTI() { //Return from Interrupt
+	PLP();
+	retrievePCfromStack();
+	return 0;
+}
 
-	A -= target;
-	if(!isSetCarryFlag()) A--;
+uint8_t NES_CPU::RTS() { //Return from Subroutine, JSR pushed the address of its last byte
+	retrievePCfromStack();
+	PC++;
+	return 0;
+}
 
-	bool bit7after = isBitSet(A, 7);
+uint8_t NES_CPU::SBC() { addWithCarry(~read(addr)); return 0; } //A-M-(1-C) is A+~M+C
 
-	setZeroFlag(A==0);
-	setNegative(bit7after);
+uint8_t NES_CPU::SEC() { setCarryFlag(1); return 0; }
+uint8_t NES_CPU::SED() { setDecimalMode(1); return 0; }
+uint8_t NES_CPU::SEI() { setInterruptDisable(1); return 0; }
 
-	if(bit7before != bit7after) {
-		setCarryFlag(0);
-		setOverflow(1);
-	}
+uint8_t NES_CPU::STA() { STZ(A); return 0; }
+uint8_t NES_CPU::STX() { STZ(X); return 0; }
+uint8_t NES_CPU::STY() { STZ(Y); return 0; }
 
-	PC += bytes;
-	return cycles;
+uint8_t NES_CPU::TAX() { TZZ(A, &X); return 0; }
+uint8_t NES_CPU::TAY() { TZZ(A, &Y); return 0; }
+uint8_t NES_CPU::TSX() { TZZ(SP, &X); return 0; }
+uint8_t NES_CPU::TXA() { TZZ(X, &A); return 0; }
+uint8_t NES_CPU::TXS() { SP = X; return 0; } //Does not affect any flags
+uint8_t NES_CPU::TYA() { TZZ(Y, &A); return 0; }
 
-}
 
-uint8_t NES_CPU::STZ(uint8_t Z) { //Stores Z into memory
-	uint8_t bytes = 0;
-	uint8_t cycles = 0;
-	uint16_t target = 0;
-
-	switch(memory[PC]) {
-
-	case 0x81:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectXValue();
-		break;
-
-	case 0x85:
-	case 0x86:
-	case 0x84:
-		bytes = 2;
-		cycles = 3;
-		target = getZeroPageValue();
-		break;
-
-	case 0x8d:
-	case 0x8e:
-	case 0x8c:
-		bytes = 3;
-		cycles = 4;
-		target = getAbsoluteValue();
-		break;
-
-	case 0x91:
-		bytes = 2;
-		cycles = 6;
-		target = getIndirectYValue();
-		break;
-
-	case 0x95:
-	case 0x94:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageXValue();
-		break;
-
-	case 0x96:
-		bytes = 2;
-		cycles = 4;
-		target = getZeroPageYValue();
-		break;
-
-	case 0x99:
-		bytes = 3;
-		cycles = 5;
-		target = getAbsoluteYValue();
-		break;
-
-	case 0x9d:
-		bytes = 3;
-		cycles = 5;
-		target = getAbsoluteXValue();
-		break;
-
-
-
-	default:
-		printf("STZ code %02x not implemented yet\n", memory[PC]);
-		return 0;
-	}
+/*
+ * Unofficial opcodes
+ * The unstable ones (AHX, SHX, SHY, TAS, XAA) use the behaviour most commonly observed on real hardware
+ */
 
-	memory[target] = Z;
-	PC += bytes;
-	return cycles;
+uint8_t NES_CPU::AHX() { STZ(A & X & ((addr >> 8) + 1)); return 0; }
 
+uint8_t NES_CPU::ALR() { //AND followed by LSR A
+	A &= read(addr);
+	mode = ACC;
+	return LSR();
 }
 
-uint8_t NES_CPU::TZZ(uint8_t ZS, uint8_t* ZT) { //Transfers contents of ZS to ZT
-	*ZT = ZS;
-	setZeroFlag(*ZT == 0);
-	setNegative(isBitSet(*ZT,7));
-	PC++;
-	return 2;
+uint8_t NES_CPU::ANC() { //AND, then copies bit 7 of the result into Carry
+	AND();
+	setCarryFlag(isBitSet(A, 7));
+	return 0;
 }
 
+uint8_t NES_CPU::ARR() { //AND followed by ROR A, Carry and Overflow are taken from bits 6 and 5
+	A &= read(addr);
+	A = (A >> 1) | (isSetCarryFlag() ? 0x80 : 0);
+	setZN(A);
+	setCarryFlag(isBitSet(A, 6));
+	setOverflow(isBitSet(A, 6) != isBitSet(A, 5));
+	return 0;
+}
 
-uint8_t NES_CPU::runOp() {
+uint8_t NES_CPU::AXS() { //X = (A & X) - target, sets flags like CMP
+	uint8_t target = read(addr);
+	uint8_t ax = A & X;
+	setCarryFlag(ax >= target);
+	X = ax - target;
+	setZN(X);
+	return 0;
+}
 
-#if CPU_DEBUG
-	printf("Executing %02x %02x at %04x, Instruction no. %i\n", memory[PC], memory[PC+1], PC,  d_totalInstructions++);
-#endif
-
-	switch(memory[PC]) {
-
-	case 0x00:
-		return BRK();
-		break;
-
-	case 0x08:
-		pushToStack(P);
-		PC++;
-		return 3;
-		break;
-
-	case 0x09:
-		case 0x05:
-		case 0x15:
-		case 0x0d:
-		case 0x1d:
-		case 0x19:
-		case 0x01:
-		case 0x11:
-			return ORA();
-
-	case 0x0a:
-		case 0x06:
-		case 0x16:
-		case 0x0e:
-		case 0x1e:
-			return ASL();
-			break;
-
-	case 0x10:
-		return BPL();
-
-	case 0x14: //IGN - Unofficial, reads from an address and ignores it, TODO: Possible side effects of this
-		case 0x34:
-		case 0x54:
-		case 0x74:
-		case 0xd4:
-		case 0xf4:
-			PC += 2;
-			return 4;
-			break;
-
-	case 0x18:
-		setCarryFlag(false);
-		PC++;
-		return 2;
-
-	case 0x1c: //IGN with absolute addressing, not sure about cycle count
-		case 0x3c:
-		case 0x5c:
-		case 0x7c:
-		case 0xdc:
-		case 0xfc:
-			PC += 3;
-			return 4; //maybe 5?
-			break;
-
-	case 0x1a:
-		case 0x3a:
-		case 0x5a:
-		case 0x7a:
-		case 0xda:
-		case 0xea:
-		case 0xfa:
-			PC+=1;
-			return 2; //NOP
-			break;
-
-	case 0x20:
-		return JSR();
-
-	case 0x24:
-		case 0x2c:
-			return BIT();
-
-	case 0x28:
-		P = pullFromStack();
-		PC++;
-		return 4; //PLP, Pull Processor Status
-
-	case 0x29:
-		case 0x25:
-		case 0x35:
-		case 0x2d:
-		case 0x3d:
-		case 0x39:
-		case 0x21:
-		case 0x31:
-			return AND();
-
-	case 0x30:
-		return BMI();
-
-	case 0x38:
-		setCarryFlag(true);
-		PC++;
-		return 2;
-
-	case 0x40:
-		return RTI();
-
-	case 0x48:
-		pushToStack(A);
-		PC++;
-		return 3; //PHA, push A
-
-	case 0x49:
-		case 0x45:
-		case 0x55:
-		case 0x4d:
-		case 0x5d:
-		case 0x59:
-		case 0x41:
-		case 0x51:
-			return EOR();
-
-	case 0x4a:
-		case 0x46:
-		case 0x56:
-		case 0x4e:
-		case 0x5e:
-			return LSR();
-
-	case 0x4c:
-		case 0x6c:
-			return JMP();
-
-	case 0x50:
-		return BVC();
-
-	case 0x60:
-		retrievePCfromStack();
-		return 6; //RTS, return from subroutine
-
-	case 0x68:
-		return PLA();
-
-	case 0x69:
-		case 0x65:
-		case 0x75:
-		case 0x6d:
-		case 0x7d:
-		case 0x79:
-		case 0x61:
-		case 0x71:
-			return ADC();
-
-	case 0x70:
-		return BVS();
-
-	case 0x78:
-		setInterruptDisable(1);
-		PC+=1;
-		return 2;
-		break;
-
-	case 0x84:
-		case 0x94:
-		case 0x8c:
-			return STZ(Y);
-			break;
-
-	case 0x85:
-		case 0x95:
-		case 0x8d:
-		case 0x9d:
-		case 0x99:
-		case 0x81:
-		case 0x91:
-			return STZ(A);
-			break;
-
-	case 0x86:
-		case 0x96:
-		case 0x8e:
-			return STZ(X);
-			break;
-
-	case 0x88:
-		return DEZ(&Y);
-
-	case 0x90:
-		return BCC();
-
-	case 0x9a:
-		SP = X;
-		PC += 1;
-		return 2;
-
-	case 0xa0:
-		case 0xa4:
-		case 0xb4:
-		case 0xac:
-		case 0xbc:
-			return LDZ(&Y);
-
-	case 0xa2:
-		case 0xa6:
-		case 0xb6:
-		case 0xae:
-		case 0xbe:
-			return LDZ(&X);
-			break;
-
-	case 0xa9:
-		case 0xa5:
-		case 0xb5:
-		case 0xad:
-		case 0xbd:
-		case 0xb9:
-		case 0xa1:
-		case 0xb1:
-			return LDZ(&A);
-			break;
-
-	case 0xb0:
-		return BCS();
-
-	case 0xb8:
-		setOverflow(false);
-		PC++;
-		return 2;
-
-	case 0xc0:
-		case 0xc4:
-		case 0xcc:
-			return CMP(&Y);
-			break;
-
-	case 0xc8:
-		return INZ(&Y);
-
-
-	case 0xc9:
-		case 0xc5:
-		case 0xd5:
-		case 0xcd:
-		case 0xdd:
-		case 0xd9:
-		case 0xc1:
-		case 0xd1:
-			return CMP(&A);
-			break;
-
-	case 0xca:
-		return DEZ(&X);
-		break;
-
-	case 0xce:
-		return DEZ(&memory[combineLowHigh(memory[PC+1], memory[PC+2])]);
-		break;
-
-	case 0xd0:
-		return BNE();
-
-	case 0xd8:
-		setDecimalMode(0);
-		PC+=1;
-		return 2;
-		break;
-
-	case 0xe0:
-		case 0xe4:
-		case 0xec:
-			return CMP(&X);
-
-	case 0xe8:
-		return INZ(&X);
-
-	case 0xe9:
-		case 0xeb:
-		case 0xe5:
-		case 0xf5:
-		case 0xed:
-		case 0xfd:
-		case 0xf9:
-		case 0xe1:
-		case 0xf1:
-			return SBC();
-
-	case 0xf0:
-		return BEQ();
-
-	case 0xf6:
-		return INZ(&memory[(uint8_t) (memory[PC+1] + X)]);
-		break;
-
-	case 0xf8:
-		setDecimalMode(1);
-		PC++;
-		return 2;
-		break;
-
-	case 0xfe:
-		return INZ(getAbsoluteXAddress());
-
-	case 0xaa:
-		return TZZ(A, &X);
-
-	case 0xa8:
-		return TZZ(A, &Y);
-
-	case 0xba:
-		return TZZ(SP, &X);
-
-	case 0x8a:
-		return TZZ(X, &A);
-
-	case 0x98:
-		return TZZ(Y, &A);
+uint8_t NES_CPU::DCP() { compareWith(A, decrementTarget()); return 0; }
+uint8_t NES_CPU::ISB() { addWithCarry(~incrementTarget()); return 0; }
 
+uint8_t NES_CPU::KIL() { return 0; } //Jams the CPU, runOp reports it as a fault
 
+uint8_t NES_CPU::LAS() { //A, X and SP are set to target & SP
+	SP &= read(addr);
+	A = SP;
+	X = SP;
+	setZN(A);
+	return 0;
+}
 
+uint8_t NES_CPU::LAX() { LDZ(&A); X = A; return 0; }
 
-	default:
-		printf("Opcode %02x not implemented yet\n", memory[PC]);
-		printf("Found at %04x which should be %04x in the PRG\n", PC, rom->prg_banks <= 1 ? PC-0xC000 : PC-0x8000);
-		printf("Which should be %04x in the ROM\n", rom->prg_banks <= 1 ? PC-0xC000+16 : PC-0x8000+16);
-		return 0;
-	}
+uint8_t NES_CPU::RLA() { //ROL, then AND with the rotated byte
+	A &= rotateLeft();
+	setZN(A);
+	return 0;
 }
 
-uint8_t NES_CPU::branchIfFlagSet(bool flag, bool isSet) {
-	bool branching = flag == isSet;
-	if(branching) {
-		branchRelative();
-		PC += 2;
-		return 3; //TODO: +2 if new page
-	} else {
-		PC += 2;
-		return 2;
-	}
-}
+uint8_t NES_CPU::RRA() { addWithCarry(rotateRight()); return 0; } //ROR, then ADC with the rotated byte
 
-inline uint8_t NES_CPU::BCS() {return branchIfFlagSet(isSetCarryFlag(), true); }
-inline uint8_t NES_CPU::BCC() {return branchIfFlagSet(isSetCarryFlag(), false); }
-inline uint8_t NES_CPU::BEQ() {return branchIfFlagSet(isSetZeroFlag(), true); }
-inline uint8_t NES_CPU::BNE() {return branchIfFlagSet(isSetZeroFlag(), false); }
-inline uint8_t NES_CPU::BMI() {return branchIfFlagSet(isSetNegative(), false); }
-inline uint8_t NES_CPU::BPL() {return branchIfFlagSet(isSetNegative(), true); }
-inline uint8_t NES_CPU::BVC() {return branchIfFlagSet(isSetOverflow(), false); }
-inline uint8_t NES_CPU::BVS() {return branchIfFlagSet(isSetOverflow(), true); }
-
-
-inline void NES_CPU::setCarryFlag(bool value) { setBit(&P, 0, value); }
-inline void NES_CPU::setZeroFlag(bool value) { setBit(&P, 1, value); }
-inline void NES_CPU::setInterruptDisable(bool value) { setBit(&P, 2, value); }
-inline void NES_CPU::setDecimalMode(bool value) { setBit(&P, 3, value); }
-inline void NES_CPU::setBRK(bool value) { setBit(&P, 4, value); }
-inline void NES_CPU::setOverflow(bool value) { setBit(&P, 6, value); }
-inline void NES_CPU::setNegative(bool value) { setBit(&P, 7, value); }
-
-inline bool NES_CPU::isSetCarryFlag() {return isBitSet(P, 0); }
-inline bool NES_CPU::isSetZeroFlag() {return isBitSet(P, 1); }
-inline bool NES_CPU::isSetInterruptDisable() {return isBitSet(P, 2); }
-inline bool NES_CPU::isSetDecimalMode() {return isBitSet(P, 3); }
-inline bool NES_CPU::isSetBRK() {return isBitSet(P, 4); }
-inline bool NES_CPU::isSetOverflow() {return isBitSet(P, 6); }
-inline bool NES_CPU::isSetNegative() {return isBitSet(P, 7); }
-
-inline uint8_t NES_CPU::getImmediateValue() {return memory[PC+1]; }
-inline uint8_t NES_CPU::getZeroPageValue() {return memory[memory[PC+1]]; }
-inline uint8_t NES_CPU::getZeroPageXValue() {return memory[memory[PC+1]+X]; }
-inline uint8_t NES_CPU::getZeroPageYValue() {return memory[memory[PC+1]+Y]; }
-inline uint8_t NES_CPU::getAbsoluteValue() {return memory[combineLowHigh(memory[PC+1], memory[PC+2])]; }
-inline uint16_t NES_CPU::getAbsoluteAddress() {return combineLowHigh(memory[PC+1], memory[PC+2]); }
-inline uint8_t NES_CPU::getAbsoluteXValue() {return memory[combineLowHigh(memory[PC+1], memory[PC+2])+X]; }
-inline uint8_t NES_CPU::getAbsoluteYValue() {return memory[combineLowHigh(memory[PC+1], memory[PC+2])+Y]; }
-inline uint8_t NES_CPU::getIndirectValue() {
-	uint8_t addr = getAbsoluteValue();
-	return memory[combineLowHigh(memory[addr], memory[addr+1])];
+uint8_t NES_CPU::SAX() { STZ(A & X); return 0; }
+uint8_t NES_CPU::SHX() { STZ(X & ((addr >> 8) + 1)); return 0; }
+uint8_t NES_CPU::SHY() { STZ(Y & ((addr >> 8) + 1)); return 0; }
+
+uint8_t NES_CPU::SLO() { //ASL, then ORA with the shifted byte
+	A |= shiftLeft();
+	setZN(A);
+	return 0;
 }
-inline uint8_t NES_CPU::getIndirectXValue() {
-	uint8_t addr = memory[PC+1] + X;
-	return memory[combineLowHigh(memory[addr], memory[addr+1])];
+
+uint8_t NES_CPU::SRE() { //LSR, then EOR with the shifted byte
+	A ^= shiftRight();
+	setZN(A);
+	return 0;
 }
-inline uint8_t NES_CPU::getIndirectYValue() {
-	uint8_t addr = memory[PC+1] + Y;
-	return memory[combineLowHigh(memory[addr], memory[addr+1])];
+
+uint8_t NES_CPU::TAS() { //SP = A & X, then stores SP & (high byte of target + 1)
+	SP = A & X;
+	STZ(SP & ((addr >> 8) + 1));
+	return 0;
 }
 
-inline uint8_t* NES_CPU::getZeroPageAddress() {return &memory[memory[PC+1]]; }
-inline uint8_t* NES_CPU::getZeroPageXAddress() {return &memory[memory[PC+1]+X]; }
-inline uint8_t* NES_CPU::getZeroPageYAddress() {return &memory[memory[PC+1]+Y]; }
-inline uint8_t* NES_CPU::getAbsoluteAddressP() {return &memory[combineLowHigh(memory[PC+1], memory[PC+2])]; }
-inline uint8_t* NES_CPU::getAbsoluteXAddress() {return &memory[combineLowHigh(memory[PC+1], memory[PC+2])+X]; }
-inline uint8_t* NES_CPU::getAbsoluteYAddress() {return &memory[combineLowHigh(memory[PC+1], memory[PC+2])+Y]; }
-inline uint8_t* NES_CPU::getIndirectAddress() {
-	uint8_t addr = getAbsoluteValue();
-	return &memory[combineLowHigh(memory[addr], memory[addr+1])];
+uint8_t NES_CPU::XAA() { //A = (A | magic) & X & target, the magic constant differs between chips
+	A = (A | 0xee) & X & read(addr);
+	setZN(A);
+	return 0;
 }
-inline uint8_t* NES_CPU::getIndirectXAddress() {
-	uint8_t addr = memory[PC+1] + X;
-	return &memory[combineLowHigh(memory[addr], memory[addr+1])];
+
+
+inline void NES_CPU::setCarryFlag(bool value) { P = (P & 0xfe) | (value ? 0x01 : 0); }
+inline void NES_CPU::setInterruptDisable(bool value) { P = (P & 0xfb) | (value ? 0x04 : 0); }
+inline void NES_CPU::setDecimalMode(bool value) { P = (P & 0xf7) | (value ? 0x08 : 0); }
+inline void NES_CPU::setBRK(bool value) { P = (P & 0xef) | (value ? 0x10 : 0); }
+inline void NES_CPU::setOverflow(bool value) { P = (P & 0xbf) | (value ? 0x40 : 0); }
+
+//Zero and Negative on their own, for the few instructions that do not take both from one result
+inline void NES_CPU::setZeroFlag(bool value) { nzResult = (isSetNegative() ? 0x100 : 0) | (value ? 0 : 1); }
+inline void NES_CPU::setNegative(bool value) { nzResult = (value ? 0x100 : 0) | (isSetZeroFlag() ? 0 : 1); }
+
+inline bool NES_CPU::isSetCarryFlag() {return (P & 0x01) != 0; }
+inline bool NES_CPU::isSetZeroFlag() {return (nzResult & 0xff) == 0; }
+inline bool NES_CPU::isSetInterruptDisable() {return (P & 0x04) != 0; }
+inline bool NES_CPU::isSetDecimalMode() {return (P & 0x08) != 0; }
+inline bool NES_CPU::isSetBRK() {return (P & 0x10) != 0; }
+inline bool NES_CPU::isSetOverflow() {return (P & 0x40) != 0; }
+inline bool NES_CPU::isSetNegative() {return (nzResult & 0x180) != 0; }
+
+inline uint8_t NES_CPU::getImmediateValue() {return read(getImmediateAddress()); }
+inline uint8_t NES_CPU::getZeroPageValue() {return read(getZeroPageAddress()); }
+inline uint8_t NES_CPU::getZeroPageXValue() {return read(getZeroPageXAddress()); }
+inline uint8_t NES_CPU::getZeroPageYValue() {return read(getZeroPageYAddress()); }
+inline uint8_t NES_CPU::getAbsoluteValue() {return read(getAbsoluteAddress()); }
+inline uint8_t NES_CPU::getAbsoluteXValue() {return read(getAbsoluteXAddress()); }
+inline uint8_t NES_CPU::getAbsoluteYValue() {return read(getAbsoluteYAddress()); }
+inline uint8_t NES_CPU::getIndirectXValue() {return read(getIndirectXAddress()); }
+inline uint8_t NES_CPU::getIndirectYValue() {return read(getIndirectYAddress()); }
+
+inline uint16_t NES_CPU::getImmediateAddress() {return PC+1; }
+inline uint16_t NES_CPU::getZeroPageAddress() {return read(PC+1); }
+inline uint16_t NES_CPU::getZeroPageXAddress() {return (uint8_t) (read(PC+1) + X); }
+inline uint16_t NES_CPU::getZeroPageYAddress() {return (uint8_t) (read(PC+1) + Y); }
+inline uint16_t NES_CPU::getAbsoluteAddress() {return combineLowHigh(read(PC+1), read(PC+2)); }
+inline uint16_t NES_CPU::getAbsoluteXAddress() {return getAbsoluteAddress() + X; }
+inline uint16_t NES_CPU::getAbsoluteYAddress() {return getAbsoluteAddress() + Y; }
+inline uint16_t NES_CPU::getIndirectAddress() { //The 6502 does not carry into the high byte when fetching the pointer
+	uint16_t pointer = getAbsoluteAddress();
+	return combineLowHigh(read(pointer), read((pointer & 0xff00) | ((pointer + 1) & 0x00ff)));
 }
-inline uint8_t* NES_CPU::getIndirectYAddress() {
-	uint8_t addr = memory[PC+1] + Y;
-	return &memory[combineLowHigh(memory[addr], memory[addr+1])];
+inline uint16_t NES_CPU::getIndirectXAddress() {
+	uint8_t pointer = read(PC+1) + X;
+	return combineLowHigh(read(pointer), read((uint8_t) (pointer+1)));
 }
-
-inline void NES_CPU::branchRelative() {
-	uint8_t offset = memory[PC+1];
-	if(isBitSet(offset, 7)) {
-		offset = offset & 0b01111111;
-		PC -= offset;
-	} else PC += offset;
+inline uint16_t NES_CPU::getIndirectYAddress() {
+	uint8_t pointer = read(PC+1);
+	return combineLowHigh(read(pointer), read((uint8_t) (pointer+1))) + Y;
 }
+inline uint16_t NES_CPU::getRelativeAddress() {return PC + 2 + (int8_t) read(PC+1); }
 
 void NES_CPU::d_printMemFromPC() {
 	printf("Dumping the first KB of Memory located at PC: \n");
 	for(int i = 0; i < 1024; ++i) {
 		for(int j = 0; j++ < 16; ++i) {
-			printf("%02x ", memory[PC + i]);
+			printf("%02x ", read(PC + i));
 		}
 		printf("\n");
 		i--;
@@ -1,23 +1,89 @@
-
 #ifndef NES_CPU_H_
 #define NES_CPU_H_
 
 #include "NES_ROM.h"
+#include "NES_BUS.h"
+#include "NES_MAPPER.h"
+#include "NES_OPCODES.h"
+#include "NES_TRACE.h"
+#include "NES_BLOCK.h"
+
+class NES_CPU;
+class NES_STATE;
+class NES_JIT;
+class NES_PROFILE;
+
+//Sources that can hold the IRQ line
+#define IRQ_MAPPER 0x01
+#define IRQ_FRAME 0x02 //APU frame counter
+#define IRQ_DMC 0x04
+
+struct NES_OPCODE {
+	uint8_t (NES_CPU::*handler)(); //returns cycles on top of the base cycles
+	uint8_t mode; //NES_ADDRMODE
+	uint8_t bytes;
+	uint8_t cycles;
+	uint8_t pagePenalty; //1 if crossing a page while indexing costs a cycle
+	bool official;
+	const char* name;
+};
 
 class NES_CPU {
 public:
 
-	uint16_t PC;
+	/*
+	 * Cold state comes first and everything touched by every instruction last, in one cache line that ends
+	 * the object. NES places the bus right behind the CPU, so the registers, the page tables and RAM
+	 * form one contiguous run of cache lines.
+	 */
+	NES_ROM* rom;
+	NES_MAPPER* mapper;
+
+	NES_TRACE* trace; //optional, NULL when not tracing
+	NES_PROFILE* profile; //optional, NULL when not profiling
+
+	NES_BLOCK_CACHE blocks; //used by runUntil unless tracing or profiling
+	NES_JIT* jit; //optional, NULL to interpret every block
+
+	alignas(CACHE_LINE_SIZE) uint16_t PC;
 	uint8_t SP;
 	uint8_t A;
 	uint8_t X;
 	uint8_t Y;
-	uint8_t P;
-	uint8_t* memory;
+	uint8_t P; //C, I, D, B, V and bit 5, N and Z are stale, use getP and setP for the whole register
 
-	NES_ROM* rom;
+	/*
+	 * N and Z are evaluated lazily from the last result instead of being set by every instruction
+	 * Z is set when the low byte is 0, N when bit 7 or bit 8 is set. Bit 8 lets setP express N and Z together.
+	 */
+	uint16_t nzResult;
+
+	//Decoded state of the instruction currently executing
+	uint8_t opcode;
+	uint8_t mode;
+	uint16_t addr;
+
+	uint8_t irqLines; //IRQ_ sources currently asserting IRQ
+	bool nmiPending; //set by the PPU, serviced before the next instruction
+
+	uint64_t cycles; //CPU cycles executed since init
+
+	NES_BUS* bus;
 
-	void init(NES_ROM* rom);
+	static const NES_OPCODE opcodes[256];
+
+	void init(NES_ROM* rom, NES_BUS* bus, NES_MAPPER* mapper);
+
+	inline uint8_t getP() { return (P & 0x7d) | ((nzResult & 0xff) == 0 ? 0x02 : 0) | ((nzResult & 0x180) != 0 ? 0x80 : 0); }
+	inline void setP(uint8_t value) {
+		P = value;
+		nzResult = ((value & 0x80) << 1) | ((value & 0x02) ? 0 : 1);
+	}
+	inline void setZN(uint8_t result) { nzResult = result; }
+	void serialize(NES_STATE& state);
+
+	inline uint8_t read(uint16_t address);
+	inline void write(uint16_t address, uint8_t value);
 
 	void pushPCtoStack();
 
@@ -28,63 +94,122 @@ public:
 	inline uint8_t pullFromStack();
 
 	uint8_t runOp();
+	void reportJam();
+
+	uint8_t interrupt(uint16_t vector);
+
+	bool runUntil(uint64_t targetCycle);
+	void runBlock(const NES_BLOCK& block, uint64_t targetCycle);
+#if CPU_THREADED
+	bool runThreaded(uint64_t targetCycle);
+#endif
+
+	//Approximate cycle of a bus access made by the instruction currently executing, its last cycle
+	inline uint64_t currentCycle() { return cycles + opcodes[opcode].cycles - 1; }
+
+	inline uint8_t resolveAddress();
+
+	//Operand access for handlers that work on either A or memory
+	inline uint8_t fetchOperand();
+	inline void storeOperand(uint8_t value);
+
+	//Shared implementations
+	inline void LDZ(uint8_t* Z);
+	inline void STZ(uint8_t Z);
+	inline void TZZ(uint8_t ZS, uint8_t* ZT);
+	inline void INZ(uint8_t* Z);
+	inline void DEZ(uint8_t* Z);
+	inline void CPZ(uint8_t Z);
+	inline void compareWith(uint8_t Z, uint8_t target);
+	inline void addWithCarry(uint8_t value);
+
+	//Read-modify-write steps, return the byte written back
+	inline uint8_t shiftLeft();
+	inline uint8_t shiftRight();
+	inline uint8_t rotateLeft();
+	inline uint8_t rotateRight();
+	inline uint8_t incrementTarget();
+	inline uint8_t decrementTarget();
+	uint8_t branchIfFlagSet(bool flag, bool isSet);
 
+	//Official opcodes
 	uint8_t ADC();
-
 	uint8_t AND();
-
 	uint8_t ASL();
-
-	uint8_t BENQ(bool value);
-
+	uint8_t BCC();
+	uint8_t BCS();
+	uint8_t BEQ();
 	uint8_t BIT();
-
-	uint8_t BIC(bool carrySet);
-
-	uint8_t BIZ(bool zeroSet);
-
+	uint8_t BMI();
+	uint8_t BNE();
+	uint8_t BPL();
 	uint8_t BRK();
-
-	//uint8_t BVC();
-
-	uint8_t CMP(uint8_t* Z);
-
-	uint8_t DEZ(uint8_t* Z);
-
+	uint8_t BVC();
+	uint8_t BVS();
+	uint8_t CLC();
+	uint8_t CLD();
+	uint8_t CLI();
+	uint8_t CLV();
+	uint8_t CMP();
+	uint8_t CPX();
+	uint8_t CPY();
+	uint8_t DEC();
+	uint8_t DEX();
+	uint8_t DEY();
 	uint8_t EOR();
-
-	uint8_t INZ(uint8_t* Z);
-
+	uint8_t INC();
+	uint8_t INX();
+	uint8_t INY();
 	uint8_t JMP();
-
 	uint8_t JSR();
-
-	uint8_t LDZ(uint8_t* Z);
-
+	uint8_t LDA();
+	uint8_t LDX();
+	uint8_t LDY();
 	uint8_t LSR();
-
+	uint8_t NOP();
 	uint8_t ORA();
-
+	uint8_t PHA();
+	uint8_t PHP();
 	uint8_t PLA();
-
-	inline uint8_t RTI();
-
+	uint8_t PLP();
+	uint8_t ROL();
+	uint8_t ROR();
+	uint8_t RTI();
+	uint8_t RTS();
 	uint8_t SBC();
-
-	uint8_t STZ(uint8_t Z);
-
-	uint8_t TZZ(uint8_t ZS, uint8_t* ZT);
-
-	uint8_t branchIfFlagSet(bool flag, bool isSet);
-
-	inline uint8_t BCS();
-	inline uint8_t BCC();
-	inline uint8_t BEQ();
-	inline uint8_t BNE();
-	inline uint8_t BMI();
-	inline uint8_t BPL();
-	inline uint8_t BVC();
-	inline uint8_t BVS();
+	uint8_t SEC();
+	uint8_t SED();
+	uint8_t SEI();
+	uint8_t STA();
+	uint8_t STX();
+	uint8_t STY();
+	uint8_t TAX();
+	uint8_t TAY();
+	uint8_t TSX();
+	uint8_t TXA();
+	uint8_t TXS();
+	uint8_t TYA();
+
+	//Unofficial opcodes
+	uint8_t AHX();
+	uint8_t ALR();
+	uint8_t ANC();
+	uint8_t ARR();
+	uint8_t AXS();
+	uint8_t DCP();
+	uint8_t ISB();
+	uint8_t KIL();
+	uint8_t LAS();
+	uint8_t LAX();
+	uint8_t RLA();
+	uint8_t RRA();
+	uint8_t SAX();
+	uint8_t SHX();
+	uint8_t SHY();
+	uint8_t SLO();
+	uint8_t SRE();
+	uint8_t TAS();
+	uint8_t XAA();
 
 
 	inline void setCarryFlag(bool value);
@@ -108,24 +233,22 @@ public:
 	inline uint8_t getZeroPageXValue();
 	inline uint8_t getZeroPageYValue();
 	inline uint8_t getAbsoluteValue();
-	inline uint16_t getAbsoluteAddress();
 	inline uint8_t getAbsoluteXValue();
 	inline uint8_t getAbsoluteYValue();
-	inline uint8_t getIndirectValue();
 	inline uint8_t getIndirectXValue();
 	inline uint8_t getIndirectYValue();
 
-	inline uint8_t* getZeroPageAddress();
-	inline uint8_t* getZeroPageXAddress();
-	inline uint8_t* getZeroPageYAddress();
-	inline uint8_t* getAbsoluteAddressP();
-	inline uint8_t* getAbsoluteXAddress();
-	inline uint8_t* getAbsoluteYAddress();
-	inline uint8_t* getIndirectAddress();
-	inline uint8_t* getIndirectXAddress();
-	inline uint8_t* getIndirectYAddress();
-
-	inline void branchRelative();
+	inline uint16_t getImmediateAddress();
+	inline uint16_t getZeroPageAddress();
+	inline uint16_t getZeroPageXAddress();
+	inline uint16_t getZeroPageYAddress();
+	inline uint16_t getAbsoluteAddress();
+	inline uint16_t getAbsoluteXAddress();
+	inline uint16_t getAbsoluteYAddress();
+	inline uint16_t getIndirectAddress();
+	inline uint16_t getIndirectXAddress();
+	inline uint16_t getIndirectYAddress();
+	inline uint16_t getRelativeAddress();
 
 	void d_printMemFromPC();
 };
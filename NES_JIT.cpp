@@ -0,0 +1,960 @@
+#include "header.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include "NES_CPU.h"
+#include "NES_JIT.h"
+#include "helper.h"
+
+#if NES_JIT_NATIVE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+//Host registers, A, X, Y and P are pinned for the whole block
+#define RAX 0
+#define RCX 1 //last result for N and Z
+#define RDX 2 //carry, 0 or 1
+#define RBX 3 //scratch, saved by the prologue
+#define RSI 6 //internal RAM
+#define RDI 7 //NES_JIT_REGS
+#define REG_A 8
+#define REG_X 9
+#define REG_Y 10
+#define REG_P 11
+
+//8 bit ALU opcodes in their "r/m8, r8" form, the /digit of the immediate form is op >> 3
+#define X86_ADD 0x00
+#define X86_OR 0x08
+#define X86_ADC 0x10
+#define X86_SBB 0x18
+#define X86_AND 0x20
+#define X86_SUB 0x28
+#define X86_XOR 0x30
+#define X86_CMP 0x38
+#define X86_TEST 0x84
+#define X86_MOV 0x88
+
+//Condition codes
+#define CC_O 0x0
+#define CC_C 0x2
+#define CC_NC 0x3
+#define CC_Z 0x4
+#define CC_NZ 0x5
+#define CC_S 0x8
+#define CC_NS 0x9
+
+//Operand kinds
+#define OPERAND_IMM 0
+#define OPERAND_RAM 1 //[rsi + disp]
+#define OPERAND_INDEXED 2 //[rsi + rax + disp], zero page indexed and the stack
+#define OPERAND_MAPPED 3 //[rbx + rax], a bus page found by emitGuard
+
+//How an instruction uses its operand, for emitGuard
+#define ACCESS_READ 0 //through readMap
+#define ACCESS_WRITE 1 //through writeMap
+#define ACCESS_MODIFY 2 //internal RAM only
+
+NES_JIT::NES_JIT() {
+	verify = false;
+	compiled = 0;
+	nativeRuns = 0;
+	mismatches = 0;
+	code = NULL;
+	used = 0;
+	sealed = 0;
+	pageSize = 4096;
+	generation = 1;
+	start = 0;
+	overflow = false;
+	nzLive = false;
+	carryLive = false;
+}
+
+NES_JIT::~NES_JIT() {
+#if NES_JIT_NATIVE
+	if(code != NULL) munmap(code, JIT_CODE_SIZE);
+#endif
+}
+
+bool NES_JIT::init(bool _verify) {
+	verify = _verify;
+	compiled = 0;
+	nativeRuns = 0;
+	mismatches = 0;
+
+#if NES_JIT_NATIVE
+	if(code == NULL) {
+		void* memory = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(memory == MAP_FAILED) {
+			printf("ERROR: JIT code buffer could not be mapped\n");
+			return false;
+		}
+		code = (uint8_t*) memory;
+		sealed = 0;
+		pageSize = sysconf(_SC_PAGESIZE);
+	}
+	flush();
+	return true;
+#else
+	printf("ERROR: The JIT is only available on x86-64\n");
+	return false;
+#endif
+}
+
+void NES_JIT::flush() {
+	used = 0;
+	if(++generation == 0) generation = 1; //0 is what freshly decoded blocks carry
+	unseal(); //if that fails, compile tries again and stays away from the buffer until it works
+}
+
+bool NES_JIT::protect(size_t from, size_t to, bool executable) { //from and to are page aligned
+#if NES_JIT_NATIVE
+	if(from < to && mprotect(code + from, to - from, PROT_READ | (executable ? PROT_EXEC : PROT_WRITE)) != 0) {
+		printf("ERROR: JIT code buffer could not be switched to %s\n", executable ? "read+execute" : "read+write");
+		return false;
+	}
+#endif
+	return true;
+}
+
+bool NES_JIT::unseal() { //makes everything from the page of used on writable again, for the next block
+	size_t page = used & ~(pageSize - 1);
+	if(page >= sealed) return true;
+	if(!protect(page, sealed, false)) return false;
+	sealed = page;
+	return true;
+}
+
+bool NES_JIT::seal() { //makes the pages written since the last seal executable
+	size_t end = (used + pageSize - 1) & ~(pageSize - 1);
+	if(!protect(sealed, end, true)) return false;
+	sealed = end;
+	return true;
+}
+
+bool NES_JIT::run(NES_CPU& cpu, NES_BLOCK& block, uint64_t targetCycle) {
+	if(code == NULL || block.writable) return false;
+
+	if(block.jitGeneration != generation) {
+		if(block.hits < JIT_THRESHOLD) {
+			block.hits++;
+			return false;
+		}
+		compile(block);
+	}
+
+	if(block.native == NULL) {
+		if(!block.jitSplit) return false;
+		cpu.runOp(); //the block at the next instruction is compiled on its own
+		return true;
+	}
+	if(cpu.cycles + block.nativeCycles > targetCycle) return false;
+
+	NES_JIT_REGS regs;
+	regs.A = cpu.A;
+	regs.X = cpu.X;
+	regs.Y = cpu.Y;
+	regs.P = cpu.getP();
+	regs.SP = cpu.SP;
+	regs.PC = cpu.PC;
+	regs.cycles = cpu.cycles;
+	regs.ram = cpu.bus->ram;
+	regs.readMap = cpu.bus->readMap;
+	regs.writeMap = cpu.bus->writeMap;
+
+	if(verify) return runVerified(cpu, block, regs);
+
+	((NES_JIT_CODE) block.native)(&regs);
+	if(regs.cycles == cpu.cycles) return false; //the first instruction's address was I/O, nothing ran
+
+	nativeRuns++;
+	cpu.A = regs.A;
+	cpu.X = regs.X;
+	cpu.Y = regs.Y;
+	cpu.setP(regs.P);
+	cpu.SP = regs.SP;
+	cpu.PC = regs.PC;
+	cpu.cycles = regs.cycles;
+	return true;
+}
+
+bool NES_JIT::runVerified(NES_CPU& cpu, NES_BLOCK& block, NES_JIT_REGS& regs) {
+	/*
+	 * Compiled code only touches the registers and the memory behind writeMap, so running it, putting
+	 * that memory back and running the same instructions through runOp has no other side effects.
+	 * The native code may have left early at an I/O address, the interpreter stops at the same cycle.
+	 */
+	uint8_t before[CPU_PAGES][CPU_PAGE_SIZE];
+	uint8_t after[CPU_PAGES][CPU_PAGE_SIZE];
+	uint8_t* const* pages = regs.writeMap;
+	for(int p = 0; p < CPU_PAGES; ++p) {
+		if(pages[p] != NULL) memcpy(before[p], pages[p], CPU_PAGE_SIZE);
+	}
+
+	((NES_JIT_CODE) block.native)(&regs);
+	if(regs.cycles == cpu.cycles) return false; //nothing ran, the interpreter takes the whole block
+
+	for(int p = 0; p < CPU_PAGES; ++p) {
+		if(pages[p] != NULL) memcpy(after[p], pages[p], CPU_PAGE_SIZE);
+	}
+	for(int p = 0; p < CPU_PAGES; ++p) { //only once all are saved, mirrors share their memory
+		if(pages[p] != NULL) memcpy(pages[p], before[p], CPU_PAGE_SIZE);
+	}
+
+	for(uint8_t i = 0; i < block.nativeOps && cpu.cycles < regs.cycles; ++i) cpu.runOp();
+
+	bool same = regs.A == cpu.A && regs.X == cpu.X && regs.Y == cpu.Y && regs.P == cpu.getP() &&
+			regs.SP == cpu.SP && regs.PC == cpu.PC && regs.cycles == cpu.cycles;
+	for(int p = 0; p < CPU_PAGES && same; ++p) {
+		if(pages[p] != NULL && memcmp(after[p], pages[p], CPU_PAGE_SIZE) != 0) same = false;
+	}
+
+	nativeRuns++;
+	if(!same) {
+		mismatches++;
+		printf("JIT mismatch in block at %04x (%u instructions)\n", block.ops[0].PC, block.nativeOps);
+		printf("  native:      A %02x X %02x Y %02x P %02x SP %02x PC %04x cycles %llu\n",
+				regs.A, regs.X, regs.Y, regs.P, regs.SP, regs.PC, (unsigned long long) regs.cycles);
+		printf("  interpreter: A %02x X %02x Y %02x P %02x SP %02x PC %04x cycles %llu\n",
+				cpu.A, cpu.X, cpu.Y, cpu.getP(), cpu.SP, cpu.PC, (unsigned long long) cpu.cycles);
+		for(int p = 0; p < CPU_PAGES; ++p) {
+			if(pages[p] == NULL) continue;
+			for(int i = 0; i < CPU_PAGE_SIZE; ++i) {
+				if(after[p][i] != pages[p][i]) {
+					printf("  %04x: native %02x interpreter %02x\n", (p << CPU_PAGE_SHIFT) | i, after[p][i], pages[p][i]);
+				}
+			}
+		}
+		block.native = NULL; //the interpreter's result stands, and this block stays interpreted
+	}
+	return true;
+}
+
+void NES_JIT::compile(NES_BLOCK& block) {
+	if(JIT_CODE_SIZE - used < 16384) flush(); //more than any block needs, with an exit for every instruction
+
+	block.jitGeneration = generation;
+	block.native = NULL;
+	block.jitSplit = false;
+	block.nativeOps = 0;
+	block.nativeCycles = 0;
+
+	if(!unseal()) return; //the block shares its first page with the one compiled before
+
+	uint16_t worstCycles;
+	uint8_t count = compileOps(block, 0, worstCycles);
+
+	//Worth interpreting the first instruction alone if the rest makes a block that is not just a jump
+	if(count == 0) block.jitSplit = compileOps(block, 1, worstCycles) >= 2;
+
+	//Also when nothing was kept, the blocks before share the page
+	if(count == 0) used = start;
+	if(!seal()) {
+		flush(); //none of the code can run any more
+		return;
+	}
+	if(count == 0) return;
+
+	block.native = code + start;
+	block.nativeOps = count;
+	block.nativeCycles = worstCycles;
+	compiled++;
+}
+
+uint8_t NES_JIT::compileOps(NES_BLOCK& block, uint8_t first, uint16_t& worstCycles) {
+	start = used;
+	overflow = false;
+	nzLive = false;
+	carryLive = false;
+
+	//Prologue, rdi points to the NES_JIT_REGS
+	emit(0x53); //push rbx
+	emitState8(0x8a, REG_A, offsetof(NES_JIT_REGS, A));
+	emitState8(0x8a, REG_X, offsetof(NES_JIT_REGS, X));
+	emitState8(0x8a, REG_Y, offsetof(NES_JIT_REGS, Y));
+	emitState8(0x8a, REG_P, offsetof(NES_JIT_REGS, P));
+	emit(0x48); //mov rsi, [rdi + ram]
+	emit(0x8b);
+	emit(0x40 | (RSI << 3) | RDI);
+	emit(offsetof(NES_JIT_REGS, ram));
+
+	uint16_t cycles = 0; //base cycles of the instructions compiled so far, page penalties are added as they happen
+	uint16_t penalties = 0;
+	uint8_t rawOffset = 0;
+	uint8_t count = 0;
+	bool ended = false;
+
+	worstCycles = 0;
+	for(uint8_t i = 0; i < first && i < block.length; ++i) rawOffset += block.ops[i].bytes;
+
+	for(uint8_t i = first; i < block.length; ++i) {
+		const NES_DECODED_OP& op = block.ops[i];
+		uint16_t operand = 0;
+		if(op.bytes > 1) operand = block.raw[rawOffset + 1];
+		if(op.bytes > 2) operand |= block.raw[rawOffset + 2] << 8;
+
+		if(!NES_CPU::opcodes[op.opcode].official || !compileOp(op, operand, cycles, ended)) break;
+
+		count++;
+		rawOffset += op.bytes;
+		worstCycles = cycles + penalties + op.cycles + (op.mode == REL ? 2 : op.pagePenalty);
+		if(ended) break;
+		cycles += op.cycles;
+		penalties += op.pagePenalty;
+	}
+
+	if(count != 0 && !overflow && !ended) {
+		const NES_DECODED_OP& last = block.ops[first + count - 1];
+		emitExit(last.PC + last.bytes, cycles);
+	}
+	if(count == 0 || overflow) {
+		used = start;
+		return 0;
+	}
+	return count;
+}
+
+bool NES_JIT::resolveOperand(const NES_DECODED_OP& op, uint16_t operand, int access, uint16_t cycles, int& kind, uint16_t& disp) {
+	/*
+	 * Immediates and operands that are certain to be internal RAM are used directly, the index for
+	 * ZPX/ZPY is computed into rax. Every other address goes into eax and through emitGuard.
+	 * Returns false without emitting anything if the operand cannot be compiled.
+	 */
+	switch(op.mode) {
+	case IMM:
+		kind = OPERAND_IMM;
+		disp = operand;
+		return true;
+	case ZP0:
+		kind = OPERAND_RAM;
+		disp = operand;
+		return true;
+	case ZPX:
+	case ZPY:
+		emitIndex(op.mode == ZPX ? REG_X : REG_Y, operand);
+		kind = OPERAND_INDEXED;
+		disp = 0;
+		return true;
+	case ABS:
+		if(op.addr < 0x2000) {
+			kind = OPERAND_RAM;
+			disp = op.addr & (CPU_RAM_SIZE - 1);
+			return true;
+		}
+		//The I/O registers, mapper registers above 0x8000, and a mapper may watch what is read-modify-written
+		if(op.addr < 0x6000 || access == ACCESS_MODIFY || (access == ACCESS_WRITE && op.addr >= 0x8000)) return false;
+		emit(0xb8); //mov eax, addr
+		emit32(op.addr);
+		break;
+	case ABX:
+	case ABY: {
+		if(operand >= 0x2000 && operand < 0x6000) return false; //the I/O registers, the guard would always exit
+		bool ram = operand + 0xff < 0x2000; //always internal RAM
+		if(!ram && access == ACCESS_MODIFY) return false;
+		int index = op.mode == ABX ? REG_X : REG_Y;
+		emitRex(RAX, index); //movzx eax, index
+		emit(0x0f);
+		emit(0xb6);
+		emit(0xc0 | (index & 7));
+		emit(0x05); //add eax, operand
+		emit32(operand);
+		if(ram) {
+			emit(0x25); //and eax, CPU_RAM_SIZE - 1
+			emit32(CPU_RAM_SIZE - 1);
+			kind = OPERAND_INDEXED;
+		} else {
+			emit(0x0f); //movzx eax, ax, the address wraps at 0x10000
+			emit(0xb7);
+			emit(0xc0);
+			emitGuard(access, op, cycles, kind);
+		}
+		disp = 0;
+		if(op.pagePenalty) emitPagePenalty(index);
+		return true;
+	}
+	case IZX:
+		if(access == ACCESS_MODIFY) return false;
+		emitIndex(REG_X, operand); //the pointer wraps within the zero page
+		emitMovzx(RBX, OPERAND_INDEXED, 0);
+		emit(0xfe); //inc al
+		emit(0xc0);
+		emitMovzx(RAX, OPERAND_INDEXED, 0);
+		emit(0xc1); //shl eax, 8
+		emit(0xe0);
+		emit(8);
+		emit(0x09); //or eax, ebx
+		emit(0xd8);
+		break;
+	case IZY:
+		if(access == ACCESS_MODIFY) return false;
+		emitMovzx(RBX, OPERAND_RAM, operand);
+		emitMovzx(RAX, OPERAND_RAM, (operand + 1) & 0xff);
+		emit(0xc1); //shl eax, 8
+		emit(0xe0);
+		emit(8);
+		emit(0x09); //or eax, ebx
+		emit(0xd8);
+		emitRex(RBX, REG_Y); //movzx ebx, Y
+		emit(0x0f);
+		emit(0xb6);
+		emit(0xc0 | (RBX << 3) | (REG_Y & 7));
+		emit(0x01); //add eax, ebx
+		emit(0xd8);
+		emit(0x0f); //movzx eax, ax
+		emit(0xb7);
+		emit(0xc0);
+		emitGuard(access, op, cycles, kind);
+		disp = 0;
+		if(op.pagePenalty) emitPagePenalty(REG_Y);
+		return true;
+	default:
+		return false;
+	}
+
+	emitGuard(access, op, cycles, kind);
+	disp = 0;
+	return true;
+}
+
+void NES_JIT::emitGuard(int access, const NES_DECODED_OP& op, uint16_t cycles, int& kind) {
+	/*
+	 * eax holds the address op accesses, a page without memory behind it exits to the interpreter at op
+	 * Leaves the offset into the page in eax, with rbx pointing to the page, or to internal RAM for a modify
+	 */
+	size_t mapped;
+	if(access == ACCESS_MODIFY) {
+		emit(0x3d); //cmp eax, 0x2000
+		emit32(0x2000);
+		mapped = emitJcc(CC_C);
+		kind = OPERAND_INDEXED;
+	} else {
+		emit(0x89); //mov ebx, eax
+		emit(0xc3);
+		emit(0xc1); //shr ebx, CPU_PAGE_SHIFT
+		emit(0xeb);
+		emit(CPU_PAGE_SHIFT);
+		emit(0xc1); //shl ebx, 3
+		emit(0xe3);
+		emit(3);
+		emit(0x48); //add rbx, [rdi + readMap or writeMap]
+		emit(0x03);
+		emit(0x40 | (RBX << 3) | RDI);
+		emit(access == ACCESS_READ ? offsetof(NES_JIT_REGS, readMap) : offsetof(NES_JIT_REGS, writeMap));
+		emit(0x48); //mov rbx, [rbx]
+		emit(0x8b);
+		emit((RBX << 3) | RBX);
+		emit(0x48); //test rbx, rbx
+		emit(0x85);
+		emit(0xc0 | (RBX << 3) | RBX);
+		mapped = emitJcc(CC_NZ);
+		kind = OPERAND_MAPPED;
+	}
+	emitExit(op.PC, cycles);
+	patchJump(mapped);
+
+	emit(0x25); //and eax, CPU_PAGE_SIZE - 1, which is also the internal RAM mirror
+	emit32(CPU_PAGE_SIZE - 1);
+}
+
+void NES_JIT::emitPagePenalty(int index) { //al is the low byte of the indexed address, below index if a page was crossed
+	emitRR(X86_CMP, RAX, index);
+	size_t same = emitJcc(CC_NC);
+	emit(0x48); //add qword [rdi + cycles], 1
+	emit(0x83);
+	emit(0x40 | RDI);
+	emit(offsetof(NES_JIT_REGS, cycles));
+	emit(1);
+	patchJump(same);
+}
+
+bool NES_JIT::compileOp(const NES_DECODED_OP& op, uint16_t operand, uint16_t cycles, bool& ended) {
+	/*
+	 * Emits op, or nothing and returns false if it cannot be compiled
+	 * cycles are those of the block before op, for the exits op ends the block with
+	 */
+	NES_HANDLER h = op.handler;
+
+	if(h == &NES_CPU::PHA || h == &NES_CPU::PLA || h == &NES_CPU::PHP || h == &NES_CPU::PLP ||
+			h == &NES_CPU::JSR || h == &NES_CPU::RTS) return compileStackOp(op, cycles, ended);
+
+	if(op.mode == IMP || op.mode == ACC) {
+		if(h == &NES_CPU::TAX) emitRR(X86_MOV, REG_X, REG_A);
+		else if(h == &NES_CPU::TAY) emitRR(X86_MOV, REG_Y, REG_A);
+		else if(h == &NES_CPU::TXA) emitRR(X86_MOV, REG_A, REG_X);
+		else if(h == &NES_CPU::TYA) emitRR(X86_MOV, REG_A, REG_Y);
+		else if(h == &NES_CPU::TSX) emitState8(0x8a, REG_X, offsetof(NES_JIT_REGS, SP));
+		else if(h == &NES_CPU::TXS) emitState8(0x88, REG_X, offsetof(NES_JIT_REGS, SP));
+		else if(h == &NES_CPU::INX) emitUnary(0xfe, 0, REG_X);
+		else if(h == &NES_CPU::INY) emitUnary(0xfe, 0, REG_Y);
+		else if(h == &NES_CPU::DEX) emitUnary(0xfe, 1, REG_X);
+		else if(h == &NES_CPU::DEY) emitUnary(0xfe, 1, REG_Y);
+		else if(h == &NES_CPU::ASL || h == &NES_CPU::LSR) emitUnary(0xd0, h == &NES_CPU::ASL ? 4 : 5, REG_A);
+		else if(h == &NES_CPU::ROL || h == &NES_CPU::ROR) {
+			emitLoadCarry();
+			emitRI(X86_ADD >> 3, RDX, 0xff); //carry into CF
+			emitUnary(0xd0, h == &NES_CPU::ROL ? 2 : 3, REG_A); //rcl, rcr
+		}
+		else if(h == &NES_CPU::CLC) emitMovRI(RDX, 0);
+		else if(h == &NES_CPU::SEC) emitMovRI(RDX, 1);
+		else if(h == &NES_CPU::CLV) emitRI(X86_AND >> 3, REG_P, 0xbf);
+		else if(h == &NES_CPU::CLD) emitRI(X86_AND >> 3, REG_P, 0xf7);
+		else if(h == &NES_CPU::SED) emitRI(X86_OR >> 3, REG_P, 0x08);
+		else if(h == &NES_CPU::SEI) emitRI(X86_OR >> 3, REG_P, 0x04);
+		else if(h == &NES_CPU::CLI) {
+			//A pending IRQ is taken right after CLI, so the block ends here and the CPU checks
+			emitRI(X86_AND >> 3, REG_P, 0xfb);
+			emitExit(op.PC + op.bytes, cycles + op.cycles);
+			ended = true;
+			return true;
+		}
+		else if(h == &NES_CPU::NOP) {}
+		else return false;
+
+		if(h == &NES_CPU::ASL || h == &NES_CPU::LSR || h == &NES_CPU::ROL || h == &NES_CPU::ROR) {
+			emitSetcc(CC_C, RDX);
+			carryLive = true;
+		}
+		if(h == &NES_CPU::CLC || h == &NES_CPU::SEC) carryLive = true;
+
+		//Everything but the flag instructions, NOP and TXS sets N and Z from its result
+		int result = -1;
+		if(h == &NES_CPU::TAX || h == &NES_CPU::TSX || h == &NES_CPU::INX || h == &NES_CPU::DEX) result = REG_X;
+		else if(h == &NES_CPU::TAY || h == &NES_CPU::INY || h == &NES_CPU::DEY) result = REG_Y;
+		else if(h == &NES_CPU::TXA || h == &NES_CPU::TYA || h == &NES_CPU::ASL || h == &NES_CPU::LSR ||
+				h == &NES_CPU::ROL || h == &NES_CPU::ROR) result = REG_A;
+		if(result >= 0) {
+			emitRR(X86_MOV, RCX, result);
+			nzLive = true;
+		}
+		return true;
+	}
+
+	if(op.mode == REL) {
+		size_t taken;
+		bool set = h == &NES_CPU::BMI || h == &NES_CPU::BEQ || h == &NES_CPU::BCS || h == &NES_CPU::BVS;
+
+		if(h == &NES_CPU::BPL || h == &NES_CPU::BMI) {
+			if(nzLive) {
+				emitRR(X86_TEST, RCX, RCX);
+				taken = emitJcc(set ? CC_S : CC_NS);
+			} else {
+				emitUnary(0xf6, 0, REG_P); //test r11b, 0x80
+				emit(0x80);
+				taken = emitJcc(set ? CC_NZ : CC_Z);
+			}
+		} else if(h == &NES_CPU::BNE || h == &NES_CPU::BEQ) {
+			if(nzLive) {
+				emitRR(X86_TEST, RCX, RCX);
+				taken = emitJcc(set ? CC_Z : CC_NZ);
+			} else {
+				emitUnary(0xf6, 0, REG_P);
+				emit(0x02);
+				taken = emitJcc(set ? CC_NZ : CC_Z);
+			}
+		} else if(h == &NES_CPU::BCC || h == &NES_CPU::BCS) {
+			if(carryLive) {
+				emitRR(X86_TEST, RDX, RDX);
+			} else {
+				emitUnary(0xf6, 0, REG_P);
+				emit(0x01);
+			}
+			taken = emitJcc(set ? CC_NZ : CC_Z);
+		} else if(h == &NES_CPU::BVC || h == &NES_CPU::BVS) {
+			emitUnary(0xf6, 0, REG_P);
+			emit(0x40);
+			taken = emitJcc(set ? CC_NZ : CC_Z);
+		} else {
+			return false;
+		}
+
+		uint16_t next = op.PC + op.bytes;
+		emitExit(next, cycles + op.cycles);
+		patchJump(taken);
+		emitExit(op.addr, cycles + op.cycles + 1 + isPageCrossed(next, op.addr));
+		ended = true;
+		return true;
+	}
+
+	if(h == &NES_CPU::JMP) {
+		if(op.mode != ABS) return false;
+		emitExit(op.addr, cycles + op.cycles);
+		ended = true;
+		return true;
+	}
+
+	int reg;
+	uint8_t alu;
+	if(h == &NES_CPU::LDA) { reg = REG_A; alu = X86_MOV; }
+	else if(h == &NES_CPU::LDX) { reg = REG_X; alu = X86_MOV; }
+	else if(h == &NES_CPU::LDY) { reg = REG_Y; alu = X86_MOV; }
+	else if(h == &NES_CPU::AND) { reg = REG_A; alu = X86_AND; }
+	else if(h == &NES_CPU::ORA) { reg = REG_A; alu = X86_OR; }
+	else if(h == &NES_CPU::EOR) { reg = REG_A; alu = X86_XOR; }
+	else if(h == &NES_CPU::CMP) { reg = REG_A; alu = X86_CMP; }
+	else if(h == &NES_CPU::CPX) { reg = REG_X; alu = X86_CMP; }
+	else if(h == &NES_CPU::CPY) { reg = REG_Y; alu = X86_CMP; }
+	else if(h == &NES_CPU::ADC) { reg = REG_A; alu = X86_ADC; }
+	else if(h == &NES_CPU::SBC) { reg = REG_A; alu = X86_SBB; }
+	else if(h == &NES_CPU::STA) { reg = REG_A; alu = 0xff; }
+	else if(h == &NES_CPU::STX) { reg = REG_X; alu = 0xff; }
+	else if(h == &NES_CPU::STY) { reg = REG_Y; alu = 0xff; }
+	else if(h == &NES_CPU::INC || h == &NES_CPU::DEC || h == &NES_CPU::ASL || h == &NES_CPU::LSR ||
+			h == &NES_CPU::ROL || h == &NES_CPU::ROR) { reg = -1; alu = 0xff; }
+	else if(h == &NES_CPU::BIT) { reg = -1; alu = X86_TEST; }
+	else return false;
+
+	int access = ACCESS_READ;
+	if(alu == 0xff) access = reg < 0 ? ACCESS_MODIFY : ACCESS_WRITE;
+
+	int kind;
+	uint16_t disp;
+	if(!resolveOperand(op, operand, access, cycles, kind, disp)) return false;
+
+	if(alu == X86_TEST) { //BIT, N and Z cannot both stay lazy, so they go into P with V
+		emitMovzx(RBX, kind, disp);
+		emitMergeNZ();
+		nzLive = false;
+		emitRI(X86_AND >> 3, REG_P, 0x3d);
+		emitRR(X86_MOV, RAX, RBX);
+		emitRI(X86_AND >> 3, RAX, 0xc0);
+		emitRR(X86_OR, REG_P, RAX);
+		emitRR(X86_TEST, RBX, REG_A);
+		emitSetcc(CC_Z, RAX);
+		emitRR(X86_ADD, RAX, RAX); //Z is bit 1
+		emitRR(X86_OR, REG_P, RAX);
+		return true;
+	}
+
+	//Only touches dl, the index in rax survives
+	if(alu == X86_ADC || alu == X86_SBB || h == &NES_CPU::ROL || h == &NES_CPU::ROR) emitLoadCarry();
+
+	if(reg < 0) { //read-modify-write of RAM
+		if(h == &NES_CPU::INC) emitUnaryMem(0xfe, 0, kind, disp);
+		else if(h == &NES_CPU::DEC) emitUnaryMem(0xfe, 1, kind, disp);
+		else if(h == &NES_CPU::ASL) emitUnaryMem(0xd0, 4, kind, disp);
+		else if(h == &NES_CPU::LSR) emitUnaryMem(0xd0, 5, kind, disp);
+		else {
+			emitRI(X86_ADD >> 3, RDX, 0xff);
+			emitUnaryMem(0xd0, h == &NES_CPU::ROL ? 2 : 3, kind, disp);
+		}
+		if(h != &NES_CPU::INC && h != &NES_CPU::DEC) {
+			emitSetcc(CC_C, RDX);
+			carryLive = true;
+		}
+		emitRM(X86_MOV, RCX, kind, disp);
+		nzLive = true;
+		return true;
+	}
+
+	if(alu == 0xff) { //store
+		emitMR(X86_MOV, kind, disp, reg);
+		return true;
+	}
+
+	if(alu == X86_ADC) emitRI(X86_ADD >> 3, RDX, 0xff); //CF = C
+	if(alu == X86_SBB) emitRI(X86_CMP >> 3, RDX, 1); //CF = !C, the 6502 borrows when carry is clear
+
+	if(alu == X86_CMP) {
+		//Carry is the inverse of the host's borrow, N and Z come from the difference
+		if(kind == OPERAND_IMM) emitRI(X86_CMP >> 3, reg, disp);
+		else emitRM(X86_CMP, reg, kind, disp);
+		emitSetcc(CC_NC, RDX);
+		emitRR(X86_MOV, RCX, reg);
+		if(kind == OPERAND_IMM) emitRI(X86_SUB >> 3, RCX, disp);
+		else emitRM(X86_SUB, RCX, kind, disp);
+		carryLive = true;
+		nzLive = true;
+		return true;
+	}
+
+	if(kind == OPERAND_IMM) {
+		if(alu == X86_MOV) emitMovRI(reg, disp);
+		else emitRI(alu >> 3, reg, disp);
+	} else {
+		emitRM(alu, reg, kind, disp);
+	}
+
+	if(alu == X86_ADC || alu == X86_SBB) {
+		emitSetcc(alu == X86_ADC ? CC_C : CC_NC, RDX);
+		emitSetcc(CC_O, RAX);
+		emitUnary(0xc0, 4, RAX); //shl al, 6 moves overflow to V
+		emit(6);
+		emitRI(X86_AND >> 3, REG_P, 0xbf);
+		emitRR(X86_OR, REG_P, RAX);
+		carryLive = true;
+	}
+
+	emitRR(X86_MOV, RCX, reg);
+	nzLive = true;
+	return true;
+}
+
+bool NES_JIT::compileStackOp(const NES_DECODED_OP& op, uint16_t cycles, bool& ended) {
+	//The stack is always internal RAM, [rsi + rax + 0x100] with SP loaded into eax
+	NES_HANDLER h = op.handler;
+
+	if(h == &NES_CPU::PHA) {
+		emitLoadSP();
+		emitMR(X86_MOV, OPERAND_INDEXED, 0x100, REG_A);
+		emitStepSP(1);
+	} else if(h == &NES_CPU::PHP) {
+		emitMergeNZ();
+		emitMergeCarry();
+		nzLive = false;
+		carryLive = false;
+		emitRR(X86_MOV, RBX, REG_P);
+		emitRI(X86_OR >> 3, RBX, 0x30); //pushed with the Break bit set
+		emitLoadSP();
+		emitMR(X86_MOV, OPERAND_INDEXED, 0x100, RBX);
+		emitStepSP(1);
+	} else if(h == &NES_CPU::PLA) {
+		emitStepSP(0);
+		emitLoadSP();
+		emitRM(X86_MOV, REG_A, OPERAND_INDEXED, 0x100);
+		emitRR(X86_MOV, RCX, REG_A);
+		nzLive = true;
+	} else if(h == &NES_CPU::PLP) {
+		//May clear the interrupt disable flag, so the block ends here and the CPU checks for an IRQ
+		emitStepSP(0);
+		emitLoadSP();
+		emitRM(X86_MOV, REG_P, OPERAND_INDEXED, 0x100);
+		emitRI(X86_AND >> 3, REG_P, 0xef);
+		emitRI(X86_OR >> 3, REG_P, 0x20);
+		nzLive = false;
+		carryLive = false;
+		emitExit(op.PC + op.bytes, cycles + op.cycles);
+		ended = true;
+	} else if(h == &NES_CPU::JSR) {
+		if(op.mode != ABS) return false;
+		uint16_t last = op.PC + 2; //JSR pushes the address of its last byte, high byte first
+		emitLoadSP();
+		emit(0xc6); //mov byte [rsi + rax + 0x100], high
+		emitMem(0, OPERAND_INDEXED, 0x100);
+		emit(last >> 8);
+		emitStepSP(1);
+		emitLoadSP(); //SP may have wrapped
+		emit(0xc6);
+		emitMem(0, OPERAND_INDEXED, 0x100);
+		emit(last & 0xff);
+		emitStepSP(1);
+		emitExit(op.addr, cycles + op.cycles);
+		ended = true;
+	} else { //RTS, the PC comes from the stack, so the exit is written out here
+		emitWriteBack();
+		emitStepSP(0);
+		emitLoadSP();
+		emitMovzx(RDX, OPERAND_INDEXED, 0x100);
+		emitStepSP(0);
+		emitLoadSP();
+		emitMovzx(RCX, OPERAND_INDEXED, 0x100);
+		emit(0xc1); //shl ecx, 8
+		emit(0xe1);
+		emit(8);
+		emit(0x09); //or ecx, edx
+		emit(0xc0 | (RDX << 3) | RCX);
+		emit(0x66); //inc cx
+		emit(0xff);
+		emit(0xc0 | RCX);
+		emit(0x66); //mov [rdi + PC], cx
+		emit(0x89);
+		emit(0x40 | (RCX << 3) | RDI);
+		emit(offsetof(NES_JIT_REGS, PC));
+		emitReturn(cycles + op.cycles);
+		ended = true;
+	}
+	return true;
+}
+
+void NES_JIT::emitLoadCarry() {
+	if(carryLive) return;
+	emitRR(X86_MOV, RDX, REG_P);
+	emitRI(X86_AND >> 3, RDX, 0x01);
+	carryLive = true;
+}
+
+void NES_JIT::emitMergeNZ() { //leaves nzLive alone, the code after an exit still has cl
+	if(!nzLive) return;
+	emitRI(X86_AND >> 3, REG_P, 0x7d);
+	emitRR(X86_TEST, RCX, RCX);
+	emitSetcc(CC_Z, RAX);
+	emitRR(X86_ADD, RAX, RAX); //Z is bit 1
+	emitRR(X86_OR, REG_P, RAX);
+	emitRR(X86_MOV, RAX, RCX);
+	emitRI(X86_AND >> 3, RAX, 0x80);
+	emitRR(X86_OR, REG_P, RAX);
+}
+
+void NES_JIT::emitMergeCarry() {
+	if(!carryLive) return;
+	emitRI(X86_AND >> 3, REG_P, 0xfe);
+	emitRR(X86_OR, REG_P, RDX);
+}
+
+void NES_JIT::emitWriteBack() { //merges the lazy flags into P and writes the registers back
+	emitMergeNZ();
+	emitMergeCarry();
+
+	emitState8(0x88, REG_A, offsetof(NES_JIT_REGS, A));
+	emitState8(0x88, REG_X, offsetof(NES_JIT_REGS, X));
+	emitState8(0x88, REG_Y, offsetof(NES_JIT_REGS, Y));
+	emitState8(0x88, REG_P, offsetof(NES_JIT_REGS, P));
+}
+
+void NES_JIT::emitExit(uint16_t PC, uint16_t cycles) {
+	emitWriteBack();
+
+	emit(0x66); //mov word [rdi + PC], PC
+	emit(0xc7);
+	emit(0x40 | RDI);
+	emit(offsetof(NES_JIT_REGS, PC));
+	emit(PC & 0xff);
+	emit(PC >> 8);
+
+	emitReturn(cycles);
+}
+
+void NES_JIT::emitReturn(uint16_t cycles) {
+	emit(0x48); //add qword [rdi + cycles], cycles
+	emit(0x81);
+	emit(0x40 | RDI);
+	emit(offsetof(NES_JIT_REGS, cycles));
+	emit32(cycles);
+
+	emit(0x5b); //pop rbx
+	emit(0xc3); //ret
+}
+
+
+void NES_JIT::emit(uint8_t byte) {
+	if(used >= JIT_CODE_SIZE) {
+		overflow = true;
+		return;
+	}
+	code[used++] = byte;
+}
+
+void NES_JIT::emit32(uint32_t value) {
+	for(int i = 0; i < 4; ++i) emit((value >> (i * 8)) & 0xff);
+}
+
+void NES_JIT::emitRex(int reg, int rm) { //only for r8-r15, the byte registers used here need no REX otherwise
+	uint8_t rex = 0x40 | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+	if(rex != 0x40) emit(rex);
+}
+
+void NES_JIT::emitRR(uint8_t op, int rm, int reg) { //op rm8, reg8
+	emitRex(reg, rm);
+	emit(op);
+	emit(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void NES_JIT::emitRI(uint8_t ext, int rm, uint8_t imm) { //op rm8, imm8, ext being the /digit
+	emitRex(0, rm);
+	emit(0x80);
+	emit(0xc0 | (ext << 3) | (rm & 7));
+	emit(imm);
+}
+
+void NES_JIT::emitMovRI(int reg, uint8_t imm) {
+	emitRex(0, reg);
+	emit(0xb0 | (reg & 7));
+	emit(imm);
+}
+
+void NES_JIT::emitMem(int reg, int kind, uint16_t disp) {
+	if(kind == OPERAND_INDEXED && disp == 0) {
+		emit(0x04 | ((reg & 7) << 3)); //[rsi + rax]
+		emit((RAX << 3) | RSI);
+	} else if(kind == OPERAND_INDEXED) {
+		emit(0x84 | ((reg & 7) << 3)); //[rsi + rax + disp32]
+		emit((RAX << 3) | RSI);
+		emit32(disp);
+	} else if(kind == OPERAND_MAPPED) {
+		emit(0x04 | ((reg & 7) << 3)); //[rbx + rax]
+		emit((RAX << 3) | RBX);
+	} else {
+		emit(0x80 | ((reg & 7) << 3) | RSI); //[rsi + disp32]
+		emit32(disp);
+	}
+}
+
+void NES_JIT::emitRM(uint8_t op, int reg, int kind, uint16_t disp) { //op reg8, [memory]
+	emitRex(reg, 0);
+	emit(op | 0x02);
+	emitMem(reg, kind, disp);
+}
+
+void NES_JIT::emitMR(uint8_t op, int kind, uint16_t disp, int reg) { //op [memory], reg8
+	emitRex(reg, 0);
+	emit(op);
+	emitMem(reg, kind, disp);
+}
+
+void NES_JIT::emitUnary(uint8_t op, uint8_t ext, int rm) {
+	emitRex(0, rm);
+	emit(op);
+	emit(0xc0 | (ext << 3) | (rm & 7));
+}
+
+void NES_JIT::emitUnaryMem(uint8_t op, uint8_t ext, int kind, uint16_t disp) {
+	emit(op);
+	emitMem(ext, kind, disp);
+}
+
+void NES_JIT::emitSetcc(uint8_t cc, int rm) {
+	emitRex(0, rm);
+	emit(0x0f);
+	emit(0x90 | cc);
+	emit(0xc0 | (rm & 7));
+}
+
+void NES_JIT::emitIndex(int reg, uint8_t base) { //eax = (reg + base) & 0xff, the zero page wraps
+	emitRex(RAX, reg); //movzx eax, reg8
+	emit(0x0f);
+	emit(0xb6);
+	emit(0xc0 | (reg & 7));
+	emit(0x04); //add al, base
+	emit(base);
+}
+
+void NES_JIT::emitMovzx(int reg, int kind, uint16_t disp) { //movzx reg32, byte [memory]
+	emitRex(reg, 0);
+	emit(0x0f);
+	emit(0xb6);
+	emitMem(reg, kind, disp);
+}
+
+void NES_JIT::emitLoadSP() { //movzx eax, byte [rdi + SP]
+	emit(0x0f);
+	emit(0xb6);
+	emit(0x40 | (RAX << 3) | RDI);
+	emit(offsetof(NES_JIT_REGS, SP));
+}
+
+void NES_JIT::emitStepSP(uint8_t ext) { //inc (0) or dec (1) byte [rdi + SP]
+	emit(0xfe);
+	emit(0x40 | (ext << 3) | RDI);
+	emit(offsetof(NES_JIT_REGS, SP));
+}
+
+size_t NES_JIT::emitJcc(uint8_t cc) { //returns where the displacement ends, for patchJump
+	emit(0x0f);
+	emit(0x80 | cc);
+	emit32(0);
+	return used;
+}
+
+void NES_JIT::patchJump(size_t at) { //points the jump ending at at to the current position
+	if(overflow) return;
+	uint32_t displacement = used - at;
+	for(int i = 0; i < 4; ++i) code[at - 4 + i] = (displacement >> (i * 8)) & 0xff;
+}
+
+void NES_JIT::emitState8(uint8_t op, int reg, uint8_t offset) { //op is 0x88 to store reg, 0x8a to load it
+	emitRex(reg, 0);
+	emit(op);
+	emit(0x40 | ((reg & 7) << 3) | RDI); //[rdi + disp8]
+	emit(offset);
+}
@@ -0,0 +1,130 @@
+#ifndef NES_JIT_H_
+#define NES_JIT_H_
+
+#include "NES_BLOCK.h"
+
+class NES_CPU;
+
+//Native code is only generated for x86-64 on POSIX systems, elsewhere init fails and everything is interpreted
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define NES_JIT_NATIVE 1
+#else
+#define NES_JIT_NATIVE 0
+#endif
+
+#define JIT_THRESHOLD 16 //runs of a block before it is compiled
+#define JIT_CODE_SIZE (1 << 20)
+
+//What compiled code sees of the CPU, copied in and out around every call
+struct NES_JIT_REGS {
+	uint8_t A;
+	uint8_t X;
+	uint8_t Y;
+	uint8_t P;
+	uint8_t SP;
+	uint16_t PC;
+	uint64_t cycles;
+	uint8_t* ram;
+	const uint8_t* const* readMap; //NES_BUS page tables, for addresses only known at run time
+	uint8_t* const* writeMap;
+};
+
+typedef void (*NES_JIT_CODE)(NES_JIT_REGS* regs);
+
+/*
+ * Compiles hot blocks of the block cache to x86-64
+ * A, X, Y and P live in r8b-r11b while a block runs. N and Z are evaluated lazily from the last result,
+ * kept in cl, and carry is kept in dl, both are only merged into P when the block exits. rbx is scratch.
+ * Only instructions that cannot reach I/O are compiled: register and immediate operations, the stack,
+ * JSR and RTS, and memory operands that are certain to be internal RAM. Addresses only known at run time
+ * (indexed, indirect, and absolute ones above the I/O registers) are looked up in the bus page tables,
+ * and an address without memory behind it exits to the interpreter at that instruction before it does
+ * anything. Loads go through readMap, stores through writeMap, read-modify-writes have to hit internal RAM.
+ * Compilation stops before anything else, so a compiled block can never start a DMA, raise an interrupt
+ * or bank, and runs only when its worst case fits the budget. A block whose first instruction cannot be
+ * compiled has only that one interpreted, the rest of it is the block at the next instruction.
+ * Code of ROM blocks is never invalidated, a bank switch makes the cache hand out the other bank's blocks.
+ * Blocks in RAM are not compiled. When the code buffer is full, all code is dropped and compiled again.
+ * The code buffer is never writable and executable at once: it is mapped read+write, and the pages of a
+ * block are switched to read+execute before it first runs. Only compiling the next block or a flush
+ * switches a page back to read+write.
+ *
+ * With verify set, every compiled run is repeated by the interpreter from the same state and the results
+ * compared. A mismatch is reported, the block is never run natively again and the interpreter's result stands.
+ */
+class NES_JIT {
+public:
+	bool verify;
+
+	uint64_t compiled; //blocks compiled
+	uint64_t nativeRuns;
+	uint64_t mismatches; //verify mode only
+
+	NES_JIT();
+	~NES_JIT();
+
+	bool init(bool verify);
+	void flush(); //drops all native code
+
+	bool run(NES_CPU& cpu, NES_BLOCK& block, uint64_t targetCycle); //false if the block has to be interpreted, true once something ran
+
+private:
+	uint8_t* code;
+	size_t used;
+	size_t sealed; //code below is read+execute, from here on read+write, page aligned
+	size_t pageSize;
+	uint32_t generation; //NES_BLOCK::jitGeneration of blocks compiled since the last flush
+
+	//Compile state of the current block
+	size_t start;
+	bool overflow;
+	bool nzLive; //cl holds the last result, P's N and Z are stale
+	bool carryLive; //dl holds the carry, P's C is stale
+
+	bool protect(size_t from, size_t to, bool executable);
+	bool unseal();
+	bool seal();
+
+	void compile(NES_BLOCK& block);
+	uint8_t compileOps(NES_BLOCK& block, uint8_t first, uint16_t& worstCycles); //returns how many were compiled, 0 leaves nothing behind
+	bool compileOp(const NES_DECODED_OP& op, uint16_t operand, uint16_t cycles, bool& ended);
+	bool compileStackOp(const NES_DECODED_OP& op, uint16_t cycles, bool& ended);
+	bool resolveOperand(const NES_DECODED_OP& op, uint16_t operand, int access, uint16_t cycles, int& kind, uint16_t& disp);
+	void emitGuard(int access, const NES_DECODED_OP& op, uint16_t cycles, int& kind);
+	void emitPagePenalty(int index);
+	void emitExit(uint16_t PC, uint16_t cycles);
+	void emitWriteBack();
+	void emitReturn(uint16_t cycles);
+	void emitMergeNZ();
+	void emitMergeCarry();
+	void emitLoadCarry();
+	bool runVerified(NES_CPU& cpu, NES_BLOCK& block, NES_JIT_REGS& regs); //false if nothing ran
+
+	//x86-64 encoding
+	void emit(uint8_t byte);
+	void emit32(uint32_t value);
+	void emitRex(int reg, int rm);
+	void emitRR(uint8_t op, int rm, int reg);
+	void emitRI(uint8_t ext, int rm, uint8_t imm);
+	void emitMovRI(int reg, uint8_t imm);
+	void emitMem(int reg, int kind, uint16_t disp);
+	void emitRM(uint8_t op, int reg, int kind, uint16_t disp);
+	void emitMR(uint8_t op, int kind, uint16_t disp, int reg);
+	void emitUnary(uint8_t op, uint8_t ext, int rm);
+	void emitUnaryMem(uint8_t op, uint8_t ext, int kind, uint16_t disp);
+	void emitSetcc(uint8_t cc, int rm);
+	void emitIndex(int reg, uint8_t base);
+	void emitMovzx(int reg, int kind, uint16_t disp);
+	void emitLoadSP();
+	void emitStepSP(uint8_t ext);
+	size_t emitJcc(uint8_t cc);
+	void patchJump(size_t at);
+	void emitState8(uint8_t op, int reg, uint8_t offset);
+
+	NES_JIT(const NES_JIT&);
+	NES_JIT& operator=(const NES_JIT&);
+};
+
+
+
+#endif /* NES_JIT_H_ */
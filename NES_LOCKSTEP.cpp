@@ -0,0 +1,1032 @@
+#include "header.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+
+#include "helper.h"
+#include "NES_LOCKSTEP.h"
+
+/*
+ * Byte lanes, LANE_WIDTH consoles per vector
+ * Only what the group kernels need: bitwise ops, wrapping add/sub, compares and a blend under the tail mask
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LANE_WIDTH 32
+typedef __m256i LANE_VEC;
+static inline LANE_VEC laneLoad(const uint8_t* p) { return _mm256_loadu_si256((const __m256i*) p); }
+static inline void laneStore(uint8_t* p, LANE_VEC v) { _mm256_storeu_si256((__m256i*) p, v); }
+static inline LANE_VEC laneSplat(uint8_t v) { return _mm256_set1_epi8((char) v); }
+static inline LANE_VEC laneAnd(LANE_VEC a, LANE_VEC b) { return _mm256_and_si256(a, b); }
+static inline LANE_VEC laneOr(LANE_VEC a, LANE_VEC b) { return _mm256_or_si256(a, b); }
+static inline LANE_VEC laneXor(LANE_VEC a, LANE_VEC b) { return _mm256_xor_si256(a, b); }
+static inline LANE_VEC laneAdd(LANE_VEC a, LANE_VEC b) { return _mm256_add_epi8(a, b); }
+static inline LANE_VEC laneSub(LANE_VEC a, LANE_VEC b) { return _mm256_sub_epi8(a, b); }
+static inline LANE_VEC laneEqual(LANE_VEC a, LANE_VEC b) { return _mm256_cmpeq_epi8(a, b); }
+static inline LANE_VEC laneMax(LANE_VEC a, LANE_VEC b) { return _mm256_max_epu8(a, b); }
+static inline LANE_VEC laneShiftRight(LANE_VEC a) { return _mm256_and_si256(_mm256_srli_epi16(a, 1), laneSplat(0x7f)); }
+static inline LANE_VEC laneSelect(LANE_VEC mask, LANE_VEC a, LANE_VEC b) { return _mm256_blendv_epi8(b, a, mask); }
+static inline LANE_VEC laneMask(uint32_t remaining) { //the first remaining lanes
+	if(remaining >= LANE_WIDTH) return laneSplat(0xff);
+	return _mm256_cmpgt_epi8(laneSplat((uint8_t) remaining), _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+			16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31));
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LANE_WIDTH 16
+typedef __m128i LANE_VEC;
+static inline LANE_VEC laneLoad(const uint8_t* p) { return _mm_loadu_si128((const __m128i*) p); }
+static inline void laneStore(uint8_t* p, LANE_VEC v) { _mm_storeu_si128((__m128i*) p, v); }
+static inline LANE_VEC laneSplat(uint8_t v) { return _mm_set1_epi8((char) v); }
+static inline LANE_VEC laneAnd(LANE_VEC a, LANE_VEC b) { return _mm_and_si128(a, b); }
+static inline LANE_VEC laneOr(LANE_VEC a, LANE_VEC b) { return _mm_or_si128(a, b); }
+static inline LANE_VEC laneXor(LANE_VEC a, LANE_VEC b) { return _mm_xor_si128(a, b); }
+static inline LANE_VEC laneAdd(LANE_VEC a, LANE_VEC b) { return _mm_add_epi8(a, b); }
+static inline LANE_VEC laneSub(LANE_VEC a, LANE_VEC b) { return _mm_sub_epi8(a, b); }
+static inline LANE_VEC laneEqual(LANE_VEC a, LANE_VEC b) { return _mm_cmpeq_epi8(a, b); }
+static inline LANE_VEC laneMax(LANE_VEC a, LANE_VEC b) { return _mm_max_epu8(a, b); }
+static inline LANE_VEC laneShiftRight(LANE_VEC a) { return _mm_and_si128(_mm_srli_epi16(a, 1), laneSplat(0x7f)); }
+static inline LANE_VEC laneSelect(LANE_VEC mask, LANE_VEC a, LANE_VEC b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+static inline LANE_VEC laneMask(uint32_t remaining) { //the first remaining lanes
+	if(remaining >= LANE_WIDTH) return laneSplat(0xff);
+	return _mm_cmpgt_epi8(laneSplat((uint8_t) remaining), _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+#else
+#define LANE_WIDTH 1
+typedef uint8_t LANE_VEC;
+static inline LANE_VEC laneLoad(const uint8_t* p) { return *p; }
+static inline void laneStore(uint8_t* p, LANE_VEC v) { *p = v; }
+static inline LANE_VEC laneSplat(uint8_t v) { return v; }
+static inline LANE_VEC laneAnd(LANE_VEC a, LANE_VEC b) { return a & b; }
+static inline LANE_VEC laneOr(LANE_VEC a, LANE_VEC b) { return a | b; }
+static inline LANE_VEC laneXor(LANE_VEC a, LANE_VEC b) { return a ^ b; }
+static inline LANE_VEC laneAdd(LANE_VEC a, LANE_VEC b) { return a + b; }
+static inline LANE_VEC laneSub(LANE_VEC a, LANE_VEC b) { return a - b; }
+static inline LANE_VEC laneEqual(LANE_VEC a, LANE_VEC b) { return a == b ? 0xff : 0; }
+static inline LANE_VEC laneMax(LANE_VEC a, LANE_VEC b) { return a > b ? a : b; }
+static inline LANE_VEC laneShiftRight(LANE_VEC a) { return a >> 1; }
+static inline LANE_VEC laneSelect(LANE_VEC mask, LANE_VEC a, LANE_VEC b) { return (mask & a) | (~mask & b); }
+static inline LANE_VEC laneMask(uint32_t remaining) { return remaining > 0 ? 0xff : 0; }
+#endif
+
+//P with N and Z taken from value
+static inline LANE_VEC laneSetNZ(LANE_VEC p, LANE_VEC value) {
+	LANE_VEC zero = laneAnd(laneEqual(value, laneSplat(0)), laneSplat(0x02));
+	return laneOr(laneOr(laneAnd(p, laneSplat(0x7d)), zero), laneAnd(value, laneSplat(0x80)));
+}
+
+//CMP/CPX/CPY, carry is set when the register is not below the operand
+static inline LANE_VEC laneCompare(LANE_VEC p, LANE_VEC reg, LANE_VEC operand) {
+	LANE_VEC carry = laneAnd(laneEqual(laneMax(reg, operand), reg), laneSplat(0x01));
+	return laneOr(laneSetNZ(laneAnd(p, laneSplat(0xfe)), laneSub(reg, operand)), carry);
+}
+
+static inline void laneUpdate(uint8_t* array, LANE_VEC mask, LANE_VEC value) { laneStore(array, laneSelect(mask, value, laneLoad(array))); }
+
+//The same on a single lane
+static inline uint8_t setNZ(uint8_t p, uint8_t value) { return (p & 0x7d) | (value == 0 ? 0x02 : 0) | (value & 0x80); }
+static inline uint8_t compare(uint8_t p, uint8_t reg, uint8_t value) { return setNZ(p & 0xfe, reg - value) | (reg >= value ? 0x01 : 0); }
+
+static inline uint8_t shiftLeft(uint8_t& p, uint8_t value) { p = (p & 0xfe) | (value >> 7); return value << 1; }
+static inline uint8_t shiftRight(uint8_t& p, uint8_t value) { p = (p & 0xfe) | (value & 0x01); return value >> 1; }
+static inline uint8_t rotateLeft(uint8_t& p, uint8_t value) { uint8_t carry = p & 0x01; p = (p & 0xfe) | (value >> 7); return (value << 1) | carry; }
+static inline uint8_t rotateRight(uint8_t& p, uint8_t value) { uint8_t carry = p << 7; p = (p & 0xfe) | (value & 0x01); return (value >> 1) | carry; }
+
+static inline uint16_t word(uint8_t low, uint8_t high) { return low | (high << 8); }
+
+static inline void addWithCarry(uint8_t& a, uint8_t& p, uint8_t value) {
+	uint16_t sum = a + value + (p & 0x01);
+	uint8_t result = sum & 0xff;
+	p = (p & 0xbe) | (sum > 0xff ? 0x01 : 0) | ((~(a ^ value) & (a ^ result) & 0x80) ? 0x40 : 0);
+	a = result;
+	p = setNZ(p, a);
+}
+
+enum LOCKSTEP_KIND {
+	KIND_NONE, //runOp on every lane
+	KIND_REGISTER, //registers and immediates only, vector kernels
+	KIND_MEMORY, //one load, store or read-modify-write per lane
+	KIND_STACK,
+	KIND_CONTROL //branches, jumps, calls and returns, always the last instruction of a block
+};
+
+//What KIND_MEMORY instructions do with their byte, stores first as the only ones not reading it
+#define LOCKSTEP_OPERATIONS(X) \
+	X(STA) X(STX) X(STY) X(SAX) \
+	X(LDA) X(LDX) X(LDY) X(LAX) X(NOP) \
+	X(ADC) X(SBC) X(AND) X(ORA) X(EOR) X(CMP) X(CPX) X(CPY) X(BIT) \
+	X(INC) X(DEC) X(ASL) X(LSR) X(ROL) X(ROR) \
+	X(SLO) X(RLA) X(SRE) X(RRA) X(DCP) X(ISB)
+
+#define LOCKSTEP_OPERATION_ENUM(name) OPERATION_##name,
+enum LOCKSTEP_OPERATION {
+	OPERATION_NONE,
+	LOCKSTEP_OPERATIONS(LOCKSTEP_OPERATION_ENUM)
+};
+#undef LOCKSTEP_OPERATION_ENUM
+
+//What a step did besides running its instructions
+#define EFFECT_INTERRUPT 0x01 //touched a device or cleared I, an interrupt may be due before the next instruction
+#define EFFECT_REMAP 0x02 //wrote a mapper register or went through runOp, the code under the lanes may differ now
+#define EFFECT_DIVERGED 0x04 //the lanes took different paths
+
+static uint8_t kinds[256];
+static uint8_t operations[256];
+
+static bool isRegisterKernel(uint8_t opcode) {
+	switch(opcode) {
+	case 0xa9: case 0xa2: case 0xa0: //LDA, LDX, LDY immediate
+	case 0xaa: case 0xa8: case 0x8a: case 0x98: case 0xba: case 0x9a: //transfers
+	case 0xe8: case 0xc8: case 0xca: case 0x88: //INX, INY, DEX, DEY
+	case 0x29: case 0x09: case 0x49: //AND, ORA, EOR immediate
+	case 0xc9: case 0xe0: case 0xc0: //CMP, CPX, CPY immediate
+	case 0x18: case 0x38: case 0x58: case 0x78: case 0xb8: case 0xd8: case 0xf8: //flag clears and sets
+	case 0xea: //NOP
+	case 0x0a: case 0x4a: case 0x2a: case 0x6a: //shifts and rotates of A
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool buildTables() {
+#define LOCKSTEP_HANDLER(name) { &NES_CPU::name, OPERATION_##name },
+	static const struct {
+		NES_HANDLER handler;
+		uint8_t operation;
+	} memoryOps[] = {
+		LOCKSTEP_OPERATIONS(LOCKSTEP_HANDLER)
+	};
+#undef LOCKSTEP_HANDLER
+
+	for(int opcode = 0; opcode < 256; ++opcode) {
+		const NES_OPCODE& op = NES_CPU::opcodes[opcode];
+		kinds[opcode] = KIND_NONE;
+		operations[opcode] = OPERATION_NONE;
+
+		if(isRegisterKernel(opcode) || (op.handler == &NES_CPU::NOP && op.mode == IMP)) { //the unofficial NOPs have no case in the kernel
+			kinds[opcode] = KIND_REGISTER;
+			continue;
+		}
+
+		switch(opcode) {
+		case 0x48: case 0x08: case 0x68: case 0x28: //PHA, PHP, PLA, PLP
+			kinds[opcode] = KIND_STACK;
+			continue;
+		case 0x4c: case 0x6c: case 0x20: case 0x60: case 0x40: //JMP, JMP indirect, JSR, RTS, RTI
+			kinds[opcode] = KIND_CONTROL;
+			continue;
+		}
+		if(op.mode == REL) {
+			kinds[opcode] = KIND_CONTROL;
+			continue;
+		}
+
+		if(op.mode == IMP || op.mode == ACC || op.mode == IND) continue;
+		for(size_t i = 0; i < sizeof(memoryOps) / sizeof(memoryOps[0]); ++i) {
+			if(op.handler != memoryOps[i].handler) continue;
+			kinds[opcode] = KIND_MEMORY;
+			operations[opcode] = memoryOps[i].operation;
+		}
+	}
+	return true;
+}
+
+NES_LOCKSTEP::NES_LOCKSTEP() {
+	lanes = NULL;
+	count = 0;
+	lane = NULL;
+	PC = NULL;
+	A = X = Y = P = SP = NULL;
+	cycles = NULL;
+	limit = NULL;
+	ram = NULL;
+	stopped = NULL;
+	faulted = NULL;
+	code = NULL;
+	dirty = NULL;
+	dirtyLanes = 0;
+	addresses = NULL;
+	penalties = NULL;
+	order = NULL;
+	scratch = NULL;
+	groupSteps = 0;
+	scalarSteps = 0;
+	aloneRuns = 0;
+}
+
+NES_LOCKSTEP::~NES_LOCKSTEP() {
+	freeArrays();
+}
+
+void NES_LOCKSTEP::freeArrays() {
+	delete[] lanes;
+	delete[] lane;
+	delete[] PC;
+	delete[] A;
+	delete[] X;
+	delete[] Y;
+	delete[] P;
+	delete[] SP;
+	delete[] cycles;
+	delete[] limit;
+	delete[] ram;
+	delete[] stopped;
+	delete[] faulted;
+	delete[] code;
+	delete[] dirty;
+	delete[] addresses;
+	delete[] penalties;
+	delete[] order;
+	delete[] scratch;
+
+	lanes = NULL;
+	lane = NULL;
+	PC = NULL;
+	A = X = Y = P = SP = NULL;
+	cycles = NULL;
+	limit = NULL;
+	ram = NULL;
+	stopped = NULL;
+	faulted = NULL;
+	code = NULL;
+	dirty = NULL;
+	dirtyLanes = 0;
+	addresses = NULL;
+	penalties = NULL;
+	order = NULL;
+	scratch = NULL;
+	count = 0;
+}
+
+bool NES_LOCKSTEP::init(const char* romPath, uint32_t _count) {
+	NES_ROM rom;
+	if(!rom.loadRom(romPath)) return false;
+	return init(rom, _count);
+}
+
+bool NES_LOCKSTEP::init(const NES_ROM& rom, uint32_t _count) {
+	static const bool tablesBuilt = buildTables();
+	(void) tablesBuilt;
+
+	freeArrays();
+
+	if(_count == 0) {
+		printf("ERROR: Lock-step run needs at least one lane\n");
+		return false;
+	}
+
+	lanes = new NES[_count];
+	for(uint32_t i = 0; i < _count; ++i) {
+		if(!lanes[i].init(rom)) {
+			delete[] lanes;
+			lanes = NULL;
+			return false;
+		}
+	}
+
+	count = _count;
+	uint32_t padded = count + LANE_WIDTH; //the last vector may start at the last slot
+
+	lane = new uint32_t[padded]();
+	PC = new uint16_t[padded]();
+	A = new uint8_t[padded]();
+	X = new uint8_t[padded]();
+	Y = new uint8_t[padded]();
+	P = new uint8_t[padded]();
+	SP = new uint8_t[padded]();
+	cycles = new uint64_t[padded]();
+	limit = new uint64_t[padded]();
+	ram = new uint8_t*[padded]();
+	stopped = new uint8_t[count]();
+	faulted = new uint8_t[count]();
+	code = new const uint8_t*[padded]();
+	dirty = new uint8_t[padded]();
+	addresses = new uint16_t[padded]();
+	penalties = new uint8_t[padded]();
+	order = new uint32_t[count]();
+	scratch = new uint64_t[count]();
+
+	for(uint32_t i = 0; i < count; ++i) {
+		lane[i] = i;
+		ram[i] = lanes[i].bus.ram;
+		load(i);
+	}
+	groupSteps = 0;
+	scalarSteps = 0;
+	aloneRuns = 0;
+	return true;
+}
+
+void NES_LOCKSTEP::setButtons(uint32_t lane, uint8_t port, uint8_t pressed) {
+	if(lane < count) lanes[lane].setButtons(port, pressed);
+}
+
+void NES_LOCKSTEP::load(uint32_t slot) {
+	NES_CPU& cpu = lanes[lane[slot]].cpu;
+	PC[slot] = cpu.PC;
+	A[slot] = cpu.A;
+	X[slot] = cpu.X;
+	Y[slot] = cpu.Y;
+	P[slot] = cpu.getP();
+	SP[slot] = cpu.SP;
+	cycles[slot] = cpu.cycles;
+}
+
+void NES_LOCKSTEP::store(uint32_t slot) {
+	NES_CPU& cpu = lanes[lane[slot]].cpu;
+	cpu.PC = PC[slot];
+	cpu.A = A[slot];
+	cpu.X = X[slot];
+	cpu.Y = Y[slot];
+	cpu.setP(P[slot]);
+	cpu.SP = SP[slot];
+	cpu.cycles = cycles[slot];
+}
+
+void NES_LOCKSTEP::swapSlots(uint32_t a, uint32_t b) {
+	if(a == b) return;
+	std::swap(lane[a], lane[b]);
+	std::swap(PC[a], PC[b]);
+	std::swap(A[a], A[b]);
+	std::swap(X[a], X[b]);
+	std::swap(Y[a], Y[b]);
+	std::swap(P[a], P[b]);
+	std::swap(SP[a], SP[b]);
+	std::swap(cycles[a], cycles[b]);
+	std::swap(limit[a], limit[b]);
+	std::swap(ram[a], ram[b]);
+	std::swap(code[a], code[b]);
+	std::swap(dirty[a], dirty[b]);
+}
+
+const uint8_t* NES_LOCKSTEP::codeOf(uint32_t slot) {
+	/*
+	 * Lanes run the same code when PC's page maps the same PRG ROM, every lane shares the cached image
+	 * Code in RAM or on the cartridge's RAM can differ between lanes, it gets the lane's own NES as a key
+	 */
+	NES& nes = lanes[lane[slot]];
+	uint8_t page = PC[slot] >> CPU_PAGE_SHIFT;
+	const uint8_t* source = nes.bus.readMap[page];
+	if(PC[slot] < 0x8000 || source == NULL || nes.bus.writeMap[page] != NULL) return (const uint8_t*) &nes;
+	return source;
+}
+
+inline bool NES_LOCKSTEP::isBefore(uint32_t a, uint32_t b) {
+	if(PC[a] != PC[b]) return PC[a] < PC[b];
+	return (uintptr_t) code[a] < (uintptr_t) code[b];
+}
+
+void NES_LOCKSTEP::permuteSlots(uint32_t begin, uint32_t end) {
+	//Slot begin + i takes what order[i] held
+	uint32_t n = end - begin;
+
+#define LOCKSTEP_PERMUTE(array, type) { \
+		type* temp = (type*) scratch; \
+		for(uint32_t i = 0; i < n; ++i) temp[i] = array[order[i]]; \
+		memcpy(&array[begin], temp, n * sizeof(type)); \
+	}
+	LOCKSTEP_PERMUTE(lane, uint32_t)
+	LOCKSTEP_PERMUTE(PC, uint16_t)
+	LOCKSTEP_PERMUTE(A, uint8_t)
+	LOCKSTEP_PERMUTE(X, uint8_t)
+	LOCKSTEP_PERMUTE(Y, uint8_t)
+	LOCKSTEP_PERMUTE(P, uint8_t)
+	LOCKSTEP_PERMUTE(SP, uint8_t)
+	LOCKSTEP_PERMUTE(cycles, uint64_t)
+	LOCKSTEP_PERMUTE(limit, uint64_t)
+	LOCKSTEP_PERMUTE(ram, uint8_t*)
+	LOCKSTEP_PERMUTE(code, const uint8_t*)
+	LOCKSTEP_PERMUTE(dirty, uint8_t)
+#undef LOCKSTEP_PERMUTE
+}
+
+void NES_LOCKSTEP::sortSlots(uint32_t begin, uint32_t end) {
+	bool sorted = true;
+	for(uint32_t s = begin + 1; s < end && sorted; ++s) sorted = !isBefore(s, s - 1);
+	if(sorted) return;
+
+	uint32_t n = end - begin;
+	for(uint32_t i = 0; i < n; ++i) order[i] = begin + i;
+	std::sort(order, order + n, [this](uint32_t a, uint32_t b) { return isBefore(a, b); });
+	permuteSlots(begin, end);
+}
+
+bool NES_LOCKSTEP::mergeSlots(uint32_t begin, uint32_t middle, uint32_t end) {
+	//Both halves are sorted, only the part of the second half below the first half's last slot moves
+	if(middle == begin) return false;
+	uint32_t stop = middle;
+	while(stop < end && isBefore(stop, middle - 1)) stop++;
+	if(stop == middle) return false;
+
+	uint32_t i = begin;
+	uint32_t j = middle;
+	uint32_t n = 0;
+	while(i < middle && j < stop) order[n++] = isBefore(j, i) ? j++ : i++;
+	while(i < middle) order[n++] = i++;
+	while(j < stop) order[n++] = j++;
+	permuteSlots(begin, stop);
+	return true;
+}
+
+uint32_t NES_LOCKSTEP::regroup() {
+	//Running lanes to the front, then one sort for all of them
+	uint32_t active = 0;
+	for(uint32_t s = 0; s < count; ++s) {
+		if(!stopped[lane[s]]) swapSlots(s, active++);
+	}
+	for(uint32_t s = 0; s < active; ++s) {
+		code[s] = codeOf(s);
+		dirty[s] = 1; //synced lanes may have an interrupt due
+	}
+	dirtyLanes = active;
+
+	sortSlots(0, active);
+	return active;
+}
+
+uint32_t NES_LOCKSTEP::runFrame() {
+	for(uint32_t s = 0; s < count; ++s) {
+		stopped[lane[s]] = faulted[lane[s]];
+		load(s);
+		limit[s] = lanes[lane[s]].nextEventCycle();
+		if(!stopped[lane[s]] && cycles[s] >= limit[s]) sync(s);
+	}
+
+	//Every pass runs each lane up to its next device event, lanes meet again in the sort that follows
+	for(;;) {
+		uint32_t active = regroup();
+		if(active == 0) break;
+		runLanes(0, active);
+	}
+
+	uint32_t faults = 0;
+	for(uint32_t s = 0; s < count; ++s) {
+		store(s);
+		faults += faulted[lane[s]];
+	}
+	return faults;
+}
+
+void NES_LOCKSTEP::runLanes(uint32_t begin, uint32_t end) {
+	/*
+	 * Runs the sorted slots begin..end up to each lane's next device event
+	 * The first group steps, lanes reaching their event sync and move in front of begin,
+	 * the rest of the group is sorted back in behind it
+	 */
+	uint32_t groupEnd = begin;
+	bool scan = true;
+
+	while(end - begin >= LOCKSTEP_MIN_GROUP) {
+		if(scan) {
+			groupEnd = begin + 1;
+			while(groupEnd < end && PC[groupEnd] == PC[begin] && code[groupEnd] == code[begin]) groupEnd++;
+		}
+
+		//Lanes with an interrupt due take it first, on their own
+		uint32_t stepEnd = begin;
+		if(dirtyLanes != 0) {
+			for(uint32_t s = begin; s < groupEnd; ++s) {
+				if(!dirty[s]) continue;
+				dirty[s] = 0;
+				dirtyLanes--;
+
+				NES_CPU& cpu = lanes[lane[s]].cpu;
+				if(cpu.nmiPending || (cpu.irqLines != 0 && !(P[s] & 0x04))) swapSlots(s, stepEnd++);
+			}
+		}
+
+		uint8_t effects;
+		if(stepEnd != begin) {
+			runInterrupts(begin, stepEnd);
+			effects = EFFECT_REMAP; //the vectors may point into different banks
+		} else {
+			stepEnd = groupEnd;
+			effects = step(begin, stepEnd, groupEnd < end ? PC[groupEnd] : 0);
+		}
+
+		for(uint32_t s = begin; s < stepEnd; ++s) {
+			if(stopped[lane[s]] || cycles[s] >= limit[s]) {
+				if(!stopped[lane[s]]) sync(s);
+				swapSlots(s, begin++);
+			} else if(effects & EFFECT_INTERRUPT) {
+				dirtyLanes += !dirty[s];
+				dirty[s] = 1;
+			}
+		}
+		if(begin == stepEnd) {
+			scan = true;
+			continue;
+		}
+
+		if(effects & EFFECT_REMAP) {
+			for(uint32_t s = begin; s < stepEnd; ++s) code[s] = codeOf(s);
+		}
+		if(effects & (EFFECT_REMAP | EFFECT_DIVERGED)) sortSlots(begin, stepEnd);
+		bool merged = mergeSlots(begin, stepEnd, end);
+
+		//Still in front and in one piece, the group only grows by the ones it caught up with
+		scan = merged || (effects & (EFFECT_REMAP | EFFECT_DIVERGED)) != 0;
+		if(!scan) {
+			groupEnd = stepEnd;
+			while(groupEnd < end && PC[groupEnd] == PC[begin] && code[groupEnd] == code[begin]) groupEnd++;
+		}
+	}
+
+	for(uint32_t s = begin; s < end; ++s) runAlone(s);
+}
+
+void NES_LOCKSTEP::runAlone(uint32_t slot) {
+	//Same as a pass of NES::runUntil, on the lane's own block cache
+	NES& nes = lanes[lane[slot]];
+	store(slot);
+	bool running = nes.cpu.runUntil(limit[slot]);
+	load(slot);
+	aloneRuns++;
+
+	if(!running) {
+		nes.catchUpDevices();
+		faulted[lane[slot]] = 1;
+		stopped[lane[slot]] = 1;
+		return;
+	}
+	sync(slot);
+}
+
+void NES_LOCKSTEP::sync(uint32_t slot) {
+	//Same as the end of a pass of NES::runUntil that reached its limit
+	NES& nes = lanes[lane[slot]];
+	nes.cpu.cycles = cycles[slot];
+	do {
+		nes.catchUpDevices();
+		if(nes.ppu.frameComplete) {
+			nes.endFrame();
+			stopped[lane[slot]] = 1;
+			break;
+		}
+		limit[slot] = nes.nextEventCycle();
+	} while(nes.cpu.cycles >= limit[slot]);
+	cycles[slot] = nes.cpu.cycles;
+}
+
+uint8_t NES_LOCKSTEP::step(uint32_t begin, uint32_t end, uint16_t stopAt) {
+	/*
+	 * Runs the leader's block on the whole group, up to the first instruction without a kernel, the first one
+	 * touching a device, the next group's PC and as far as the worst case keeps every lane below its limit
+	 */
+	NES_BLOCK* block = lanes[lane[begin]].cpu.blocks.lookup(PC[begin]);
+	if(block == NULL || kinds[block->ops[0].opcode] == KIND_NONE) {
+		runScalar(begin, end);
+		return EFFECT_INTERRUPT | EFFECT_REMAP;
+	}
+
+	uint64_t headroom = UINT64_MAX;
+	for(uint32_t s = begin; s < end; ++s) headroom = std::min(headroom, limit[s] - cycles[s]);
+
+	uint64_t pending = 0; //base cycles of the instructions so far, added to every lane at the end
+	uint64_t worst = 0;
+	uint8_t effects = 0;
+	bool jumped = false;
+	uint16_t next = PC[begin];
+	const uint8_t* raw = block->raw;
+	uint32_t ran = 0;
+
+	for(uint8_t i = 0; i < block->length; ++i) {
+		const NES_DECODED_OP& op = block->ops[i];
+		uint8_t kind = kinds[op.opcode];
+		if(kind == KIND_NONE || (i > 0 && (worst >= headroom || op.PC == stopAt))) break;
+
+		uint8_t operand = op.bytes > 1 ? raw[1] : 0;
+		uint16_t absolute = op.bytes > 2 ? word(operand, raw[2]) : operand;
+		raw += op.bytes;
+
+		switch(kind) {
+		case KIND_REGISTER:
+			runRegisterOp(op.opcode, operand, begin, end);
+			if(op.opcode == 0x58) effects |= EFFECT_INTERRUPT; //CLI
+			break;
+		case KIND_MEMORY:
+			runMemoryOp(op, operand, absolute, begin, end, pending, effects);
+			break;
+		case KIND_STACK:
+			runStackOp(op.opcode, begin, end);
+			if(op.opcode == 0x28) effects |= EFFECT_INTERRUPT; //PLP
+			break;
+		case KIND_CONTROL:
+			runControlOp(op, operand, absolute, begin, end, pending, effects);
+			jumped = true;
+			break;
+		}
+
+		pending += op.cycles;
+		worst += op.cycles + op.pagePenalty + (op.mode == REL ? 2 : 0);
+		next = op.PC + op.bytes;
+		ran++;
+		if(effects != 0 || jumped) break;
+	}
+	groupSteps += (uint64_t) ran * (end - begin);
+
+	for(uint32_t s = begin; s < end; ++s) {
+		cycles[s] += pending;
+		if(!jumped) PC[s] = next;
+		else if(PC[s] != PC[begin]) effects |= EFFECT_DIVERGED;
+	}
+	return effects;
+}
+
+void NES_LOCKSTEP::runInterrupts(uint32_t begin, uint32_t end) {
+	//NES_CPU::interrupt on every lane of the range, each has one due
+	for(uint32_t s = begin; s < end; ++s) {
+		NES_CPU& cpu = lanes[lane[s]].cpu;
+		uint16_t vector = 0xfffe;
+		if(cpu.nmiPending) {
+			cpu.nmiPending = false;
+			vector = 0xfffa;
+		}
+
+		uint8_t* stack = ram[s] + 0x100;
+		stack[SP[s]--] = PC[s] >> 8;
+		stack[SP[s]--] = PC[s] & 0xff;
+		stack[SP[s]--] = (P[s] & 0xef) | 0x20;
+		P[s] |= 0x04;
+
+		uint8_t effects = 0;
+		uint8_t low = readLane(s, vector, cpu.opcode, 0, effects);
+		PC[s] = word(low, readLane(s, vector + 1, cpu.opcode, 0, effects));
+		cycles[s] += 7;
+	}
+}
+
+void NES_LOCKSTEP::runScalar(uint32_t begin, uint32_t end) {
+	for(uint32_t s = begin; s < end; ++s) {
+		NES& nes = lanes[lane[s]];
+		store(s);
+		if(nes.cpu.runOp() == 0) {
+			nes.catchUpDevices();
+			faulted[lane[s]] = 1;
+			stopped[lane[s]] = 1;
+		}
+		load(s);
+		scalarSteps++;
+	}
+}
+
+inline uint8_t NES_LOCKSTEP::readLane(uint32_t slot, uint16_t address, uint8_t opcode, uint64_t pending, uint8_t& effects) {
+	if(address < 0x2000) return ram[slot][address & (CPU_RAM_SIZE - 1)];
+
+	NES& nes = lanes[lane[slot]];
+	const uint8_t* page = nes.bus.readMap[address >> CPU_PAGE_SHIFT];
+	if(page != NULL) return page[address & (CPU_PAGE_SIZE - 1)];
+
+	//Devices look at the cycle and opcode of the instruction, as through NES_CPU::currentCycle
+	nes.cpu.cycles = cycles[slot] + pending;
+	nes.cpu.opcode = opcode;
+	effects |= EFFECT_INTERRUPT;
+	return nes.bus.read(address);
+}
+
+inline void NES_LOCKSTEP::writeLane(uint32_t slot, uint16_t address, uint8_t value, uint8_t opcode, uint64_t pending, uint8_t& effects) {
+	if(address < 0x2000) {
+		ram[slot][address & (CPU_RAM_SIZE - 1)] = value;
+		return;
+	}
+
+	NES& nes = lanes[lane[slot]];
+	uint8_t* page = nes.bus.writeMap[address >> CPU_PAGE_SHIFT];
+	if(page != NULL) {
+		page[address & (CPU_PAGE_SIZE - 1)] = value;
+		return;
+	}
+
+	uint64_t before = cycles[slot] + pending;
+	nes.cpu.cycles = before;
+	nes.cpu.opcode = opcode;
+	nes.bus.write(address, value);
+	cycles[slot] += nes.cpu.cycles - before; //OAM DMA
+	effects |= address >= 0x4020 ? EFFECT_INTERRUPT | EFFECT_REMAP : EFFECT_INTERRUPT;
+}
+
+void NES_LOCKSTEP::runRegisterOp(uint8_t opcode, uint8_t operand, uint32_t begin, uint32_t end) {
+	LANE_VEC imm = laneSplat(operand);
+	LANE_VEC one = laneSplat(1);
+
+	for(uint32_t i = begin; i < end; i += LANE_WIDTH) {
+		LANE_VEC mask = laneMask(end - i);
+		LANE_VEC p = laneLoad(&P[i]);
+
+		switch(opcode) {
+		case 0xa9: laneUpdate(&A[i], mask, imm); p = laneSetNZ(p, imm); break;
+		case 0xa2: laneUpdate(&X[i], mask, imm); p = laneSetNZ(p, imm); break;
+		case 0xa0: laneUpdate(&Y[i], mask, imm); p = laneSetNZ(p, imm); break;
+		case 0xaa: { LANE_VEC x = laneLoad(&A[i]); laneUpdate(&X[i], mask, x); p = laneSetNZ(p, x); break; }
+		case 0xa8: { LANE_VEC y = laneLoad(&A[i]); laneUpdate(&Y[i], mask, y); p = laneSetNZ(p, y); break; }
+		case 0x8a: { LANE_VEC a = laneLoad(&X[i]); laneUpdate(&A[i], mask, a); p = laneSetNZ(p, a); break; }
+		case 0x98: { LANE_VEC a = laneLoad(&Y[i]); laneUpdate(&A[i], mask, a); p = laneSetNZ(p, a); break; }
+		case 0xba: { LANE_VEC x = laneLoad(&SP[i]); laneUpdate(&X[i], mask, x); p = laneSetNZ(p, x); break; }
+		case 0x9a: laneUpdate(&SP[i], mask, laneLoad(&X[i])); break;
+		case 0xe8: { LANE_VEC x = laneAdd(laneLoad(&X[i]), one); laneUpdate(&X[i], mask, x); p = laneSetNZ(p, x); break; }
+		case 0xc8: { LANE_VEC y = laneAdd(laneLoad(&Y[i]), one); laneUpdate(&Y[i], mask, y); p = laneSetNZ(p, y); break; }
+		case 0xca: { LANE_VEC x = laneSub(laneLoad(&X[i]), one); laneUpdate(&X[i], mask, x); p = laneSetNZ(p, x); break; }
+		case 0x88: { LANE_VEC y = laneSub(laneLoad(&Y[i]), one); laneUpdate(&Y[i], mask, y); p = laneSetNZ(p, y); break; }
+		case 0x29: { LANE_VEC a = laneAnd(laneLoad(&A[i]), imm); laneUpdate(&A[i], mask, a); p = laneSetNZ(p, a); break; }
+		case 0x09: { LANE_VEC a = laneOr(laneLoad(&A[i]), imm); laneUpdate(&A[i], mask, a); p = laneSetNZ(p, a); break; }
+		case 0x49: { LANE_VEC a = laneXor(laneLoad(&A[i]), imm); laneUpdate(&A[i], mask, a); p = laneSetNZ(p, a); break; }
+		case 0xc9: p = laneCompare(p, laneLoad(&A[i]), imm); break;
+		case 0xe0: p = laneCompare(p, laneLoad(&X[i]), imm); break;
+		case 0xc0: p = laneCompare(p, laneLoad(&Y[i]), imm); break;
+		case 0x18: p = laneAnd(p, laneSplat(0xfe)); break;
+		case 0x38: p = laneOr(p, laneSplat(0x01)); break;
+		case 0x58: p = laneAnd(p, laneSplat(0xfb)); break;
+		case 0x78: p = laneOr(p, laneSplat(0x04)); break;
+		case 0xb8: p = laneAnd(p, laneSplat(0xbf)); break;
+		case 0xd8: p = laneAnd(p, laneSplat(0xf7)); break;
+		case 0xf8: p = laneOr(p, laneSplat(0x08)); break;
+		case 0xea: break;
+		case 0x0a: { //ASL
+			LANE_VEC a = laneLoad(&A[i]);
+			LANE_VEC carry = laneAnd(laneEqual(laneAnd(a, laneSplat(0x80)), laneSplat(0x80)), one);
+			a = laneAdd(a, a);
+			laneUpdate(&A[i], mask, a);
+			p = laneOr(laneSetNZ(laneAnd(p, laneSplat(0xfe)), a), carry);
+			break;
+		}
+		case 0x4a: { //LSR
+			LANE_VEC a = laneLoad(&A[i]);
+			LANE_VEC carry = laneAnd(a, one);
+			a = laneShiftRight(a);
+			laneUpdate(&A[i], mask, a);
+			p = laneOr(laneSetNZ(laneAnd(p, laneSplat(0xfe)), a), carry);
+			break;
+		}
+		case 0x2a: { //ROL
+			LANE_VEC a = laneLoad(&A[i]);
+			LANE_VEC carry = laneAnd(laneEqual(laneAnd(a, laneSplat(0x80)), laneSplat(0x80)), one);
+			a = laneOr(laneAdd(a, a), laneAnd(p, one));
+			laneUpdate(&A[i], mask, a);
+			p = laneOr(laneSetNZ(laneAnd(p, laneSplat(0xfe)), a), carry);
+			break;
+		}
+		case 0x6a: { //ROR
+			LANE_VEC a = laneLoad(&A[i]);
+			LANE_VEC carry = laneAnd(a, one);
+			LANE_VEC top = laneAnd(laneEqual(laneAnd(p, one), one), laneSplat(0x80));
+			a = laneOr(laneShiftRight(a), top);
+			laneUpdate(&A[i], mask, a);
+			p = laneOr(laneSetNZ(laneAnd(p, laneSplat(0xfe)), a), carry);
+			break;
+		}
+		}
+
+		laneUpdate(&P[i], mask, p);
+	}
+}
+
+void NES_LOCKSTEP::runMemoryOp(const NES_DECODED_OP& op, uint8_t operand, uint16_t absolute, uint32_t begin, uint32_t end, uint64_t pending, uint8_t& effects) {
+	/*
+	 * The effective addresses of NES_CPU::resolveAddress first, per lane on its own registers and RAM,
+	 * then the handler's work on every lane, straight on RAM when no lane addresses anything else
+	 */
+	uint16_t touched = 0; //every address ORed, below 0x2000 only if all of them are internal RAM
+	bool indexed = false;
+
+	switch(op.mode) {
+	case ZP0:
+	case ABS:
+		for(uint32_t s = begin; s < end; ++s) addresses[s] = absolute;
+		touched = absolute;
+		break;
+	case ZPX:
+		for(uint32_t s = begin; s < end; ++s) addresses[s] = (uint8_t) (operand + X[s]);
+		break;
+	case ZPY:
+		for(uint32_t s = begin; s < end; ++s) addresses[s] = (uint8_t) (operand + Y[s]);
+		break;
+	case ABX:
+	case ABY: {
+		const uint8_t* index = op.mode == ABX ? X : Y;
+		for(uint32_t s = begin; s < end; ++s) {
+			addresses[s] = absolute + index[s];
+			penalties[s] = isPageCrossed(absolute, addresses[s]);
+			touched |= addresses[s];
+		}
+		indexed = true;
+		break;
+	}
+	case IZX:
+		for(uint32_t s = begin; s < end; ++s) {
+			uint8_t pointer = operand + X[s];
+			addresses[s] = word(ram[s][pointer], ram[s][(uint8_t) (pointer + 1)]);
+			touched |= addresses[s];
+		}
+		break;
+	case IZY:
+		for(uint32_t s = begin; s < end; ++s) {
+			uint16_t base = word(ram[s][operand], ram[s][(uint8_t) (operand + 1)]);
+			addresses[s] = base + Y[s];
+			penalties[s] = isPageCrossed(base, addresses[s]);
+			touched |= addresses[s];
+		}
+		indexed = true;
+		break;
+	}
+
+	bool direct = op.mode != IMM && touched < 0x2000;
+	auto load = [&](uint32_t s) -> uint8_t {
+		if(direct) return ram[s][addresses[s] & (CPU_RAM_SIZE - 1)];
+		if(op.mode == IMM) return operand;
+		return readLane(s, addresses[s], op.opcode, pending, effects);
+	};
+	auto store = [&](uint32_t s, uint8_t value) {
+		if(direct) ram[s][addresses[s] & (CPU_RAM_SIZE - 1)] = value;
+		else writeLane(s, addresses[s], value, op.opcode, pending, effects);
+	};
+
+	switch(operations[op.opcode]) {
+	case OPERATION_STA: for(uint32_t s = begin; s < end; ++s) store(s, A[s]); break;
+	case OPERATION_STX: for(uint32_t s = begin; s < end; ++s) store(s, X[s]); break;
+	case OPERATION_STY: for(uint32_t s = begin; s < end; ++s) store(s, Y[s]); break;
+	case OPERATION_SAX: for(uint32_t s = begin; s < end; ++s) store(s, A[s] & X[s]); break;
+
+	case OPERATION_LDA: for(uint32_t s = begin; s < end; ++s) { A[s] = load(s); P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_LDX: for(uint32_t s = begin; s < end; ++s) { X[s] = load(s); P[s] = setNZ(P[s], X[s]); } break;
+	case OPERATION_LDY: for(uint32_t s = begin; s < end; ++s) { Y[s] = load(s); P[s] = setNZ(P[s], Y[s]); } break;
+	case OPERATION_LAX: for(uint32_t s = begin; s < end; ++s) { A[s] = X[s] = load(s); P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_NOP: for(uint32_t s = begin; s < end; ++s) load(s); break; //the read can still reach a device
+
+	case OPERATION_ADC: for(uint32_t s = begin; s < end; ++s) addWithCarry(A[s], P[s], load(s)); break;
+	case OPERATION_SBC: for(uint32_t s = begin; s < end; ++s) addWithCarry(A[s], P[s], ~load(s)); break;
+	case OPERATION_AND: for(uint32_t s = begin; s < end; ++s) { A[s] &= load(s); P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_ORA: for(uint32_t s = begin; s < end; ++s) { A[s] |= load(s); P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_EOR: for(uint32_t s = begin; s < end; ++s) { A[s] ^= load(s); P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_CMP: for(uint32_t s = begin; s < end; ++s) P[s] = compare(P[s], A[s], load(s)); break;
+	case OPERATION_CPX: for(uint32_t s = begin; s < end; ++s) P[s] = compare(P[s], X[s], load(s)); break;
+	case OPERATION_CPY: for(uint32_t s = begin; s < end; ++s) P[s] = compare(P[s], Y[s], load(s)); break;
+	case OPERATION_BIT:
+		for(uint32_t s = begin; s < end; ++s) {
+			uint8_t value = load(s);
+			P[s] = (P[s] & 0x3d) | ((A[s] & value) == 0 ? 0x02 : 0) | (value & 0xc0);
+		}
+		break;
+
+	//Read-modify-write, the byte goes back before the registers change like in the handlers
+	case OPERATION_INC: for(uint32_t s = begin; s < end; ++s) { uint8_t value = load(s) + 1; store(s, value); P[s] = setNZ(P[s], value); } break;
+	case OPERATION_DEC: for(uint32_t s = begin; s < end; ++s) { uint8_t value = load(s) - 1; store(s, value); P[s] = setNZ(P[s], value); } break;
+	case OPERATION_ASL: for(uint32_t s = begin; s < end; ++s) { uint8_t value = shiftLeft(P[s], load(s)); store(s, value); P[s] = setNZ(P[s], value); } break;
+	case OPERATION_LSR: for(uint32_t s = begin; s < end; ++s) { uint8_t value = shiftRight(P[s], load(s)); store(s, value); P[s] = setNZ(P[s], value); } break;
+	case OPERATION_ROL: for(uint32_t s = begin; s < end; ++s) { uint8_t value = rotateLeft(P[s], load(s)); store(s, value); P[s] = setNZ(P[s], value); } break;
+	case OPERATION_ROR: for(uint32_t s = begin; s < end; ++s) { uint8_t value = rotateRight(P[s], load(s)); store(s, value); P[s] = setNZ(P[s], value); } break;
+	case OPERATION_SLO: for(uint32_t s = begin; s < end; ++s) { uint8_t value = shiftLeft(P[s], load(s)); store(s, value); A[s] |= value; P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_RLA: for(uint32_t s = begin; s < end; ++s) { uint8_t value = rotateLeft(P[s], load(s)); store(s, value); A[s] &= value; P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_SRE: for(uint32_t s = begin; s < end; ++s) { uint8_t value = shiftRight(P[s], load(s)); store(s, value); A[s] ^= value; P[s] = setNZ(P[s], A[s]); } break;
+	case OPERATION_RRA: for(uint32_t s = begin; s < end; ++s) { uint8_t value = rotateRight(P[s], load(s)); store(s, value); addWithCarry(A[s], P[s], value); } break;
+	case OPERATION_DCP: for(uint32_t s = begin; s < end; ++s) { uint8_t value = load(s) - 1; store(s, value); P[s] = compare(P[s], A[s], value); } break;
+	case OPERATION_ISB: for(uint32_t s = begin; s < end; ++s) { uint8_t value = load(s) + 1; store(s, value); addWithCarry(A[s], P[s], ~value); } break;
+	}
+
+	if(indexed && op.pagePenalty) {
+		for(uint32_t s = begin; s < end; ++s) cycles[s] += penalties[s];
+	}
+}
+
+void NES_LOCKSTEP::runStackOp(uint8_t opcode, uint32_t begin, uint32_t end) {
+	for(uint32_t s = begin; s < end; ++s) {
+		uint8_t* stack = ram[s] + 0x100;
+		switch(opcode) {
+		case 0x48: stack[SP[s]--] = A[s]; break; //PHA
+		case 0x08: stack[SP[s]--] = P[s] | 0x30; break; //PHP, with the Break bit
+		case 0x68: A[s] = stack[++SP[s]]; P[s] = setNZ(P[s], A[s]); break; //PLA
+		case 0x28: P[s] = (stack[++SP[s]] & 0xef) | 0x20; break; //PLP
+		}
+	}
+}
+
+void NES_LOCKSTEP::runControlOp(const NES_DECODED_OP& op, uint8_t operand, uint16_t absolute, uint32_t begin, uint32_t end, uint64_t pending, uint8_t& effects) {
+	uint16_t next = op.PC + op.bytes;
+
+	switch(op.opcode) {
+	case 0x4c: //JMP
+		for(uint32_t s = begin; s < end; ++s) PC[s] = absolute;
+		break;
+
+	case 0x6c: { //JMP indirect, without carry into the pointer's high byte
+		uint16_t high = (absolute & 0xff00) | ((absolute + 1) & 0x00ff);
+		for(uint32_t s = begin; s < end; ++s) {
+			uint8_t low = readLane(s, absolute, op.opcode, pending, effects);
+			PC[s] = word(low, readLane(s, high, op.opcode, pending, effects));
+		}
+		break;
+	}
+
+	case 0x20: { //JSR, pushes the address of its last byte
+		uint16_t last = next - 1;
+		for(uint32_t s = begin; s < end; ++s) {
+			uint8_t* stack = ram[s] + 0x100;
+			stack[SP[s]--] = last >> 8;
+			stack[SP[s]--] = last & 0xff;
+			PC[s] = absolute;
+		}
+		break;
+	}
+
+	case 0x60: //RTS
+		for(uint32_t s = begin; s < end; ++s) {
+			uint8_t* stack = ram[s] + 0x100;
+			uint8_t low = stack[++SP[s]];
+			PC[s] = word(low, stack[++SP[s]]) + 1;
+		}
+		break;
+
+	case 0x40: //RTI
+		for(uint32_t s = begin; s < end; ++s) {
+			uint8_t* stack = ram[s] + 0x100;
+			P[s] = (stack[++SP[s]] & 0xef) | 0x20;
+			uint8_t low = stack[++SP[s]];
+			PC[s] = word(low, stack[++SP[s]]);
+		}
+		effects |= EFFECT_INTERRUPT;
+		break;
+
+	default: { //Branches, the flag by the top two bits, taken when it equals bit 5
+		static const uint8_t flags[4] = { 0x80, 0x40, 0x01, 0x02 };
+		uint8_t flag = flags[op.opcode >> 6];
+		uint8_t wanted = (op.opcode & 0x20) ? flag : 0;
+		uint16_t target = next + (int8_t) operand;
+		uint8_t takenCycles = 1 + isPageCrossed(next, target);
+
+		for(uint32_t s = begin; s < end; ++s) {
+			bool taken = (P[s] & flag) == wanted;
+			PC[s] = taken ? target : next;
+			cycles[s] += taken ? takenCycles : 0;
+		}
+		break;
+	}
+	}
+}
+
+uint8_t NES_LOCKSTEP::testButtons(uint32_t lane, uint32_t frame) {
+	uint32_t x = (lane + 1) * 2654435761u ^ (frame / 8 + 1) * 40503u;
+	x ^= x >> 15;
+	x *= 2246822519u;
+	x ^= x >> 13;
+	return x & 0xff;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool NES_LOCKSTEP::selfCheck(const NES_ROM& rom, uint32_t count, uint32_t frames, FILE* out) {
+	NES_LOCKSTEP lockstep;
+	if(!lockstep.init(rom, count)) return false;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(uint32_t frame = 0; frame < frames; ++frame) {
+		for(uint32_t i = 0; i < count; ++i) lockstep.setButtons(i, 0, testButtons(i, frame));
+		lockstep.runFrame();
+	}
+	double lockstepSeconds = secondsSince(start);
+
+	//The same inputs one console after another, as N independent runs would
+	NES* single = new NES[count];
+	bool ok = true;
+	for(uint32_t i = 0; i < count && ok; ++i) ok = single[i].init(rom);
+	if(!ok) {
+		delete[] single;
+		return false;
+	}
+
+	start = std::chrono::steady_clock::now();
+	for(uint32_t i = 0; i < count; ++i) {
+		for(uint32_t frame = 0; frame < frames; ++frame) {
+			single[i].setButtons(0, testButtons(i, frame));
+			if(single[i].runFrame().reason == STOP_FAULT) break;
+		}
+	}
+	double singleSeconds = secondsSince(start);
+
+	uint64_t totalCycles = 0;
+	uint32_t mismatches = 0;
+	for(uint32_t i = 0; i < count; ++i) {
+		NES& mine = lockstep.lanes[i];
+		NES& theirs = single[i];
+		totalCycles += theirs.cpu.cycles;
+
+		bool same = mine.cpu.cycles == theirs.cpu.cycles && mine.frame == theirs.frame && mine.ramHash() == theirs.ramHash();
+		if(same) continue;
+		mismatches++;
+		fprintf(out, "lane %4u  frame %6u/%6u  cycle %12llu/%12llu  ram %08x/%08x  MISMATCH\n", i, mine.frame, theirs.frame,
+				(unsigned long long) mine.cpu.cycles, (unsigned long long) theirs.cpu.cycles, mine.ramHash(), theirs.ramHash());
+	}
+	delete[] single;
+
+	uint64_t steps = lockstep.groupSteps + lockstep.scalarSteps;
+	fprintf(out, "%u lanes, %u frames, %u mismatches\n", count, frames, mismatches);
+	fprintf(out, "lock-step    %8.3f s  %10.2f MHz\n", lockstepSeconds, totalCycles / lockstepSeconds / 1e6);
+	fprintf(out, "independent  %8.3f s  %10.2f MHz\n", singleSeconds, totalCycles / singleSeconds / 1e6);
+	fprintf(out, "speedup      %8.2fx\n", singleSeconds / lockstepSeconds);
+	fprintf(out, "group instructions %llu (%.1f%% through runOp), lanes run alone %llu times\n", (unsigned long long) steps,
+			steps != 0 ? 100.0 * lockstep.scalarSteps / steps : 0.0, (unsigned long long) lockstep.aloneRuns);
+	return mismatches == 0;
+}
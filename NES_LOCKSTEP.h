@@ -0,0 +1,104 @@
+#ifndef NES_LOCKSTEP_H_
+#define NES_LOCKSTEP_H_
+
+#include <stdio.h>
+
+#include "NES.h"
+
+#define LOCKSTEP_MIN_GROUP 4 //fewer lanes left run on their own block caches, a shared step would cost more than it saves
+
+/*
+ * Many consoles running the same cartridge in lock-step, e.g. one ROM under many input streams
+ * The CPU registers of all lanes live in structure-of-arrays form, in slots sorted by PC and ROM bank, so every
+ * group of lanes at the same instruction is a contiguous run. A step runs a whole pre-decoded block for the
+ * group: register and immediate instructions with SSE2/AVX2 kernels where the compiler targets them, memory,
+ * stack and control flow per lane straight on the SoA registers and the lane's RAM. Only opcodes without a
+ * kernel go through NES_CPU::runOp.
+ * The group with the lowest PC always steps next and stops at the next group's PC, so lanes that split at a
+ * branch meet again where the paths join. Only the group that just stepped is re-sorted. Once fewer than
+ * LOCKSTEP_MIN_GROUP lanes are left before their next device event, each runs through NES_CPU::runUntil.
+ */
+class NES_LOCKSTEP {
+public:
+	NES* lanes;
+	uint32_t count;
+
+	//Register file by slot, every array has LANE_WIDTH spare entries for the vector kernels' tails
+	uint32_t* lane; //the NES a slot holds
+	uint16_t* PC;
+	uint8_t* A;
+	uint8_t* X;
+	uint8_t* Y;
+	uint8_t* P;
+	uint8_t* SP;
+	uint64_t* cycles;
+	uint64_t* limit; //cycle at which the lane's devices need to catch up
+	uint8_t** ram; //the lane's internal RAM
+
+	//By lane
+	uint8_t* stopped; //finished its frame or faulted
+	uint8_t* faulted;
+
+	uint64_t groupSteps; //lane instructions run by the group kernels
+	uint64_t scalarSteps; //lane instructions run by runOp inside a group
+	uint64_t aloneRuns; //runs of a single lane up to its next device event
+
+	NES_LOCKSTEP();
+	~NES_LOCKSTEP();
+
+	bool init(const char* romPath, uint32_t count);
+	bool init(const NES_ROM& rom, uint32_t count); //every lane shares rom's cached image
+	void setButtons(uint32_t lane, uint8_t port, uint8_t pressed);
+
+	uint32_t runFrame(); //runs every lane to the end of its next frame, returns the number of lanes that faulted
+
+	static uint8_t testButtons(uint32_t lane, uint32_t frame); //a different input stream per lane, changing every 8 frames
+
+	//Runs count lanes for frames, in lock-step and one console after another, and compares cycles, frames and RAM
+	static bool selfCheck(const NES_ROM& rom, uint32_t count, uint32_t frames, FILE* out);
+
+private:
+	//By slot, sorted along
+	const uint8_t** code; //what the lane's PC page maps, see codeOf
+	uint8_t* dirty; //an interrupt may have become due, checked before the lane's next step
+	uint32_t dirtyLanes;
+
+	uint32_t* order; //scratch for sorting
+	uint64_t* scratch;
+	uint16_t* addresses; //scratch for the memory kernels, by slot
+	uint8_t* penalties;
+
+	void load(uint32_t slot);
+	void store(uint32_t slot);
+	void swapSlots(uint32_t a, uint32_t b);
+	const uint8_t* codeOf(uint32_t slot);
+	inline bool isBefore(uint32_t a, uint32_t b);
+	void sortSlots(uint32_t begin, uint32_t end);
+	bool mergeSlots(uint32_t begin, uint32_t middle, uint32_t end); //false if nothing moved
+	void permuteSlots(uint32_t begin, uint32_t end);
+	uint32_t regroup();
+
+	void runLanes(uint32_t begin, uint32_t end);
+	void runAlone(uint32_t slot);
+	void sync(uint32_t slot);
+	uint8_t step(uint32_t begin, uint32_t end, uint16_t stopAt);
+	void runInterrupts(uint32_t begin, uint32_t end);
+	void runScalar(uint32_t begin, uint32_t end);
+
+	void runRegisterOp(uint8_t opcode, uint8_t operand, uint32_t begin, uint32_t end);
+	void runMemoryOp(const NES_DECODED_OP& op, uint8_t operand, uint16_t absolute, uint32_t begin, uint32_t end, uint64_t pending, uint8_t& effects);
+	void runStackOp(uint8_t opcode, uint32_t begin, uint32_t end);
+	void runControlOp(const NES_DECODED_OP& op, uint8_t operand, uint16_t absolute, uint32_t begin, uint32_t end, uint64_t pending, uint8_t& effects);
+
+	inline uint8_t readLane(uint32_t slot, uint16_t address, uint8_t opcode, uint64_t pending, uint8_t& effects);
+	inline void writeLane(uint32_t slot, uint16_t address, uint8_t value, uint8_t opcode, uint64_t pending, uint8_t& effects);
+
+	void freeArrays();
+
+	NES_LOCKSTEP(const NES_LOCKSTEP&);
+	NES_LOCKSTEP& operator=(const NES_LOCKSTEP&);
+};
+
+
+
+#endif /* NES_LOCKSTEP_H_ */
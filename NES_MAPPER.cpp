@@ -0,0 +1,438 @@
+#include "header.h"
+
+#include <new>
+
+#include "NES_MAPPER.h"
+#include "NES_ARENA.h"
+#include "NES_CPU.h"
+#include "NES_PPU.h"
+#include "NES_STATE.h"
+#include "helper.h"
+
+template<class MAPPER> static NES_MAPPER* construct(NES_ROM* rom, NES_ARENA& arena) {
+	static_assert(sizeof(MAPPER) <= MAPPER_OBJECT_SIZE, "MAPPER_OBJECT_SIZE is too small for a mapper");
+	void* at = arena.allocate(sizeof(MAPPER));
+	return at != NULL ? new(at) MAPPER(rom) : NULL;
+}
+
+NES_MAPPER* NES_MAPPER::create(NES_ROM* rom, NES_ARENA& arena) {
+	NES_MAPPER* mapper;
+
+	switch(rom->mapper) {
+
+	case 0:
+		mapper = construct<NES_NROM>(rom, arena);
+		break;
+
+	case 1:
+		mapper = construct<NES_MMC1>(rom, arena);
+		break;
+
+	case 2:
+		mapper = construct<NES_UXROM>(rom, arena);
+		break;
+
+	case 3:
+		mapper = construct<NES_CNROM>(rom, arena);
+		break;
+
+	case 4:
+		mapper = construct<NES_MMC3>(rom, arena);
+		break;
+
+	default:
+		printf("ERROR: Mapper %i is not supported\n", rom->mapper);
+		return NULL;
+	}
+
+	if(mapper == NULL) return NULL; //arena sized by arenaSize, so never for a well formed header
+
+	if(mapper->prgRamSize) mapper->prgRam = (uint8_t*) arena.allocate(mapper->prgRamSize);
+	if(rom->chr_rom == NULL) mapper->chrRam = (uint8_t*) arena.allocate(KB8);
+
+	if((mapper->prgRamSize && mapper->prgRam == NULL) || (rom->chr_rom == NULL && mapper->chrRam == NULL)) {
+		mapper->~NES_MAPPER();
+		return NULL;
+	}
+	return mapper;
+}
+
+size_t NES_MAPPER::arenaSize(NES_ROM* rom) { //all three are whole cache lines already
+	return MAPPER_OBJECT_SIZE + (size_t) rom->ramBanks * KB8 + (rom->chr_rom == NULL ? KB8 : 0);
+}
+
+NES_MAPPER::NES_MAPPER(NES_ROM* _rom) {
+	rom = _rom;
+	cpu = NULL;
+	bus = NULL;
+	ppu = NULL;
+
+	prgRamSize = rom->ramBanks * KB8;
+	prgRam = NULL; //both from the arena, see create
+	chrRam = NULL;
+
+	for(int i = 0; i < CHR_PAGES; ++i) {
+		chrMap[i] = NULL;
+		chrWriteMap[i] = NULL;
+	}
+
+	mirroring = rom->mirrortype;
+	irq = false;
+	countsScanlines = false;
+}
+
+NES_MAPPER::~NES_MAPPER() {} //the arena owns the memory
+
+void NES_MAPPER::attach(NES_CPU* _cpu) {
+	cpu = _cpu;
+	cpu->mapper = this;
+	bus = cpu->bus;
+
+	bus->mapIO(0x6000, 0xffff, NES_BUS::openBusRead, registerWrite, this);
+	mapPrgRam(true, true);
+	reset();
+}
+
+static uint32_t bankOffset(int bank, uint32_t bankSize, uint32_t totalSize) { //Bank numbers wrap around the available banks
+	int count = totalSize / bankSize;
+	if(count == 0) return 0;
+
+	bank %= count;
+	if(bank < 0) bank += count;
+
+	return bank * bankSize;
+}
+
+void NES_MAPPER::mapPrg8k(uint8_t slot, int bank) {
+	uint32_t offset = bankOffset(bank, KB8, rom->prg_size);
+	uint8_t firstPage = (0x8000 + slot * KB8) >> CPU_PAGE_SHIFT;
+
+	for(int i = 0; i < KB8 / CPU_PAGE_SIZE; ++i) {
+		bus->readMap[firstPage + i] = &rom->prg_rom[offset + i * CPU_PAGE_SIZE];
+		bus->writeMap[firstPage + i] = NULL; //writes go to the mapper registers
+	}
+}
+
+void NES_MAPPER::mapPrg16k(uint8_t slot, int bank) {
+	mapPrg8k(slot * 2, bank * 2);
+	mapPrg8k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void NES_MAPPER::mapPrg32k(int bank) {
+	mapPrg16k(0, bank * 2);
+	mapPrg16k(1, bank * 2 + 1);
+}
+
+void NES_MAPPER::mapPrgRam(bool readable, bool writable) { //0x6000-0x7fff, writes to write protected RAM go to writeRegister
+	uint8_t firstPage = 0x6000 >> CPU_PAGE_SHIFT;
+
+	for(int i = 0; i < KB8 / CPU_PAGE_SIZE; ++i) {
+		uint8_t* page = prgRamSize ? &prgRam[(i * CPU_PAGE_SIZE) % prgRamSize] : NULL; //no PRG RAM, the pages stay open bus
+		bus->readMap[firstPage + i] = readable ? page : NULL;
+		bus->writeMap[firstPage + i] = writable ? page : NULL;
+	}
+}
+
+void NES_MAPPER::mapChr1k(uint8_t slot, int bank) {
+	if(chrRam != NULL) {
+		uint32_t offset = bankOffset(bank, CHR_PAGE_SIZE, KB8);
+		chrMap[slot] = &chrRam[offset];
+		chrWriteMap[slot] = &chrRam[offset];
+	} else {
+		chrMap[slot] = &rom->chr_rom[bankOffset(bank, CHR_PAGE_SIZE, rom->chr_size)];
+		chrWriteMap[slot] = NULL;
+	}
+}
+
+void NES_MAPPER::mapChr2k(uint8_t slot, int bank) {
+	mapChr1k(slot * 2, bank * 2);
+	mapChr1k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void NES_MAPPER::mapChr4k(uint8_t slot, int bank) {
+	mapChr2k(slot * 2, bank * 2);
+	mapChr2k(slot * 2 + 1, bank * 2 + 1);
+}
+
+void NES_MAPPER::mapChr8k(int bank) {
+	mapChr4k(0, bank * 2);
+	mapChr4k(1, bank * 2 + 1);
+}
+
+void NES_MAPPER::setIrq(bool value) {
+	irq = value;
+	if(value) cpu->irqLines |= IRQ_MAPPER;
+	else cpu->irqLines &= ~IRQ_MAPPER;
+}
+
+void NES_MAPPER::serialize(NES_STATE& state) {
+	if(prgRam != NULL) state.bytes(prgRam, prgRamSize);
+	if(chrRam != NULL) state.bytes(chrRam, KB8);
+	state.value(mirroring);
+	state.value(irq);
+}
+
+void NES_MAPPER::registerWrite(void* device, uint16_t address, uint8_t value) {
+	NES_MAPPER* mapper = (NES_MAPPER*) device;
+	if(mapper->ppu != NULL) {
+		mapper->ppu->catchUp(mapper->cpu->currentCycle());
+		mapper->ppu->restartSegment(false); //the rest of the line fetches its tiles from the new CHR banks
+	}
+	mapper->writeRegister(address, value);
+}
+
+
+void NES_NROM::reset() {
+	mapPrg16k(0, 0);
+	mapPrg16k(1, -1); //16KB carts are mirrored into 0xc000
+	mapChr8k(0);
+}
+
+void NES_NROM::writeRegister(uint16_t, uint8_t) {} //no registers
+
+
+void NES_MMC1::reset() {
+	shift = 0;
+	shiftCount = 0;
+	control = 0x0c; //last bank fixed at 0xc000
+	chrBank0 = 0;
+	chrBank1 = 0;
+	prgBank = 0;
+	updateBanks();
+}
+
+void NES_MMC1::writeRegister(uint16_t address, uint8_t value) {
+	/*
+	 * Registers are loaded serially, one bit per write, starting with bit 0
+	 * The fifth write selects the register through bits 13 and 14 of its address
+	 * Writing a value with bit 7 set resets the shift register
+	 */
+	if(address < 0x8000) return;
+
+	if(isBitSet(value, 7)) {
+		shift = 0;
+		shiftCount = 0;
+		control |= 0x0c;
+		updateBanks();
+		return;
+	}
+
+	shift |= (value & 1) << shiftCount;
+	if(++shiftCount < 5) return;
+
+	switch((address >> 13) & 3) {
+
+	case 0:
+		control = shift;
+		break;
+
+	case 1:
+		chrBank0 = shift;
+		break;
+
+	case 2:
+		chrBank1 = shift;
+		break;
+
+	case 3:
+		prgBank = shift;
+		break;
+	}
+
+	shift = 0;
+	shiftCount = 0;
+	updateBanks();
+}
+
+void NES_MMC1::serialize(NES_STATE& state) {
+	NES_MAPPER::serialize(state);
+	state.value(shift);
+	state.value(shiftCount);
+	state.value(control);
+	state.value(chrBank0);
+	state.value(chrBank1);
+	state.value(prgBank);
+	if(state.loading) updateBanks();
+}
+
+void NES_MMC1::updateBanks() {
+	static const uint8_t mirrorModes[4] = { MIRROR_SINGLE_LOWER, MIRROR_SINGLE_UPPER, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+	mirroring = mirrorModes[control & 3];
+
+	switch((control >> 2) & 3) {
+
+	case 0:
+	case 1: //32KB mode, low bit of the bank number is ignored
+		mapPrg32k((prgBank & 0x0f) >> 1);
+		break;
+
+	case 2: //first bank fixed at 0x8000
+		mapPrg16k(0, 0);
+		mapPrg16k(1, prgBank & 0x0f);
+		break;
+
+	case 3: //last bank fixed at 0xc000
+		mapPrg16k(0, prgBank & 0x0f);
+		mapPrg16k(1, -1);
+		break;
+	}
+
+	if(isBitSet(control, 4)) {
+		mapChr4k(0, chrBank0);
+		mapChr4k(1, chrBank1);
+	} else mapChr8k(chrBank0 >> 1);
+
+	mapPrgRam(!isBitSet(prgBank, 4), !isBitSet(prgBank, 4));
+}
+
+
+void NES_UXROM::reset() {
+	prgBank = 0;
+	mapPrg16k(0, 0);
+	mapPrg16k(1, -1);
+	mapChr8k(0);
+}
+
+void NES_UXROM::writeRegister(uint16_t address, uint8_t value) {
+	if(address < 0x8000) return;
+
+	prgBank = value;
+	mapPrg16k(0, prgBank);
+}
+
+void NES_UXROM::serialize(NES_STATE& state) {
+	NES_MAPPER::serialize(state);
+	state.value(prgBank);
+	if(state.loading) mapPrg16k(0, prgBank);
+}
+
+
+void NES_CNROM::reset() {
+	chrBank = 0;
+	mapPrg16k(0, 0);
+	mapPrg16k(1, -1);
+	mapChr8k(0);
+}
+
+void NES_CNROM::writeRegister(uint16_t address, uint8_t value) {
+	if(address < 0x8000) return;
+
+	chrBank = value;
+	mapChr8k(chrBank);
+}
+
+void NES_CNROM::serialize(NES_STATE& state) {
+	NES_MAPPER::serialize(state);
+	state.value(chrBank);
+	if(state.loading) mapChr8k(chrBank);
+}
+
+
+void NES_MMC3::reset() {
+	static const uint8_t powerOnBanks[8] = { 0, 2, 4, 5, 6, 7, 0, 1 };
+
+	bankSelect = 0;
+	for(int i = 0; i < 8; ++i) banks[i] = powerOnBanks[i];
+	prgRamProtect = 0x80;
+	irqLatch = 0;
+	irqCounter = 0;
+	irqReload = false;
+	irqEnabled = false;
+	updateBanks();
+}
+
+void NES_MMC3::writeRegister(uint16_t address, uint8_t value) {
+	/*
+	 * Registers are selected by the address range and whether the address is even or odd
+	 * 0x8000 bank select, 0x8001 bank data
+	 * 0xa000 mirroring, 0xa001 PRG RAM protect
+	 * 0xc000 IRQ latch, 0xc001 IRQ reload
+	 * 0xe000 IRQ disable, 0xe001 IRQ enable
+	 */
+	switch(address & 0xe001) {
+
+	case 0x8000:
+		bankSelect = value;
+		updateBanks();
+		break;
+
+	case 0x8001:
+		banks[bankSelect & 7] = value;
+		updateBanks();
+		break;
+
+	case 0xa000:
+		if(mirroring != MIRROR_FOURSCREEN) mirroring = isBitSet(value, 0) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL;
+		break;
+
+	case 0xa001:
+		prgRamProtect = value;
+		mapPrgRam(isBitSet(value, 7), isBitSet(value, 7) && !isBitSet(value, 6));
+		break;
+
+	case 0xc000:
+		irqLatch = value;
+		break;
+
+	case 0xc001:
+		irqCounter = 0;
+		irqReload = true;
+		break;
+
+	case 0xe000:
+		irqEnabled = false;
+		setIrq(false);
+		break;
+
+	case 0xe001:
+		irqEnabled = true;
+		break;
+	}
+}
+
+void NES_MMC3::scanline() {
+	if(irqCounter == 0 || irqReload) {
+		irqCounter = irqLatch;
+		irqReload = false;
+	} else irqCounter--;
+
+	if(irqCounter == 0 && irqEnabled) setIrq(true);
+}
+
+void NES_MMC3::serialize(NES_STATE& state) {
+	NES_MAPPER::serialize(state);
+	state.value(bankSelect);
+	state.bytes(banks, 8);
+	state.value(prgRamProtect);
+	state.value(irqLatch);
+	state.value(irqCounter);
+	state.value(irqReload);
+	state.value(irqEnabled);
+
+	if(state.loading) {
+		updateBanks();
+		mapPrgRam(isBitSet(prgRamProtect, 7), isBitSet(prgRamProtect, 7) && !isBitSet(prgRamProtect, 6));
+	}
+}
+
+void NES_MMC3::updateBanks() {
+	if(isBitSet(bankSelect, 6)) { //second to last bank fixed at 0x8000
+		mapPrg8k(0, -2);
+		mapPrg8k(2, banks[6]);
+	} else {
+		mapPrg8k(0, banks[6]);
+		mapPrg8k(2, -2);
+	}
+	mapPrg8k(1, banks[7]);
+	mapPrg8k(3, -1);
+
+	uint8_t inversion = isBitSet(bankSelect, 7) ? 4 : 0; //swaps the 2KB and 1KB halves of the pattern tables
+	mapChr1k(0 ^ inversion, banks[0] & 0xfe);
+	mapChr1k(1 ^ inversion, banks[0] | 1);
+	mapChr1k(2 ^ inversion, banks[1] & 0xfe);
+	mapChr1k(3 ^ inversion, banks[1] | 1);
+	mapChr1k(4 ^ inversion, banks[2]);
+	mapChr1k(5 ^ inversion, banks[3]);
+	mapChr1k(6 ^ inversion, banks[4]);
+	mapChr1k(7 ^ inversion, banks[5]);
+}
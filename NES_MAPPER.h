@@ -0,0 +1,138 @@
+#ifndef NES_MAPPER_H_
+#define NES_MAPPER_H_
+
+#include "NES_ROM.h"
+
+class NES_CPU;
+class NES_PPU;
+class NES_BUS;
+class NES_STATE;
+class NES_ARENA;
+
+#define MIRROR_HORIZONTAL 0
+#define MIRROR_VERTICAL 1
+#define MIRROR_FOURSCREEN 2
+#define MIRROR_SINGLE_LOWER 3
+#define MIRROR_SINGLE_UPPER 4
+
+#define CHR_PAGE_SIZE 0x400
+#define CHR_PAGES 8
+
+#define MAPPER_OBJECT_SIZE 512 //arena space for the mapper object itself, enough for every mapper class
+
+/*
+ * Cartridge hardware. A mapper never copies banks around, it only repoints
+ * the CPU page table (PRG, 2KB pages) and its own CHR page table (1KB pages),
+ * so every bank switch is O(1).
+ */
+class NES_MAPPER {
+public:
+	NES_ROM* rom;
+	NES_CPU* cpu;
+	NES_BUS* bus;
+	NES_PPU* ppu; //set by NES_PPU::init, caught up before every register write
+
+	uint8_t* prgRam;
+	uint32_t prgRamSize;
+	uint8_t* chrRam; //only allocated if the cartridge has no CHR ROM
+
+	const uint8_t* chrMap[CHR_PAGES]; //PPU 0x0000-0x1fff
+	uint8_t* chrWriteMap[CHR_PAGES]; //NULL for CHR ROM
+	uint8_t mirroring;
+
+	bool irq; //the mapper is asserting IRQ
+	bool countsScanlines; //scanline() does something, the PPU has to stop at every rendered scanline for it
+
+	//The mapper, its PRG RAM and CHR RAM are placed in arena, so it is destroyed with ~NES_MAPPER, never deleted
+	static NES_MAPPER* create(NES_ROM* rom, NES_ARENA& arena);
+	static size_t arenaSize(NES_ROM* rom); //what create takes from the arena
+
+	NES_MAPPER(NES_ROM* rom);
+	virtual ~NES_MAPPER();
+
+	void attach(NES_CPU* cpu); //claims 0x6000-0xffff on the CPU bus and installs the power-on banks
+
+	virtual void reset() = 0;
+	virtual void writeRegister(uint16_t address, uint8_t value) = 0; //writes to 0x6000-0xffff that did not hit writable PRG RAM
+	virtual void scanline() {} //called by the PPU once per rendered scanline
+	virtual void serialize(NES_STATE& state); //subclasses add their registers and remap their banks when loading
+
+	void mapPrg8k(uint8_t slot, int bank); //slot 0-3 is 0x8000, 0xa000, 0xc000, 0xe000, negative banks count from the end
+	void mapPrg16k(uint8_t slot, int bank); //slot 0-1 is 0x8000, 0xc000
+	void mapPrg32k(int bank);
+	void mapPrgRam(bool readable, bool writable); //disabled PRG RAM reads as open bus
+
+	void mapChr1k(uint8_t slot, int bank);
+	void mapChr2k(uint8_t slot, int bank);
+	void mapChr4k(uint8_t slot, int bank);
+	void mapChr8k(int bank);
+
+	void setIrq(bool value);
+
+	static void registerWrite(void* mapper, uint16_t address, uint8_t value); //catches the PPU up first, banks and mirroring change from the write on
+};
+
+class NES_NROM : public NES_MAPPER { //Mapper 0
+public:
+	NES_NROM(NES_ROM* rom) : NES_MAPPER(rom) {}
+	void reset();
+	void writeRegister(uint16_t address, uint8_t value);
+};
+
+class NES_MMC1 : public NES_MAPPER { //Mapper 1
+public:
+	uint8_t shift;
+	uint8_t shiftCount;
+	uint8_t control;
+	uint8_t chrBank0;
+	uint8_t chrBank1;
+	uint8_t prgBank;
+
+	NES_MMC1(NES_ROM* rom) : NES_MAPPER(rom) {}
+	void reset();
+	void writeRegister(uint16_t address, uint8_t value);
+	void serialize(NES_STATE& state);
+	void updateBanks();
+};
+
+class NES_UXROM : public NES_MAPPER { //Mapper 2
+public:
+	uint8_t prgBank;
+
+	NES_UXROM(NES_ROM* rom) : NES_MAPPER(rom) {}
+	void reset();
+	void writeRegister(uint16_t address, uint8_t value);
+	void serialize(NES_STATE& state);
+};
+
+class NES_CNROM : public NES_MAPPER { //Mapper 3
+public:
+	uint8_t chrBank;
+
+	NES_CNROM(NES_ROM* rom) : NES_MAPPER(rom) {}
+	void reset();
+	void writeRegister(uint16_t address, uint8_t value);
+	void serialize(NES_STATE& state);
+};
+
+class NES_MMC3 : public NES_MAPPER { //Mapper 4
+public:
+	uint8_t bankSelect;
+	uint8_t banks[8]; //R0-R7
+	uint8_t prgRamProtect;
+	uint8_t irqLatch;
+	uint8_t irqCounter;
+	bool irqReload;
+	bool irqEnabled;
+
+	NES_MMC3(NES_ROM* rom) : NES_MAPPER(rom) { countsScanlines = true; }
+	void reset();
+	void writeRegister(uint16_t address, uint8_t value);
+	void serialize(NES_STATE& state);
+	void scanline();
+	void updateBanks();
+};
+
+
+
+#endif /* NES_MAPPER_H_ */
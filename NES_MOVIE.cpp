@@ -0,0 +1,316 @@
+#include "header.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "NES.h"
+#include "NES_MOVIE.h"
+
+#define FM2_PORT_GAMEPAD 1
+#define FM2_COMMAND_RESET 0x01
+#define FM2_COMMAND_POWER 0x02
+
+#define MOVIE_MAX_FRAMES 0x1000000 //a script frame number beyond this is a typo, not 77 hours of input
+
+static uint8_t parseFM2Buttons(const char* field) { //"RLDUTSBA", '.' or ' ' for released
+	static const uint8_t bits[8] = {
+		BUTTON_RIGHT, BUTTON_LEFT, BUTTON_DOWN, BUTTON_UP, BUTTON_START, BUTTON_SELECT, BUTTON_B, BUTTON_A
+	};
+
+	uint8_t pressed = 0;
+	for(int i = 0; i < 8 && field[i] != '|' && field[i] != '\0' && field[i] != '\n' && field[i] != '\r'; ++i) {
+		if(field[i] != '.' && field[i] != ' ') pressed |= bits[i];
+	}
+	return pressed;
+}
+
+
+static bool isFieldEnd(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\0'; }
+
+static bool parseField(char*& cursor, int base, unsigned long max, unsigned long& value) {
+	//One whitespace separated number, false if it is missing, has anything but digits in it or is above max
+	while(*cursor == ' ' || *cursor == '\t') cursor++;
+	if(*cursor == '-' || *cursor == '+') return false; //strtoul would wrap a sign around
+
+	char* end;
+	value = strtoul(cursor, &end, base);
+	if(end == cursor || !isFieldEnd(*end) || value > max) return false;
+
+	cursor = end;
+	return true;
+}
+
+static bool isLineEnd(const char* cursor) {
+	while(*cursor == ' ' || *cursor == '\t') cursor++;
+	return *cursor == '\n' || *cursor == '\r' || *cursor == '\0';
+}
+
+
+NES_MOVIE::NES_MOVIE() {
+	romHash = 0;
+}
+
+bool NES_MOVIE::load(const char* path) {
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("ERROR: Movie %s could not be opened\n", path);
+		return false;
+	}
+
+	frames.clear();
+	romHash = 0;
+
+	bool header = false;
+	char line[256];
+	int lineNumber = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		char* cursor = line;
+		while(*cursor == ' ' || *cursor == '\t') cursor++;
+		if(*cursor == '#' || *cursor == '\n' || *cursor == '\r' || *cursor == '\0') continue;
+
+		if(!header) {
+			if(strncmp(cursor, "nesmovie 1", 10) != 0) {
+				printf("ERROR: %s is not a version 1 movie\n", path);
+				fclose(file);
+				return false;
+			}
+			header = true;
+			continue;
+		}
+
+		if(strncmp(cursor, "rom ", 4) == 0) {
+			char* end;
+			romHash = strtoull(cursor + 4, &end, 16);
+			if(end == cursor + 4 || !isLineEnd(end)) {
+				printf("ERROR: %s:%i has an invalid ROM hash\n", path, lineNumber);
+				fclose(file);
+				return false;
+			}
+			continue;
+		}
+
+		unsigned long buttons[2];
+		if(!parseField(cursor, 16, 0xff, buttons[0]) || !parseField(cursor, 16, 0xff, buttons[1]) || !isLineEnd(cursor)) {
+			printf("ERROR: %s:%i is not two hex button masks\n", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+
+		NES_MOVIE_FRAME frame;
+		frame.buttons[0] = buttons[0];
+		frame.buttons[1] = buttons[1];
+		frames.push_back(frame);
+	}
+
+	fclose(file);
+	if(!header) {
+		printf("ERROR: Movie %s is empty\n", path);
+		return false;
+	}
+	return true;
+}
+
+bool NES_MOVIE::save(const char* path) {
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		printf("ERROR: Movie %s could not be opened\n", path);
+		return false;
+	}
+
+	fprintf(file, "nesmovie 1\n");
+	if(romHash != 0) fprintf(file, "rom %016llx\n", (unsigned long long) romHash);
+	for(size_t i = 0; i < frames.size(); ++i) fprintf(file, "%02x %02x\n", frames[i].buttons[0], frames[i].buttons[1]);
+
+	fclose(file);
+	return true;
+}
+
+bool NES_MOVIE::importFM2(const char* path) {
+	/*
+	 * Header lines are "<key> <value>", input lines are |<commands>|<port 0>|<port 1>|<port 2>|, one per frame
+	 * The ROM checksum is an MD5 and cannot be checked against NES_ROM::hash, so romHash stays 0
+	 */
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("ERROR: Movie %s could not be opened\n", path);
+		return false;
+	}
+
+	frames.clear();
+	romHash = 0;
+
+	int ports[2] = { FM2_PORT_GAMEPAD, FM2_PORT_GAMEPAD };
+	uint32_t resets = 0;
+	char line[1024];
+	while(fgets(line, sizeof(line), file) != NULL) {
+		if(line[0] != '|') {
+			int value = 0;
+			if(sscanf(line, "binary %d", &value) == 1 && value != 0) {
+				printf("ERROR: Movie %s has binary input, which is not supported\n", path);
+				fclose(file);
+				return false;
+			}
+			if(sscanf(line, "fourscore %d", &value) == 1 && value != 0) {
+				printf("ERROR: Movie %s uses a Four Score, which is not supported\n", path);
+				fclose(file);
+				return false;
+			}
+			if(sscanf(line, "port0 %d", &value) == 1) ports[0] = value;
+			if(sscanf(line, "port1 %d", &value) == 1) ports[1] = value;
+			continue;
+		}
+
+		char* cursor = line + 1;
+		uint32_t commands = strtoul(cursor, &cursor, 10);
+		if((commands & (FM2_COMMAND_RESET | FM2_COMMAND_POWER)) && !frames.empty()) resets++; //power on at frame 0 is where replay starts anyway
+
+		NES_MOVIE_FRAME frame;
+		for(int port = 0; port < 2; ++port) {
+			cursor = strchr(cursor, '|');
+			frame.buttons[port] = 0;
+			if(cursor == NULL) continue;
+
+			cursor++;
+			if(ports[port] == FM2_PORT_GAMEPAD) frame.buttons[port] = parseFM2Buttons(cursor);
+		}
+		frames.push_back(frame);
+	}
+
+	fclose(file);
+	if(ports[0] != FM2_PORT_GAMEPAD || ports[1] != FM2_PORT_GAMEPAD) printf("WARNING: Movie %s has devices other than gamepads, their input is dropped\n", path);
+	if(resets != 0) printf("WARNING: Movie %s resets the console %u times, which are not replayed\n", path, resets);
+	return true;
+}
+
+bool NES_MOVIE::importScript(const char* path) {
+	//Every change is held up to the next one, so the frames in between repeat the last state
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("ERROR: Input script %s could not be opened\n", path);
+		return false;
+	}
+
+	frames.clear();
+	romHash = 0;
+
+	NES_MOVIE_FRAME held = { { 0, 0 } };
+	char line[256];
+	int lineNumber = 0;
+	while(fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		char* cursor = line;
+		while(*cursor == ' ' || *cursor == '\t') cursor++;
+		if(*cursor == '#' || *cursor == '\n' || *cursor == '\r' || *cursor == '\0') continue;
+
+		unsigned long frame;
+		unsigned long buttons[2] = { 0, 0 };
+		bool valid = parseField(cursor, 10, MOVIE_MAX_FRAMES - 1, frame) && parseField(cursor, 0, 0xff, buttons[0]);
+		if(valid && !isLineEnd(cursor)) valid = parseField(cursor, 0, 0xff, buttons[1]) && isLineEnd(cursor);
+		if(!valid) {
+			printf("ERROR: %s:%i is not <frame> <buttons port 1> [<buttons port 2>]\n", path, lineNumber);
+			fclose(file);
+			return false;
+		}
+		if(frame < frames.size()) {
+			printf("ERROR: Input script %s goes back to frame %lu\n", path, frame);
+			fclose(file);
+			return false;
+		}
+
+		frames.resize(frame, held);
+		held.buttons[0] = buttons[0];
+		held.buttons[1] = buttons[1];
+		frames.push_back(held);
+	}
+
+	fclose(file);
+	return true;
+}
+
+bool NES_MOVIE::loadAny(const char* path) {
+	size_t length = strlen(path);
+	if(length >= 4 && strcmp(path + length - 4, ".fm2") == 0) return importFM2(path);
+
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("ERROR: Input %s could not be opened\n", path);
+		return false;
+	}
+
+	bool native = false;
+	char line[256];
+	while(fgets(line, sizeof(line), file) != NULL) { //the first line that is not blank or a comment decides
+		char* cursor = line;
+		while(*cursor == ' ' || *cursor == '\t') cursor++;
+		if(*cursor == '#' || *cursor == '\n' || *cursor == '\r' || *cursor == '\0') continue;
+
+		native = strncmp(cursor, "nesmovie", 8) == 0;
+		break;
+	}
+	fclose(file);
+
+	return native ? load(path) : importScript(path);
+}
+
+bool NES_MOVIE::matches(const NES& nes) {
+	if(romHash == 0 || romHash == nes.rom.hash) return true;
+
+	printf("WARNING: Movie was recorded on ROM %016llx, this is %016llx\n", (unsigned long long) romHash, (unsigned long long) nes.rom.hash);
+	return false;
+}
+
+void NES_MOVIE::record(const NES& nes) {
+	NES_MOVIE_FRAME frame;
+	frame.buttons[0] = nes.buttons[0];
+	frame.buttons[1] = nes.buttons[1];
+	frames.push_back(frame);
+	romHash = nes.rom.hash;
+}
+
+NES_MOVIE_FRAME NES_MOVIE::input(uint32_t frame) const {
+	if(frame < frames.size()) return frames[frame];
+
+	NES_MOVIE_FRAME released = { { 0, 0 } };
+	return released;
+}
+
+void NES_MOVIE::applyInput(NES& nes) const {
+	NES_MOVIE_FRAME frame = input(nes.frame);
+	nes.setButtons(0, frame.buttons[0]);
+	nes.setButtons(1, frame.buttons[1]);
+}
+
+NES_RUN_STATUS NES_MOVIE::runFrame(NES& nes) const { return runUntil(nes, UINT64_MAX); }
+
+NES_RUN_STATUS NES_MOVIE::runUntil(NES& nes, uint64_t targetCycle) const {
+	applyInput(nes);
+	return nes.runUntil(targetCycle, true);
+}
+
+NES_RUN_STATUS NES_MOVIE::fastForward(NES& nes, uint32_t targetFrame) const {
+	//Output goes back to how the caller had it, even when the CPU jams on the way
+	void* framebuffer = nes.ppu.framebuffer;
+	uint8_t format = nes.ppu.format;
+	bool muted = nes.apu.muted;
+
+	nes.ppu.setFramebuffer(NULL, format);
+	nes.apu.setMuted(true);
+
+	NES_RUN_STATUS status;
+	status.cycles = 0;
+	status.reason = STOP_FRAME;
+	status.faultOpcode = 0;
+	status.faultPC = 0;
+
+	while(nes.frame < targetFrame) {
+		NES_RUN_STATUS frameStatus = runFrame(nes);
+		frameStatus.cycles += status.cycles;
+		status = frameStatus;
+		if(status.reason == STOP_FAULT) break;
+	}
+
+	nes.ppu.setFramebuffer(framebuffer, format);
+	nes.apu.setMuted(muted);
+	return status;
+}
@@ -0,0 +1,49 @@
+#ifndef NES_MOVIE_H_
+#define NES_MOVIE_H_
+
+#include <vector>
+
+class NES;
+struct NES_RUN_STATUS;
+
+//Controller state held through one frame
+struct NES_MOVIE_FRAME {
+	uint8_t buttons[2]; //BUTTON_ bits for each port
+};
+
+/*
+ * Input movie, one entry per frame from power on, and its replay
+ * Frame n of the movie is held while the NES runs its frame n, past the end both ports are released.
+ * The native format is text: a "nesmovie 1" line, optionally "rom <hash>" with NES_ROM::hash in hex,
+ * then one "<port 1> <port 2>" line of hex BUTTON_ masks per frame. FCEUX's FM2 text movies can be imported,
+ * and so can event scripts: one "<frame> <port 1> [<port 2>]" line per change, the frame in decimal and the
+ * masks in decimal or 0x hex, held up to the next line. Past a script's last line nothing is pressed.
+ * fastForward runs without a framebuffer and with the APU muted, which changes nothing the CPU can see,
+ * so a replay reaches the same state either way.
+ */
+class NES_MOVIE {
+public:
+	std::vector<NES_MOVIE_FRAME> frames;
+	uint64_t romHash; //0 if the movie does not name a ROM
+
+	NES_MOVIE();
+
+	bool load(const char* path);
+	bool save(const char* path);
+	bool importFM2(const char* path); //gamepads on ports 0 and 1 only, resets are not replayed
+	bool importScript(const char* path);
+	bool loadAny(const char* path); //FM2 by its .fm2 extension, native movies by their first line, anything else as a script
+
+	bool matches(const NES& nes); //false, with a warning, if the movie was made on another ROM
+	void record(const NES& nes); //appends the buttons nes holds, call once per frame before running it
+
+	NES_MOVIE_FRAME input(uint32_t frame) const; //nothing pressed past the end
+	void applyInput(NES& nes) const; //sets the buttons for nes.frame
+	NES_RUN_STATUS runFrame(NES& nes) const;
+	NES_RUN_STATUS runUntil(NES& nes, uint64_t targetCycle) const; //runFrame, stopping early at targetCycle
+	NES_RUN_STATUS fastForward(NES& nes, uint32_t targetFrame) const; //frames up to targetFrame without video or audio output
+};
+
+
+
+#endif /* NES_MOVIE_H_ */
@@ -0,0 +1,153 @@
+#include "header.h"
+
+#include <string.h>
+
+#include "NES.h"
+#include "NES_NESTEST.h"
+
+static bool hexField(const char* line, const char* name, unsigned& value) {
+	const char* at = strstr(line, name);
+	return at != NULL && sscanf(at + strlen(name), "%x", &value) == 1;
+}
+
+bool NES_NESTEST::parseLine(const char* line, NES_NESTEST_STATE& state) {
+	/*
+	 * C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+	 * Only the address at the start and the register columns are used, the disassembly is not checked
+	 */
+	unsigned PC, A, X, Y, P, SP;
+	if(sscanf(line, "%4x", &PC) != 1) return false;
+	if(!hexField(line, " A:", A) || !hexField(line, " X:", X) || !hexField(line, " Y:", Y) ||
+			!hexField(line, " P:", P) || !hexField(line, " SP:", SP)) return false;
+
+	state.PC = PC;
+	state.A = A;
+	state.X = X;
+	state.Y = Y;
+	state.P = P;
+	state.SP = SP;
+
+	unsigned long long cycles = 0;
+	const char* at = strstr(line, " CYC:");
+	state.hasCycles = strstr(line, " PPU:") != NULL && at != NULL && sscanf(at + 5, "%llu", &cycles) == 1;
+	state.cycles = cycles;
+	return true;
+}
+
+bool NES_NESTEST::loadLog(const char* path) {
+	FILE* file = fopen(path, "r");
+	if(file == NULL) {
+		printf("ERROR: nestest log %s could not be opened\n", path);
+		return false;
+	}
+
+	expected.clear();
+	lines.clear();
+
+	char line[512];
+	int lineNumber = 0;
+	bool ok = true;
+
+	while(fgets(line, sizeof(line), file) != NULL) {
+		lineNumber++;
+		line[strcspn(line, "\r\n")] = '\0';
+		if(line[0] == '\0') continue;
+
+		NES_NESTEST_STATE state;
+		if(!parseLine(line, state)) {
+			printf("ERROR: %s:%i is not a nestest log line\n", path, lineNumber);
+			ok = false;
+			break;
+		}
+		expected.push_back(state);
+		lines.push_back(line);
+	}
+
+	fclose(file);
+
+	if(ok && expected.empty()) {
+		printf("ERROR: nestest log %s is empty\n", path);
+		ok = false;
+	}
+	return ok;
+}
+
+void NES_NESTEST::printState(FILE* out, const char* label, const NES_NESTEST_STATE& state) {
+	fprintf(out, "  %-9s%04X  A:%02X X:%02X Y:%02X P:%02X SP:%02X", label, state.PC, state.A, state.X, state.Y, state.P, state.SP);
+	if(state.hasCycles) fprintf(out, " CYC:%llu", (unsigned long long) state.cycles);
+	fprintf(out, "\n");
+}
+
+bool NES_NESTEST::run(const char* romPath, FILE* out) {
+	if(expected.empty()) {
+		printf("ERROR: No nestest log loaded\n");
+		return false;
+	}
+
+	NES* nes = new NES();
+	if(!nes->init(romPath)) {
+		delete nes;
+		return false;
+	}
+
+	const NES_NESTEST_STATE& first = expected[0];
+	nes->cpu.PC = first.PC;
+	nes->cpu.A = first.A;
+	nes->cpu.X = first.X;
+	nes->cpu.Y = first.Y;
+	nes->cpu.setP(first.P);
+	nes->cpu.SP = first.SP;
+	if(first.hasCycles) nes->cpu.cycles = first.cycles;
+
+	bool passed = true;
+	size_t index;
+
+	for(index = 0; index < expected.size(); ++index) {
+		const NES_NESTEST_STATE& want = expected[index];
+
+		NES_NESTEST_STATE got;
+		got.PC = nes->cpu.PC;
+		got.A = nes->cpu.A;
+		got.X = nes->cpu.X;
+		got.Y = nes->cpu.Y;
+		got.P = nes->cpu.getP();
+		got.SP = nes->cpu.SP;
+		got.hasCycles = want.hasCycles;
+		got.cycles = nes->cpu.cycles;
+
+		std::string differs;
+		if(got.PC != want.PC) differs += " PC";
+		if(got.A != want.A) differs += " A";
+		if(got.X != want.X) differs += " X";
+		if(got.Y != want.Y) differs += " Y";
+		if(got.P != want.P) differs += " P";
+		if(got.SP != want.SP) differs += " SP";
+		if(want.hasCycles && got.cycles != want.cycles) differs += " CYC";
+
+		if(!differs.empty()) {
+			fprintf(out, "nestest: instruction %zu differs in%s\n", index + 1, differs.c_str());
+			if(index > 0) fprintf(out, "  %-9s%s\n", "after", lines[index - 1].c_str());
+			printState(out, "expected", want);
+			printState(out, "actual", got);
+			passed = false;
+			break;
+		}
+
+		if(index + 1 == expected.size()) break;
+
+		if(nes->runCycles(1).reason == STOP_FAULT) { //one instruction, every instruction takes at least 2 cycles
+			fprintf(out, "nestest: CPU jammed at instruction %zu\n", index + 1);
+			fprintf(out, "  %-9s%s\n", "at", lines[index].c_str());
+			passed = false;
+			break;
+		}
+	}
+
+	if(passed) fprintf(out, "nestest: all %zu instructions match the log\n", expected.size());
+
+	//nestest leaves the number of its first failed official and unofficial test at 0x02 and 0x03
+	fprintf(out, "nestest: result codes %02x %02x\n", nes->bus.ram[0x02], nes->bus.ram[0x03]);
+
+	delete nes;
+	return passed;
+}
@@ -0,0 +1,42 @@
+#ifndef NES_NESTEST_H_
+#define NES_NESTEST_H_
+
+#include <string>
+#include <vector>
+
+//CPU state before one instruction, as a line of a nestest log gives it
+struct NES_NESTEST_STATE {
+	uint16_t PC;
+	uint8_t A;
+	uint8_t X;
+	uint8_t Y;
+	uint8_t P;
+	uint8_t SP;
+	bool hasCycles; //only logs with a PPU: column count CPU cycles after CYC:, older ones count PPU dots
+	uint64_t cycles;
+};
+
+/*
+ * Headless nestest conformance runner
+ * Starts the CPU in the state of the log's first line, which is the automated mode at 0xc000 for nestest.nes,
+ * then steps it one instruction at a time through NES::runCycles, so the devices and whatever dispatch
+ * NES_CPU::runUntil uses are exercised as well. Before every instruction the CPU is compared against the next
+ * line of the golden log, the run stops at the first line that differs.
+ */
+class NES_NESTEST {
+public:
+	std::vector<NES_NESTEST_STATE> expected;
+	std::vector<std::string> lines; //the log as read, for reporting
+
+	bool loadLog(const char* path);
+	static bool parseLine(const char* line, NES_NESTEST_STATE& state);
+
+	bool run(const char* romPath, FILE* out); //true if every line of the log matched
+
+private:
+	static void printState(FILE* out, const char* label, const NES_NESTEST_STATE& state);
+};
+
+
+
+#endif /* NES_NESTEST_H_ */
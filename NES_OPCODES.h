@@ -0,0 +1,300 @@
+#ifndef NES_OPCODES_H_
+#define NES_OPCODES_H_
+
+/*
+ * Addressing modes, resolved once per instruction by NES_CPU::runOp
+ * before the handler is called. Handlers only ever see the effective address.
+ */
+enum NES_ADDRMODE {
+	IMP, //Implied
+	ACC, //Accumulator
+	IMM, //Immediate, effective address is PC+1
+	ZP0, //Zero Page
+	ZPX, //Zero Page,X (wraps within the zero page)
+	ZPY, //Zero Page,Y (wraps within the zero page)
+	ABS, //Absolute
+	ABX, //Absolute,X
+	ABY, //Absolute,Y
+	IND, //Indirect, only used by JMP
+	IZX, //(Indirect,X)
+	IZY, //(Indirect),Y
+	REL  //Relative, only used by branches
+};
+
+#define NES_ADDRMODE_COUNT 13
+
+//Instruction length in bytes for each addressing mode
+#define NES_MODE_BYTES(mode) \
+	((mode) == IMP || (mode) == ACC ? 1 : \
+	 (mode) == ABS || (mode) == ABX || (mode) == ABY || (mode) == IND ? 3 : 2)
+
+/*
+ * The full 6502 opcode matrix, one line per opcode, in opcode order.
+ * X(opcode, handler, addressing mode, base cycles, page penalty, official)
+ *
+ * Page penalty is 1 for reads that take an extra cycle when indexing crosses a page,
+ * stores and read-modify-write instructions always take the long path and are already counted in base cycles.
+ * Taken branches add their penalty in branchIfFlagSet.
+ * Unofficial opcodes are listed with official = 0 so that traces can mark them.
+ */
+#define NES_OPCODES(X) \
+	X(0x00, BRK, IMP, 7, 0, 1) \
+	X(0x01, ORA, IZX, 6, 0, 1) \
+	X(0x02, KIL, IMP, 2, 0, 0) \
+	X(0x03, SLO, IZX, 8, 0, 0) \
+	X(0x04, NOP, ZP0, 3, 0, 0) \
+	X(0x05, ORA, ZP0, 3, 0, 1) \
+	X(0x06, ASL, ZP0, 5, 0, 1) \
+	X(0x07, SLO, ZP0, 5, 0, 0) \
+	X(0x08, PHP, IMP, 3, 0, 1) \
+	X(0x09, ORA, IMM, 2, 0, 1) \
+	X(0x0a, ASL, ACC, 2, 0, 1) \
+	X(0x0b, ANC, IMM, 2, 0, 0) \
+	X(0x0c, NOP, ABS, 4, 0, 0) \
+	X(0x0d, ORA, ABS, 4, 0, 1) \
+	X(0x0e, ASL, ABS, 6, 0, 1) \
+	X(0x0f, SLO, ABS, 6, 0, 0) \
+	X(0x10, BPL, REL, 2, 0, 1) \
+	X(0x11, ORA, IZY, 5, 1, 1) \
+	X(0x12, KIL, IMP, 2, 0, 0) \
+	X(0x13, SLO, IZY, 8, 0, 0) \
+	X(0x14, NOP, ZPX, 4, 0, 0) \
+	X(0x15, ORA, ZPX, 4, 0, 1) \
+	X(0x16, ASL, ZPX, 6, 0, 1) \
+	X(0x17, SLO, ZPX, 6, 0, 0) \
+	X(0x18, CLC, IMP, 2, 0, 1) \
+	X(0x19, ORA, ABY, 4, 1, 1) \
+	X(0x1a, NOP, IMP, 2, 0, 0) \
+	X(0x1b, SLO, ABY, 7, 0, 0) \
+	X(0x1c, NOP, ABX, 4, 1, 0) \
+	X(0x1d, ORA, ABX, 4, 1, 1) \
+	X(0x1e, ASL, ABX, 7, 0, 1) \
+	X(0x1f, SLO, ABX, 7, 0, 0) \
+	X(0x20, JSR, ABS, 6, 0, 1) \
+	X(0x21, AND, IZX, 6, 0, 1) \
+	X(0x22, KIL, IMP, 2, 0, 0) \
+	X(0x23, RLA, IZX, 8, 0, 0) \
+	X(0x24, BIT, ZP0, 3, 0, 1) \
+	X(0x25, AND, ZP0, 3, 0, 1) \
+	X(0x26, ROL, ZP0, 5, 0, 1) \
+	X(0x27, RLA, ZP0, 5, 0, 0) \
+	X(0x28, PLP, IMP, 4, 0, 1) \
+	X(0x29, AND, IMM, 2, 0, 1) \
+	X(0x2a, ROL, ACC, 2, 0, 1) \
+	X(0x2b, ANC, IMM, 2, 0, 0) \
+	X(0x2c, BIT, ABS, 4, 0, 1) \
+	X(0x2d, AND, ABS, 4, 0, 1) \
+	X(0x2e, ROL, ABS, 6, 0, 1) \
+	X(0x2f, RLA, ABS, 6, 0, 0) \
+	X(0x30, BMI, REL, 2, 0, 1) \
+	X(0x31, AND, IZY, 5, 1, 1) \
+	X(0x32, KIL, IMP, 2, 0, 0) \
+	X(0x33, RLA, IZY, 8, 0, 0) \
+	X(0x34, NOP, ZPX, 4, 0, 0) \
+	X(0x35, AND, ZPX, 4, 0, 1) \
+	X(0x36, ROL, ZPX, 6, 0, 1) \
+	X(0x37, RLA, ZPX, 6, 0, 0) \
+	X(0x38, SEC, IMP, 2, 0, 1) \
+	X(0x39, AND, ABY, 4, 1, 1) \
+	X(0x3a, NOP, IMP, 2, 0, 0) \
+	X(0x3b, RLA, ABY, 7, 0, 0) \
+	X(0x3c, NOP, ABX, 4, 1, 0) \
+	X(0x3d, AND, ABX, 4, 1, 1) \
+	X(0x3e, ROL, ABX, 7, 0, 1) \
+	X(0x3f, RLA, ABX, 7, 0, 0) \
+	X(0x40, RTI, IMP, 6, 0, 1) \
+	X(0x41, EOR, IZX, 6, 0, 1) \
+	X(0x42, KIL, IMP, 2, 0, 0) \
+	X(0x43, SRE, IZX, 8, 0, 0) \
+	X(0x44, NOP, ZP0, 3, 0, 0) \
+	X(0x45, EOR, ZP0, 3, 0, 1) \
+	X(0x46, LSR, ZP0, 5, 0, 1) \
+	X(0x47, SRE, ZP0, 5, 0, 0) \
+	X(0x48, PHA, IMP, 3, 0, 1) \
+	X(0x49, EOR, IMM, 2, 0, 1) \
+	X(0x4a, LSR, ACC, 2, 0, 1) \
+	X(0x4b, ALR, IMM, 2, 0, 0) \
+	X(0x4c, JMP, ABS, 3, 0, 1) \
+	X(0x4d, EOR, ABS, 4, 0, 1) \
+	X(0x4e, LSR, ABS, 6, 0, 1) \
+	X(0x4f, SRE, ABS, 6, 0, 0) \
+	X(0x50, BVC, REL, 2, 0, 1) \
+	X(0x51, EOR, IZY, 5, 1, 1) \
+	X(0x52, KIL, IMP, 2, 0, 0) \
+	X(0x53, SRE, IZY, 8, 0, 0) \
+	X(0x54, NOP, ZPX, 4, 0, 0) \
+	X(0x55, EOR, ZPX, 4, 0, 1) \
+	X(0x56, LSR, ZPX, 6, 0, 1) \
+	X(0x57, SRE, ZPX, 6, 0, 0) \
+	X(0x58, CLI, IMP, 2, 0, 1) \
+	X(0x59, EOR, ABY, 4, 1, 1) \
+	X(0x5a, NOP, IMP, 2, 0, 0) \
+	X(0x5b, SRE, ABY, 7, 0, 0) \
+	X(0x5c, NOP, ABX, 4, 1, 0) \
+	X(0x5d, EOR, ABX, 4, 1, 1) \
+	X(0x5e, LSR, ABX, 7, 0, 1) \
+	X(0x5f, SRE, ABX, 7, 0, 0) \
+	X(0x60, RTS, IMP, 6, 0, 1) \
+	X(0x61, ADC, IZX, 6, 0, 1) \
+	X(0x62, KIL, IMP, 2, 0, 0) \
+	X(0x63, RRA, IZX, 8, 0, 0) \
+	X(0x64, NOP, ZP0, 3, 0, 0) \
+	X(0x65, ADC, ZP0, 3, 0, 1) \
+	X(0x66, ROR, ZP0, 5, 0, 1) \
+	X(0x67, RRA, ZP0, 5, 0, 0) \
+	X(0x68, PLA, IMP, 4, 0, 1) \
+	X(0x69, ADC, IMM, 2, 0, 1) \
+	X(0x6a, ROR, ACC, 2, 0, 1) \
+	X(0x6b, ARR, IMM, 2, 0, 0) \
+	X(0x6c, JMP, IND, 5, 0, 1) \
+	X(0x6d, ADC, ABS, 4, 0, 1) \
+	X(0x6e, ROR, ABS, 6, 0, 1) \
+	X(0x6f, RRA, ABS, 6, 0, 0) \
+	X(0x70, BVS, REL, 2, 0, 1) \
+	X(0x71, ADC, IZY, 5, 1, 1) \
+	X(0x72, KIL, IMP, 2, 0, 0) \
+	X(0x73, RRA, IZY, 8, 0, 0) \
+	X(0x74, NOP, ZPX, 4, 0, 0) \
+	X(0x75, ADC, ZPX, 4, 0, 1) \
+	X(0x76, ROR, ZPX, 6, 0, 1) \
+	X(0x77, RRA, ZPX, 6, 0, 0) \
+	X(0x78, SEI, IMP, 2, 0, 1) \
+	X(0x79, ADC, ABY, 4, 1, 1) \
+	X(0x7a, NOP, IMP, 2, 0, 0) \
+	X(0x7b, RRA, ABY, 7, 0, 0) \
+	X(0x7c, NOP, ABX, 4, 1, 0) \
+	X(0x7d, ADC, ABX, 4, 1, 1) \
+	X(0x7e, ROR, ABX, 7, 0, 1) \
+	X(0x7f, RRA, ABX, 7, 0, 0) \
+	X(0x80, NOP, IMM, 2, 0, 0) \
+	X(0x81, STA, IZX, 6, 0, 1) \
+	X(0x82, NOP, IMM, 2, 0, 0) \
+	X(0x83, SAX, IZX, 6, 0, 0) \
+	X(0x84, STY, ZP0, 3, 0, 1) \
+	X(0x85, STA, ZP0, 3, 0, 1) \
+	X(0x86, STX, ZP0, 3, 0, 1) \
+	X(0x87, SAX, ZP0, 3, 0, 0) \
+	X(0x88, DEY, IMP, 2, 0, 1) \
+	X(0x89, NOP, IMM, 2, 0, 0) \
+	X(0x8a, TXA, IMP, 2, 0, 1) \
+	X(0x8b, XAA, IMM, 2, 0, 0) \
+	X(0x8c, STY, ABS, 4, 0, 1) \
+	X(0x8d, STA, ABS, 4, 0, 1) \
+	X(0x8e, STX, ABS, 4, 0, 1) \
+	X(0x8f, SAX, ABS, 4, 0, 0) \
+	X(0x90, BCC, REL, 2, 0, 1) \
+	X(0x91, STA, IZY, 6, 0, 1) \
+	X(0x92, KIL, IMP, 2, 0, 0) \
+	X(0x93, AHX, IZY, 6, 0, 0) \
+	X(0x94, STY, ZPX, 4, 0, 1) \
+	X(0x95, STA, ZPX, 4, 0, 1) \
+	X(0x96, STX, ZPY, 4, 0, 1) \
+	X(0x97, SAX, ZPY, 4, 0, 0) \
+	X(0x98, TYA, IMP, 2, 0, 1) \
+	X(0x99, STA, ABY, 5, 0, 1) \
+	X(0x9a, TXS, IMP, 2, 0, 1) \
+	X(0x9b, TAS, ABY, 5, 0, 0) \
+	X(0x9c, SHY, ABX, 5, 0, 0) \
+	X(0x9d, STA, ABX, 5, 0, 1) \
+	X(0x9e, SHX, ABY, 5, 0, 0) \
+	X(0x9f, AHX, ABY, 5, 0, 0) \
+	X(0xa0, LDY, IMM, 2, 0, 1) \
+	X(0xa1, LDA, IZX, 6, 0, 1) \
+	X(0xa2, LDX, IMM, 2, 0, 1) \
+	X(0xa3, LAX, IZX, 6, 0, 0) \
+	X(0xa4, LDY, ZP0, 3, 0, 1) \
+	X(0xa5, LDA, ZP0, 3, 0, 1) \
+	X(0xa6, LDX, ZP0, 3, 0, 1) \
+	X(0xa7, LAX, ZP0, 3, 0, 0) \
+	X(0xa8, TAY, IMP, 2, 0, 1) \
+	X(0xa9, LDA, IMM, 2, 0, 1) \
+	X(0xaa, TAX, IMP, 2, 0, 1) \
+	X(0xab, LAX, IMM, 2, 0, 0) \
+	X(0xac, LDY, ABS, 4, 0, 1) \
+	X(0xad, LDA, ABS, 4, 0, 1) \
+	X(0xae, LDX, ABS, 4, 0, 1) \
+	X(0xaf, LAX, ABS, 4, 0, 0) \
+	X(0xb0, BCS, REL, 2, 0, 1) \
+	X(0xb1, LDA, IZY, 5, 1, 1) \
+	X(0xb2, KIL, IMP, 2, 0, 0) \
+	X(0xb3, LAX, IZY, 5, 1, 0) \
+	X(0xb4, LDY, ZPX, 4, 0, 1) \
+	X(0xb5, LDA, ZPX, 4, 0, 1) \
+	X(0xb6, LDX, ZPY, 4, 0, 1) \
+	X(0xb7, LAX, ZPY, 4, 0, 0) \
+	X(0xb8, CLV, IMP, 2, 0, 1) \
+	X(0xb9, LDA, ABY, 4, 1, 1) \
+	X(0xba, TSX, IMP, 2, 0, 1) \
+	X(0xbb, LAS, ABY, 4, 1, 0) \
+	X(0xbc, LDY, ABX, 4, 1, 1) \
+	X(0xbd, LDA, ABX, 4, 1, 1) \
+	X(0xbe, LDX, ABY, 4, 1, 1) \
+	X(0xbf, LAX, ABY, 4, 1, 0) \
+	X(0xc0, CPY, IMM, 2, 0, 1) \
+	X(0xc1, CMP, IZX, 6, 0, 1) \
+	X(0xc2, NOP, IMM, 2, 0, 0) \
+	X(0xc3, DCP, IZX, 8, 0, 0) \
+	X(0xc4, CPY, ZP0, 3, 0, 1) \
+	X(0xc5, CMP, ZP0, 3, 0, 1) \
+	X(0xc6, DEC, ZP0, 5, 0, 1) \
+	X(0xc7, DCP, ZP0, 5, 0, 0) \
+	X(0xc8, INY, IMP, 2, 0, 1) \
+	X(0xc9, CMP, IMM, 2, 0, 1) \
+	X(0xca, DEX, IMP, 2, 0, 1) \
+	X(0xcb, AXS, IMM, 2, 0, 0) \
+	X(0xcc, CPY, ABS, 4, 0, 1) \
+	X(0xcd, CMP, ABS, 4, 0, 1) \
+	X(0xce, DEC, ABS, 6, 0, 1) \
+	X(0xcf, DCP, ABS, 6, 0, 0) \
+	X(0xd0, BNE, REL, 2, 0, 1) \
+	X(0xd1, CMP, IZY, 5, 1, 1) \
+	X(0xd2, KIL, IMP, 2, 0, 0) \
+	X(0xd3, DCP, IZY, 8, 0, 0) \
+	X(0xd4, NOP, ZPX, 4, 0, 0) \
+	X(0xd5, CMP, ZPX, 4, 0, 1) \
+	X(0xd6, DEC, ZPX, 6, 0, 1) \
+	X(0xd7, DCP, ZPX, 6, 0, 0) \
+	X(0xd8, CLD, IMP, 2, 0, 1) \
+	X(0xd9, CMP, ABY, 4, 1, 1) \
+	X(0xda, NOP, IMP, 2, 0, 0) \
+	X(0xdb, DCP, ABY, 7, 0, 0) \
+	X(0xdc, NOP, ABX, 4, 1, 0) \
+	X(0xdd, CMP, ABX, 4, 1, 1) \
+	X(0xde, DEC, ABX, 7, 0, 1) \
+	X(0xdf, DCP, ABX, 7, 0, 0) \
+	X(0xe0, CPX, IMM, 2, 0, 1) \
+	X(0xe1, SBC, IZX, 6, 0, 1) \
+	X(0xe2, NOP, IMM, 2, 0, 0) \
+	X(0xe3, ISB, IZX, 8, 0, 0) \
+	X(0xe4, CPX, ZP0, 3, 0, 1) \
+	X(0xe5, SBC, ZP0, 3, 0, 1) \
+	X(0xe6, INC, ZP0, 5, 0, 1) \
+	X(0xe7, ISB, ZP0, 5, 0, 0) \
+	X(0xe8, INX, IMP, 2, 0, 1) \
+	X(0xe9, SBC, IMM, 2, 0, 1) \
+	X(0xea, NOP, IMP, 2, 0, 1) \
+	X(0xeb, SBC, IMM, 2, 0, 0) \
+	X(0xec, CPX, ABS, 4, 0, 1) \
+	X(0xed, SBC, ABS, 4, 0, 1) \
+	X(0xee, INC, ABS, 6, 0, 1) \
+	X(0xef, ISB, ABS, 6, 0, 0) \
+	X(0xf0, BEQ, REL, 2, 0, 1) \
+	X(0xf1, SBC, IZY, 5, 1, 1) \
+	X(0xf2, KIL, IMP, 2, 0, 0) \
+	X(0xf3, ISB, IZY, 8, 0, 0) \
+	X(0xf4, NOP, ZPX, 4, 0, 0) \
+	X(0xf5, SBC, ZPX, 4, 0, 1) \
+	X(0xf6, INC, ZPX, 6, 0, 1) \
+	X(0xf7, ISB, ZPX, 6, 0, 0) \
+	X(0xf8, SED, IMP, 2, 0, 1) \
+	X(0xf9, SBC, ABY, 4, 1, 1) \
+	X(0xfa, NOP, IMP, 2, 0, 0) \
+	X(0xfb, ISB, ABY, 7, 0, 0) \
+	X(0xfc, NOP, ABX, 4, 1, 0) \
+	X(0xfd, SBC, ABX, 4, 1, 1) \
+	X(0xfe, INC, ABX, 7, 0, 1) \
+	X(0xff, ISB, ABX, 7, 0, 0)
+
+
+
+#endif /* NES_OPCODES_H_ */
@@ -5,6 +5,518 @@
  *      Author: User
  */
 
+#include "header.h"
 
+#include <string.h>
 
+#include "NES_PPU.h"
+#include "NES_CPU.h"
+#include "NES_STATE.h"
 
+#define RGBA(r, g, b) ((uint32_t) (r) | ((uint32_t) (g) << 8) | ((uint32_t) (b) << 16) | 0xff000000u)
+
+static const uint32_t ppuRGBA[64] = { //2C02 colours, without emphasis
+	RGBA( 84,  84,  84), RGBA(  0,  30, 116), RGBA(  8,  16, 144), RGBA( 48,   0, 136),
+	RGBA( 68,   0, 100), RGBA( 92,   0,  48), RGBA( 84,   4,   0), RGBA( 60,  24,   0),
+	RGBA( 32,  42,   0), RGBA(  8,  58,   0), RGBA(  0,  64,   0), RGBA(  0,  60,   0),
+	RGBA(  0,  50,  60), RGBA(  0,   0,   0), RGBA(  0,   0,   0), RGBA(  0,   0,   0),
+	RGBA(152, 150, 152), RGBA(  8,  76, 196), RGBA( 48,  50, 236), RGBA( 92,  30, 228),
+	RGBA(136,  20, 176), RGBA(160,  20, 100), RGBA(152,  34,  32), RGBA(120,  60,   0),
+	RGBA( 84,  90,   0), RGBA( 40, 114,   0), RGBA(  8, 124,   0), RGBA(  0, 118,  40),
+	RGBA(  0, 102, 120), RGBA(  0,   0,   0), RGBA(  0,   0,   0), RGBA(  0,   0,   0),
+	RGBA(236, 238, 236), RGBA( 76, 154, 236), RGBA(120, 124, 236), RGBA(176,  98, 236),
+	RGBA(228,  84, 236), RGBA(236,  88, 180), RGBA(236, 106, 100), RGBA(212, 136,  32),
+	RGBA(160, 170,   0), RGBA(116, 196,   0), RGBA( 76, 208,  32), RGBA( 56, 204, 108),
+	RGBA( 56, 180, 204), RGBA( 60,  60,  60), RGBA(  0,   0,   0), RGBA(  0,   0,   0),
+	RGBA(236, 238, 236), RGBA(168, 204, 236), RGBA(188, 188, 236), RGBA(212, 178, 236),
+	RGBA(236, 174, 236), RGBA(236, 174, 212), RGBA(236, 180, 176), RGBA(228, 196, 144),
+	RGBA(204, 210, 120), RGBA(180, 222, 120), RGBA(168, 226, 144), RGBA(152, 226, 180),
+	RGBA(160, 214, 228), RGBA(160, 162, 160), RGBA(  0,   0,   0), RGBA(  0,   0,   0)
+};
+
+/*
+ * A row of a tile is two bit planes, bit 7 being the leftmost pixel.
+ * spread moves bit (7 - i) of a plane into bit 0 of nibble i, so a whole row of 2 bit pixels
+ * is spread[low] | spread[high] << 1 with pixel i in nibble i. flipped does the same mirrored.
+ */
+struct NES_PPU_DECODE {
+	uint32_t spread[256];
+	uint32_t flipped[256];
+
+	NES_PPU_DECODE() {
+		for(int b = 0; b < 256; ++b) {
+			spread[b] = 0;
+			flipped[b] = 0;
+			for(int i = 0; i < 8; ++i) {
+				spread[b] |= (uint32_t) ((b >> (7 - i)) & 1) << (i * 4);
+				flipped[b] |= (uint32_t) ((b >> i) & 1) << (i * 4);
+			}
+		}
+	}
+};
+
+static const NES_PPU_DECODE ppuDecode;
+
+static inline uint16_t advanceCoarseX(uint16_t v, int steps) { //Moves v steps tiles to the right, switching horizontal nametable on wrap
+	for(; steps > 0; --steps) {
+		if((v & 0x001f) == 31) v = (v & ~0x001f) ^ 0x0400;
+		else v++;
+	}
+	return v;
+}
+
+static inline uint8_t paletteIndex(uint16_t address) { //0x3f10, 0x3f14, 0x3f18 and 0x3f1c mirror the background entries
+	uint8_t index = address & 0x1f;
+	if((index & 0x13) == 0x10) index &= 0x0f;
+	return index;
+}
+
+
+void NES_PPU::init(NES_CPU* _cpu, NES_BUS* bus, NES_MAPPER* _mapper) {
+	cpu = _cpu;
+	mapper = _mapper;
+	mapper->ppu = this;
+
+	ctrl = 0;
+	mask = 0;
+	status = 0;
+	oamAddr = 0;
+	v = 0;
+	t = 0;
+	fineX = 0;
+	w = false;
+	readBuffer = 0;
+	openBus = 0;
+
+	memset(vram, 0, sizeof(vram));
+	memset(palette, 0, sizeof(palette));
+	memset(oam, 0, sizeof(oam));
+
+	nametableMirroring = 0xff;
+	updateMirroring();
+
+	clock = 0;
+	scanline = 0;
+	dot = 0;
+	oddFrame = false;
+	frameComplete = false;
+
+	framebuffer = NULL;
+	format = PPU_FORMAT_INDEXED;
+
+	startScanline();
+
+	bus->mapIO(0x2000, 0x3fff, registerRead, registerWrite, this); //8 registers mirrored every 8 bytes
+}
+
+void NES_PPU::setFramebuffer(void* _framebuffer, uint8_t _format) { //PPU_WIDTH * PPU_HEIGHT pixels of format, row by row
+	framebuffer = _framebuffer;
+	format = _format;
+}
+
+void NES_PPU::serialize(NES_STATE& state) {
+	state.value(ctrl);
+	state.value(mask);
+	state.value(status);
+	state.value(oamAddr);
+	state.value(v);
+	state.value(t);
+	state.value(fineX);
+	state.value(w);
+	state.value(readBuffer);
+	state.value(openBus);
+
+	state.bytes(vram, mapper->rom->mirrortype == MIRROR_FOURSCREEN ? PPU_VRAM_SIZE : 0x800);
+	state.bytes(palette, sizeof(palette));
+	state.bytes(oam, sizeof(oam));
+
+	state.value(clock);
+	state.value(scanline);
+	state.value(dot);
+	state.value(oddFrame);
+	state.value(frameComplete);
+
+	state.value(segmentV);
+	state.value(segmentX);
+	state.value(segmentFineX);
+
+	if(!state.loading) return;
+
+	//everything else is derived
+	nametableMirroring = 0xff;
+	updateMirroring();
+	fetchedStep = -1;
+	if(scanline < PPU_HEIGHT) evaluateSprites();
+}
+
+
+void NES_PPU::catchUp(uint64_t cpuCycle) { run(cpuCycle * 3); }
+
+void NES_PPU::run(uint64_t targetClock) {
+	/*
+	 * Advances dot by dot in batches: every pass covers as much of the current scanline as possible
+	 * and only does the work of the fixed points (rendering, v updates, flags) that fall inside it
+	 */
+	while(clock < targetClock) {
+		uint16_t lineEnd = PPU_DOTS;
+		if(scanline == PPU_PRERENDER_LINE && oddFrame && isRendering()) lineEnd--; //odd frames skip the last dot of the pre-render line
+
+		uint64_t remaining = targetClock - clock;
+		uint16_t stop = remaining < (uint64_t) (lineEnd - dot) ? dot + remaining : lineEnd;
+
+		if(scanline < PPU_HEIGHT && dot <= 256 && stop > 1) { //pixel x is output on dot x + 1
+			int x0 = dot > 1 ? dot - 1 : 0;
+			int x1 = stop < 257 ? stop - 1 : PPU_WIDTH;
+			if(x1 > x0) renderSegment(x0, x1);
+		}
+
+		if(scanline < PPU_HEIGHT || scanline == PPU_PRERENDER_LINE) {
+			if(scanline == PPU_PRERENDER_LINE && dot <= 1 && stop > 1) status &= 0x1f; //clears vblank, sprite 0 hit and sprite overflow
+
+			if(isRendering()) {
+				if(dot <= 256 && stop > 256) incrementY();
+				if(dot <= 257 && stop > 257) copyHorizontal();
+				if(scanline == PPU_PRERENDER_LINE && dot <= 280 && stop > 280) copyVertical();
+				if(mapper->countsScanlines && dot <= 260 && stop > 260) mapper->scanline();
+			}
+		} else if(scanline == PPU_VBLANK_LINE && dot <= 1 && stop > 1) {
+			status |= 0x80;
+			if(ctrl & 0x80) cpu->nmiPending = true;
+		}
+
+		clock += stop - dot;
+		dot = stop;
+
+		if(dot >= lineEnd) {
+			dot = 0;
+			if(++scanline == PPU_SCANLINES) {
+				scanline = 0;
+				oddFrame = !oddFrame;
+				frameComplete = true;
+			}
+			if(scanline < PPU_HEIGHT) startScanline();
+		}
+	}
+}
+
+uint64_t NES_PPU::nextEventCycle() {
+	/*
+	 * The first CPU cycle by which the PPU has to have run to stay correct without being asked:
+	 * the vblank NMI, the end of the frame and, for mappers that count them, the next rendered scanline.
+	 * Positions are in dots from the start of the frame, the skipped dot of odd frames only makes events come early.
+	 */
+	uint32_t now = scanline * PPU_DOTS + dot;
+	uint32_t next = PPU_SCANLINES * PPU_DOTS;
+
+	uint32_t vblank = PPU_VBLANK_LINE * PPU_DOTS + 2;
+	if(now < vblank) next = vblank;
+
+	if(mapper->countsScanlines && isRendering()) {
+		uint32_t line = dot <= 260 ? scanline : scanline + 1;
+		if(line >= PPU_HEIGHT && line < PPU_PRERENDER_LINE) line = PPU_PRERENDER_LINE;
+
+		uint32_t counted = line * PPU_DOTS + 261;
+		if(line < PPU_SCANLINES && counted < next) next = counted;
+	}
+
+	return (clock + (next - now) + 2) / 3;
+}
+
+
+uint8_t NES_PPU::readRegister(uint16_t address) {
+	uint8_t value = openBus;
+
+	switch(address & 7) {
+
+	case 2: //status, the low bits are whatever was last on the PPU bus
+		value = (status & 0xe0) | (openBus & 0x1f);
+		status &= 0x7f;
+		w = false;
+		break;
+
+	case 4:
+		value = oam[oamAddr];
+		break;
+
+	case 7: { //reads are delayed through a buffer, except for the palette
+		uint16_t vramAddress = v & 0x3fff;
+		if(vramAddress >= 0x3f00) {
+			value = palette[paletteIndex(vramAddress)] | (openBus & 0xc0);
+			readBuffer = readVRAM(vramAddress & 0x2fff); //the nametable byte underneath
+		} else {
+			value = readBuffer;
+			readBuffer = readVRAM(vramAddress);
+		}
+		v += (ctrl & 0x04) ? 32 : 1;
+		break;
+	}
+	}
+
+	openBus = value;
+	return value;
+}
+
+void NES_PPU::writeRegister(uint16_t address, uint8_t value) {
+	openBus = value;
+
+	switch(address & 7) {
+
+	case 0: //enabling NMI during vblank raises one immediately
+		if(!(ctrl & 0x80) && (value & 0x80) && (status & 0x80)) cpu->nmiPending = true;
+		ctrl = value;
+		t = (t & 0xf3ff) | ((value & 0x03) << 10);
+		break;
+
+	case 1:
+		mask = value;
+		break;
+
+	case 3:
+		oamAddr = value;
+		break;
+
+	case 4:
+		writeOAM(value);
+		break;
+
+	case 5: //first write is X scroll, second Y scroll
+		if(!w) {
+			t = (t & 0xffe0) | (value >> 3);
+			fineX = value & 7;
+			restartSegment(false);
+		} else t = (t & 0x8c1f) | ((value & 0x07) << 12) | ((value & 0xf8) << 2);
+		w = !w;
+		break;
+
+	case 6: //first write is the high byte, second the low byte which also loads v
+		if(!w) t = (t & 0x00ff) | ((value & 0x3f) << 8);
+		else {
+			t = (t & 0xff00) | value;
+			v = t;
+			restartSegment(true);
+		}
+		w = !w;
+		break;
+
+	case 7:
+		writeVRAM(v & 0x3fff, value);
+		v += (ctrl & 0x04) ? 32 : 1;
+		break;
+	}
+}
+
+void NES_PPU::writeOAM(uint8_t value) { oam[oamAddr++] = value; }
+
+uint8_t NES_PPU::registerRead(void* device, uint16_t address) {
+	NES_PPU* ppu = (NES_PPU*) device;
+	ppu->catchUp(ppu->cpu->currentCycle());
+	return ppu->readRegister(address);
+}
+
+void NES_PPU::registerWrite(void* device, uint16_t address, uint8_t value) {
+	NES_PPU* ppu = (NES_PPU*) device;
+	ppu->catchUp(ppu->cpu->currentCycle());
+	ppu->writeRegister(address, value);
+}
+
+
+uint8_t NES_PPU::readVRAM(uint16_t address) {
+	address &= 0x3fff;
+
+	if(address < 0x2000) return mapper->chrMap[address >> 10][address & (CHR_PAGE_SIZE - 1)];
+
+	if(address < 0x3f00) {
+		updateMirroring();
+		return nametables[(address >> 10) & 3][address & 0x3ff];
+	}
+
+	return palette[paletteIndex(address)];
+}
+
+void NES_PPU::writeVRAM(uint16_t address, uint8_t value) {
+	address &= 0x3fff;
+
+	if(address < 0x2000) {
+		uint8_t* page = mapper->chrWriteMap[address >> 10];
+		if(page != NULL) page[address & (CHR_PAGE_SIZE - 1)] = value;
+	} else if(address < 0x3f00) {
+		updateMirroring();
+		nametables[(address >> 10) & 3][address & 0x3ff] = value;
+	} else palette[paletteIndex(address)] = value & 0x3f;
+}
+
+void NES_PPU::updateMirroring() { //Points the four logical nametables at VRAM according to the mapper
+	if(mapper->mirroring == nametableMirroring) return;
+	nametableMirroring = mapper->mirroring;
+
+	static const uint8_t layouts[5][4] = {
+		{ 0, 0, 1, 1 }, //MIRROR_HORIZONTAL
+		{ 0, 1, 0, 1 }, //MIRROR_VERTICAL
+		{ 0, 1, 2, 3 }, //MIRROR_FOURSCREEN
+		{ 0, 0, 0, 0 }, //MIRROR_SINGLE_LOWER
+		{ 1, 1, 1, 1 }  //MIRROR_SINGLE_UPPER
+	};
+
+	const uint8_t* layout = layouts[nametableMirroring < 5 ? nametableMirroring : MIRROR_HORIZONTAL];
+	for(int i = 0; i < 4; ++i) nametables[i] = &vram[layout[i] * 0x400];
+}
+
+
+void NES_PPU::startScanline() {
+	updateMirroring();
+
+	segmentV = v;
+	segmentX = 0;
+	segmentFineX = fineX;
+	fetchedStep = -1;
+
+	evaluateSprites();
+}
+
+void NES_PPU::evaluateSprites() { //Draws the first 8 sprites on this scanline into spritePixels, front to back
+	memset(spritePixels, 0, sizeof(spritePixels));
+	spriteZeroOnLine = false;
+
+	if(!(mask & 0x10)) return;
+
+	uint8_t height = (ctrl & 0x20) ? 16 : 8;
+	uint8_t found = 0;
+
+	for(int i = 0; i < 64; ++i) {
+		const uint8_t* sprite = &oam[i * 4];
+		int row = scanline - sprite[0] - 1; //sprites are drawn one line below their Y
+		if(row < 0 || row >= height) continue;
+
+		if(++found > 8) {
+			status |= 0x20;
+			break;
+		}
+
+		uint8_t tile = sprite[1];
+		uint8_t attributes = sprite[2];
+		if(attributes & 0x80) row = height - 1 - row;
+
+		uint16_t pattern;
+		if(height == 16) pattern = ((tile & 1) << 12) | ((tile & 0xfe) << 4) | ((row & 8) << 1) | (row & 7);
+		else pattern = ((ctrl & 0x08) << 9) | (tile << 4) | row;
+
+		uint8_t low = readVRAM(pattern);
+		uint8_t high = readVRAM(pattern + 8);
+		const uint32_t* decode = (attributes & 0x40) ? ppuDecode.flipped : ppuDecode.spread;
+		uint32_t pixels = decode[low] | (decode[high] << 1);
+		if(pixels == 0) continue;
+
+		uint8_t base = 0x10 | ((attributes & 3) << 2) | ((attributes & 0x20) ? 0x20 : 0) | (i == 0 ? 0x40 : 0);
+		if(i == 0) spriteZeroOnLine = true;
+
+		for(int x = sprite[3]; x < PPU_WIDTH && pixels != 0; ++x, pixels >>= 4) {
+			uint8_t pixel = pixels & 3;
+			if(pixel != 0 && !(spritePixels[x] & 3)) spritePixels[x] = base | pixel;
+		}
+	}
+}
+
+uint32_t NES_PPU::fetchTile(int step) { //The 8 pixels of the tile step tiles right of segmentV, 4 bit palette index per nibble
+	uint16_t tileV = advanceCoarseX(segmentV, step);
+	const uint8_t* nametable = nametables[(tileV >> 10) & 3];
+
+	uint8_t tile = nametable[tileV & 0x3ff];
+	uint8_t attributes = nametable[0x3c0 | ((tileV >> 4) & 0x38) | ((tileV >> 2) & 0x07)];
+	uint8_t attribute = (attributes >> (((tileV >> 4) & 4) | (tileV & 2))) & 3;
+
+	uint16_t pattern = ((ctrl & 0x10) << 8) | (tile << 4) | ((tileV >> 12) & 7);
+	uint8_t low = readVRAM(pattern);
+	uint8_t high = readVRAM(pattern + 8);
+
+	return ppuDecode.spread[low] | (ppuDecode.spread[high] << 1) | (attribute * 0x44444444u);
+}
+
+void NES_PPU::renderSegment(int x0, int x1) {
+	bool showBackground = mask & 0x08;
+	bool showSprites = mask & 0x10;
+	bool spriteZeroPossible = spriteZeroOnLine && showBackground && showSprites && !(status & 0x40);
+
+	if(framebuffer == NULL && !spriteZeroPossible) return; //nothing anyone could observe
+
+	if(showBackground) {
+		for(int x = x0; x < x1;) {
+			int position = x - segmentX + segmentFineX;
+			int step = position >> 3;
+			int sub = position & 7;
+
+			if(step != fetchedStep) {
+				fetchedTile = fetchTile(step);
+				fetchedStep = step;
+			}
+
+			int count = 8 - sub;
+			if(count > x1 - x) count = x1 - x;
+
+			uint32_t pixels = fetchedTile >> (sub * 4);
+			for(int i = 0; i < count; ++i, pixels >>= 4) bgPixels[x + i] = pixels & 0x0f;
+			x += count;
+		}
+
+		if(!(mask & 0x02)) for(int x = x0; x < x1 && x < 8; ++x) bgPixels[x] = 0; //left column clipped
+	} else memset(&bgPixels[x0], 0, x1 - x0);
+
+	uint8_t greyscale = (mask & 0x01) ? 0x30 : 0x3f;
+	uint8_t* indexed = (uint8_t*) framebuffer + scanline * PPU_WIDTH;
+	uint32_t* rgba = (uint32_t*) framebuffer + scanline * PPU_WIDTH;
+
+	for(int x = x0; x < x1; ++x) {
+		uint8_t background = (bgPixels[x] & 3) ? bgPixels[x] : 0;
+		uint8_t sprite = (showSprites && (x >= 8 || (mask & 0x04))) ? spritePixels[x] : 0;
+		uint8_t index = background;
+
+		if(sprite & 3) {
+			if((sprite & 0x40) && background != 0 && x != 255) status |= 0x40;
+			if(background == 0 || !(sprite & 0x20)) index = sprite & 0x1f;
+		}
+
+		if(framebuffer == NULL) continue;
+
+		uint8_t colour = palette[index] & greyscale;
+		if(format == PPU_FORMAT_RGBA) rgba[x] = ppuRGBA[colour];
+		else indexed[x] = colour;
+	}
+}
+
+void NES_PPU::restartSegment(bool reloadV) {
+	/*
+	 * Pixels up to the current dot have been rendered with the old values,
+	 * the rest of the line continues from here with the new ones
+	 */
+	if(scanline >= PPU_HEIGHT || dot > 256 || !isRendering()) return;
+
+	int x = dot > 0 ? dot - 1 : 0;
+	if(!reloadV) segmentV = advanceCoarseX(segmentV, (x - segmentX + segmentFineX) >> 3);
+	else segmentV = v;
+
+	segmentX = x;
+	segmentFineX = fineX;
+	fetchedStep = -1;
+}
+
+
+void NES_PPU::incrementY() { //Fine Y, then coarse Y, switching vertical nametable after row 29
+	if((v & 0x7000) != 0x7000) {
+		v += 0x1000;
+		return;
+	}
+
+	v &= ~0x7000;
+	uint16_t coarseY = (v & 0x03e0) >> 5;
+
+	if(coarseY == 29) {
+		coarseY = 0;
+		v ^= 0x0800;
+	} else if(coarseY == 31) coarseY = 0;
+	else coarseY++;
+
+	v = (v & ~0x03e0) | (coarseY << 5);
+}
+
+void NES_PPU::copyHorizontal() { v = (v & ~0x041f) | (t & 0x041f); }
+
+void NES_PPU::copyVertical() { v = (v & ~0x7be0) | (t & 0x7be0); }
@@ -0,0 +1,108 @@
+#ifndef NES_PPU_H_
+#define NES_PPU_H_
+
+#include "NES_BUS.h"
+#include "NES_MAPPER.h"
+
+class NES_CPU;
+class NES_STATE;
+
+#define PPU_WIDTH 256
+#define PPU_HEIGHT 240
+#define PPU_DOTS 341
+#define PPU_SCANLINES 262
+#define PPU_VBLANK_LINE 241
+#define PPU_PRERENDER_LINE 261
+
+#define PPU_VRAM_SIZE 0x1000 //2KB on the console, the rest is only used by four-screen cartridges
+
+#define PPU_FORMAT_INDEXED 0 //one uint8_t per pixel, the 6 bit NES colour index
+#define PPU_FORMAT_RGBA 1 //one uint32_t per pixel, bytes R, G, B, A in memory
+
+/*
+ * The picture processing unit
+ * The PPU does not step along with the CPU. It is caught up lazily whenever the CPU touches one of its
+ * registers and at the points NES_PPU::nextEventCycle reports (vblank NMI, mapper scanline IRQs, end of frame).
+ * Catching up renders whole scanline segments at once, the background a tile (8 pixels) at a time.
+ * A register write in the middle of a visible scanline simply ends the current segment there.
+ */
+class NES_PPU {
+public:
+	NES_CPU* cpu;
+	NES_MAPPER* mapper;
+
+	//Registers
+	uint8_t ctrl; //0x2000
+	uint8_t mask; //0x2001
+	uint8_t status; //0x2002
+	uint8_t oamAddr; //0x2003
+	uint16_t v; //current VRAM address
+	uint16_t t; //temporary VRAM address
+	uint8_t fineX;
+	bool w; //first or second write toggle of 0x2005/0x2006
+	uint8_t readBuffer;
+	uint8_t openBus;
+
+	//Memory
+	uint8_t vram[PPU_VRAM_SIZE];
+	uint8_t palette[32];
+	uint8_t oam[256];
+	uint8_t* nametables[4];
+	uint8_t nametableMirroring;
+
+	//Timing
+	uint64_t clock; //dots since init, 3 per CPU cycle
+	uint16_t scanline;
+	uint16_t dot;
+	bool oddFrame;
+	bool frameComplete; //set at the end of every frame, cleared by whoever consumes the frame
+
+	//Output
+	void* framebuffer; //owned by the caller, NULL skips all pixel output
+	uint8_t format;
+
+	//Current scanline
+	uint16_t segmentV; //v at segmentX
+	uint8_t segmentX;
+	uint8_t segmentFineX;
+	uint8_t bgPixels[PPU_WIDTH]; //4 bit palette index, 0 is transparent
+	uint8_t spritePixels[PPU_WIDTH]; //bits 0-4 palette index, 0 is transparent, 0x20 behind background, 0x40 sprite 0
+	bool spriteZeroOnLine;
+	int fetchedStep; //coarse X step of the tile in fetchedTile
+	uint32_t fetchedTile;
+
+	void init(NES_CPU* cpu, NES_BUS* bus, NES_MAPPER* mapper);
+	void setFramebuffer(void* framebuffer, uint8_t format);
+	void serialize(NES_STATE& state);
+
+	void catchUp(uint64_t cpuCycle);
+	void run(uint64_t targetClock);
+	uint64_t nextEventCycle();
+
+	uint8_t readRegister(uint16_t address);
+	void writeRegister(uint16_t address, uint8_t value);
+	void writeOAM(uint8_t value);
+
+	static uint8_t registerRead(void* ppu, uint16_t address);
+	static void registerWrite(void* ppu, uint16_t address, uint8_t value);
+
+	inline bool isRendering() { return (mask & 0x18) != 0; }
+
+	uint8_t readVRAM(uint16_t address);
+	void writeVRAM(uint16_t address, uint8_t value);
+	void updateMirroring();
+
+	void startScanline();
+	void evaluateSprites();
+	void renderSegment(int x0, int x1);
+	uint32_t fetchTile(int step);
+	void restartSegment(bool reloadV); //a register write changed v or fineX in the middle of a visible scanline
+
+	void incrementY();
+	void copyHorizontal();
+	void copyVertical();
+};
+
+
+
+#endif /* NES_PPU_H_ */
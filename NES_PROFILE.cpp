@@ -0,0 +1,138 @@
+#include "header.h"
+
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "NES_CPU.h"
+#include "NES_PROFILE.h"
+
+static const char* const modeNames[NES_ADDRMODE_COUNT] = {
+	"IMP", "ACC", "IMM", "ZP0", "ZPX", "ZPY", "ABS", "ABX", "ABY", "IND", "IZX", "IZY", "REL"
+};
+
+struct NES_PROFILE_ROW {
+	std::string label;
+	uint64_t count;
+	uint64_t cycles;
+};
+
+static bool moreCycles(const NES_PROFILE_ROW& a, const NES_PROFILE_ROW& b) {
+	return a.cycles != b.cycles ? a.cycles > b.cycles : a.label < b.label;
+}
+
+static void printRows(FILE* out, const char* title, std::vector<NES_PROFILE_ROW>& rows, unsigned top, uint64_t totalCount, uint64_t totalCycles) {
+	std::sort(rows.begin(), rows.end(), moreCycles);
+
+	fprintf(out, "\n%s\n", title);
+	fprintf(out, "  %-16s %14s %7s %14s %7s %7s\n", "", "count", "%", "cycles", "%", "cyc/op");
+	for(size_t i = 0; i < rows.size() && (top == 0 || i < top); ++i) {
+		const NES_PROFILE_ROW& row = rows[i];
+		if(row.count == 0) break;
+		fprintf(out, "  %-16s %14llu %6.2f%% %14llu %6.2f%% %7.2f\n", row.label.c_str(),
+				(unsigned long long) row.count, 100.0 * row.count / totalCount,
+				(unsigned long long) row.cycles, 100.0 * row.cycles / totalCycles, (double) row.cycles / row.count);
+	}
+}
+
+
+NES_PROFILE::NES_PROFILE() {
+	pcCount = new uint64_t[PROFILE_ADDRESSES];
+	pcCycles = new uint64_t[PROFILE_ADDRESSES];
+	pcOpcode = new uint8_t[PROFILE_ADDRESSES];
+	reset();
+}
+
+NES_PROFILE::~NES_PROFILE() {
+	delete[] pcCount;
+	delete[] pcCycles;
+	delete[] pcOpcode;
+}
+
+void NES_PROFILE::reset() {
+	memset(opcodeCount, 0, sizeof(opcodeCount));
+	memset(opcodeCycles, 0, sizeof(opcodeCycles));
+	memset(pcCount, 0, PROFILE_ADDRESSES * sizeof(uint64_t));
+	memset(pcCycles, 0, PROFILE_ADDRESSES * sizeof(uint64_t));
+	memset(pcOpcode, 0, PROFILE_ADDRESSES);
+	interrupts = 0;
+}
+
+void NES_PROFILE::printReport(FILE* out, unsigned top) {
+	uint64_t totalCount = 0;
+	uint64_t totalCycles = 0;
+	for(int i = 0; i < 256; ++i) {
+		totalCount += opcodeCount[i];
+		totalCycles += opcodeCycles[i];
+	}
+
+	fprintf(out, "Profile: %llu instructions, %llu cycles, %llu interrupts\n", (unsigned long long) totalCount,
+			(unsigned long long) totalCycles, (unsigned long long) interrupts);
+	if(totalCount == 0) return;
+
+	std::map<std::string, NES_PROFILE_ROW> handlers;
+	std::vector<NES_PROFILE_ROW> modes(NES_ADDRMODE_COUNT);
+	std::vector<NES_PROFILE_ROW> opcodes;
+
+	for(int i = 0; i < NES_ADDRMODE_COUNT; ++i) {
+		modes[i].label = modeNames[i];
+		modes[i].count = 0;
+		modes[i].cycles = 0;
+	}
+
+	for(int i = 0; i < 256; ++i) {
+		const NES_OPCODE& op = NES_CPU::opcodes[i];
+
+		NES_PROFILE_ROW& handler = handlers[op.name];
+		handler.label = op.name;
+		handler.count += opcodeCount[i];
+		handler.cycles += opcodeCycles[i];
+
+		modes[op.mode].count += opcodeCount[i];
+		modes[op.mode].cycles += opcodeCycles[i];
+
+		char label[32];
+		snprintf(label, sizeof(label), "%02x %s %s", i, op.name, modeNames[op.mode]);
+		NES_PROFILE_ROW row = { label, opcodeCount[i], opcodeCycles[i] };
+		opcodes.push_back(row);
+	}
+
+	std::vector<NES_PROFILE_ROW> handlerRows;
+	std::map<std::string, NES_PROFILE_ROW>::iterator it;
+	for(it = handlers.begin(); it != handlers.end(); ++it) handlerRows.push_back(it->second);
+
+	std::vector<NES_PROFILE_ROW> addresses;
+	for(uint32_t PC = 0; PC < PROFILE_ADDRESSES; ++PC) {
+		if(pcCount[PC] == 0) continue;
+		const NES_OPCODE& op = NES_CPU::opcodes[pcOpcode[PC]];
+
+		char label[32];
+		snprintf(label, sizeof(label), "%04x %s %s", PC, op.name, modeNames[op.mode]);
+		NES_PROFILE_ROW row = { label, pcCount[PC], pcCycles[PC] };
+		addresses.push_back(row);
+	}
+
+	printRows(out, "By handler", handlerRows, 0, totalCount, totalCycles);
+	printRows(out, "By addressing mode", modes, 0, totalCount, totalCycles);
+	printRows(out, "By opcode", opcodes, top, totalCount, totalCycles);
+	printRows(out, "By PC", addresses, top, totalCount, totalCycles);
+}
+
+bool NES_PROFILE::writeFolded(const char* path) {
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		printf("ERROR: Profile file %s could not be opened\n", path);
+		return false;
+	}
+
+	for(uint32_t PC = 0; PC < PROFILE_ADDRESSES; ++PC) {
+		if(pcCycles[PC] == 0) continue;
+		const NES_OPCODE& op = NES_CPU::opcodes[pcOpcode[PC]];
+		fprintf(file, "%s;%s;%04x %llu\n", op.name, modeNames[op.mode], PC, (unsigned long long) pcCycles[PC]);
+	}
+
+	fclose(file);
+	return true;
+}
@@ -0,0 +1,45 @@
+#ifndef NES_PROFILE_H_
+#define NES_PROFILE_H_
+
+#define PROFILE_ADDRESSES 0x10000
+
+/*
+ * Execution counts and cycles per opcode and per PC, filled in by NES_CPU::runOp
+ * Counting is a handful of increments per instruction. Per handler and per addressing mode figures are
+ * summed from the opcodes when a report is written, since every opcode has exactly one of each.
+ * Code banked in at the same address shares its PC counters, pcOpcode keeps the last opcode seen there.
+ * While a profile is attached runUntil goes through runOp for every instruction, like it does for traces.
+ */
+class NES_PROFILE {
+public:
+	uint64_t opcodeCount[256];
+	uint64_t opcodeCycles[256];
+	uint64_t* pcCount; //PROFILE_ADDRESSES entries each
+	uint64_t* pcCycles;
+	uint8_t* pcOpcode;
+	uint64_t interrupts; //NMI and IRQ entries, 7 cycles each, not in any of the above
+
+	NES_PROFILE();
+	~NES_PROFILE();
+
+	void reset();
+
+	inline void record(uint16_t PC, uint8_t opcode, uint8_t cycles) {
+		opcodeCount[opcode]++;
+		opcodeCycles[opcode] += cycles;
+		pcCount[PC]++;
+		pcCycles[PC] += cycles;
+		pcOpcode[PC] = opcode;
+	}
+
+	void printReport(FILE* out, unsigned top); //tables sorted by cycles, top limits the opcode and PC tables
+	bool writeFolded(const char* path); //"handler;mode;PC cycles" lines for flamegraph.pl and compatible tools
+
+private:
+	NES_PROFILE(const NES_PROFILE&);
+	NES_PROFILE& operator=(const NES_PROFILE&);
+};
+
+
+
+#endif /* NES_PROFILE_H_ */
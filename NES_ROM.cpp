@@ -1,49 +1,293 @@
 #include "header.h"
 
+#include <string.h>
+#include <map>
+#include <mutex>
+
 #include "NES_ROM.h"
 #include "helper.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-bool NES_ROM::loadRom(char* romPath) {
 
-	std::ifstream rom (romPath, std::ios::in | std::ios::binary | std::ios::ate);
+static std::mutex cacheLock;
+static std::multimap<uint64_t, NES_ROM_IMAGE*> cache; //by hash, equal hashes are told apart by their contents
 
-	if(rom.is_open()) {
-		size = rom.tellg();
+static uint64_t contentHash(const uint8_t* contents, size_t size) { //FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i = 0; i < size; ++i) hash = (hash ^ contents[i]) * 1099511628211ull;
+	return hash;
+}
 
-		romContents = new uint8_t[size]();
+static void freeContents(const uint8_t* contents, size_t size, uint8_t storage) {
+#ifndef _WIN32
+	if(storage == ROM_MAPPED) munmap((void*) contents, size);
+#endif
+	if(storage == ROM_HEAP) delete[] contents;
+}
 
-		rom.seekg(0, std::ios::beg);
+NES_ROM_IMAGE* NES_ROM_CACHE::acquire(const uint8_t* contents, size_t size, uint8_t storage) {
+	uint64_t hash = contentHash(contents, size); //outside the lock, it reads the whole file
 
-		rom.read((char*)romContents, size);
+	std::lock_guard<std::mutex> guard(cacheLock);
 
-		rom.close();
+	std::multimap<uint64_t, NES_ROM_IMAGE*>::iterator it;
+	for(it = cache.lower_bound(hash); it != cache.end() && it->first == hash; ++it) {
+		NES_ROM_IMAGE* image = it->second;
+		if(image->size == size && memcmp(image->contents, contents, size) == 0) {
+			image->users++;
+			freeContents(contents, size, storage);
+			return image;
+		}
+	}
 
-		if(romContents[3] != 0x1a) {
-			printf("ERROR: selected ROM is invalid\n");
-			return false;
+	NES_ROM_IMAGE* image = new NES_ROM_IMAGE();
+	if(storage == ROM_BORROWED) {
+		uint8_t* copy = new uint8_t[size];
+		memcpy(copy, contents, size);
+		contents = copy;
+		storage = ROM_HEAP;
+	}
+	image->contents = contents;
+	image->size = size;
+	image->storage = storage;
+	image->hash = hash;
+	image->users = 1;
+
+	cache.insert(std::make_pair(hash, image));
+	return image;
+}
+
+void NES_ROM_CACHE::retain(NES_ROM_IMAGE* image) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+	image->users++;
+}
+
+void NES_ROM_CACHE::release(NES_ROM_IMAGE* image) {
+	std::lock_guard<std::mutex> guard(cacheLock);
+
+	if(--image->users > 0) return;
+
+	std::multimap<uint64_t, NES_ROM_IMAGE*>::iterator it;
+	for(it = cache.lower_bound(image->hash); it != cache.end() && it->first == image->hash; ++it) {
+		if(it->second == image) {
+			cache.erase(it);
+			break;
 		}
+	}
 
-		prg_banks = romContents[4];
-		chr_banks = romContents[5];
+	freeContents(image->contents, image->size, image->storage);
+	delete image;
+}
 
-		mirrortype = isBitSet(romContents[6], 0);
-		batteryRamPresent = isBitSet(romContents[6], 1);
-		trainerPresent = isBitSet(romContents[6], 2);
-		if(isBitSet(romContents[6], 3)) mirrortype = 2;
-		//TODO: Mapper Number
-		ramBanks = romContents[8] == 0 ? 1 : romContents[8];
+size_t NES_ROM_CACHE::count() {
+	std::lock_guard<std::mutex> guard(cacheLock);
+	return cache.size();
+}
 
-		prg_rom = trainerPresent ? &romContents[512+16] : &romContents[16];
-		chr_rom = &prg_rom[prg_banks*KB16];
 
-		return true;
-	} else {
+NES_ROM::NES_ROM() {
+	image = NULL;
+	path = NULL;
+	romContents = NULL;
+	size = 0;
+	mapped = false;
+	hash = 0;
+	prg_rom = NULL;
+	chr_rom = NULL;
+}
+
+NES_ROM::~NES_ROM() { unloadRom(); }
+
+bool NES_ROM::loadRom(const char* romPath) {
+	unloadRom();
+
+	if(!mapFile(romPath)) {
 		printf("ERROR: Rom at %s could not be opened\n", romPath);
 		return false;
 	}
+	useImage(NES_ROM_CACHE::acquire(romContents, size, mapped ? ROM_MAPPED : ROM_HEAP));
+
+	if(!parseHeader()) {
+		unloadRom();
+		return false;
+	}
+
+	path = new char[strlen(romPath) + 1];
+	strcpy(path, romPath);
+
+	return true;
 } //end loadRom
 
+bool NES_ROM::loadImage(const uint8_t* contents, size_t contentSize) { //for images built in memory, path stays NULL
+	unloadRom();
+
+	useImage(NES_ROM_CACHE::acquire(contents, contentSize, ROM_BORROWED));
+
+	if(!parseHeader()) {
+		unloadRom();
+		return false;
+	}
+	return true;
+}
+
+bool NES_ROM::loadShared(const NES_ROM& other) {
+	if(&other == this) return image != NULL;
+
+	unloadRom();
+
+	if(other.image == NULL) {
+		printf("ERROR: There is no ROM loaded to share\n");
+		return false;
+	}
+
+	NES_ROM_CACHE::retain(other.image);
+	useImage(other.image);
+
+	if(!parseHeader()) {
+		unloadRom();
+		return false;
+	}
+
+	if(other.path != NULL) {
+		path = new char[strlen(other.path) + 1];
+		strcpy(path, other.path);
+	}
+	return true;
+}
+
+bool NES_ROM::mapFile(const char* romPath) {
+#ifdef _WIN32
+	std::ifstream rom (romPath, std::ios::in | std::ios::binary | std::ios::ate);
+	if(!rom.is_open()) return false;
+
+	size = rom.tellg();
+	uint8_t* contents = new uint8_t[size]();
+	rom.seekg(0, std::ios::beg);
+	rom.read((char*)contents, size);
+	rom.close();
+
+	romContents = contents;
+	mapped = false;
+	return true;
+#else
+	int fd = open(romPath, O_RDONLY);
+	if(fd < 0) return false;
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); //the mapping keeps the file referenced
+	if(mapping == MAP_FAILED) return false;
+
+	romContents = (const uint8_t*) mapping;
+	size = info.st_size;
+	mapped = true;
+	return true;
+#endif
+}
+
+void NES_ROM::useImage(NES_ROM_IMAGE* _image) {
+	image = _image;
+	romContents = image->contents;
+	size = image->size;
+	mapped = image->storage == ROM_MAPPED;
+	hash = image->hash;
+}
+
+void NES_ROM::unloadRom() {
+	if(image != NULL) NES_ROM_CACHE::release(image);
+	image = NULL;
+
+	delete[] path;
+	path = NULL;
+	romContents = NULL;
+	size = 0;
+	mapped = false;
+	hash = 0;
+	prg_rom = NULL;
+	chr_rom = NULL;
+}
+
+static uint32_t nes2RomSize(uint8_t lsb, uint8_t msbNibble, uint32_t unit) {
+	//NES 2.0 sizes are either a 12 bit count of units, or 2^E * (2M+1) bytes when the MSB nibble is 0xf
+	if(msbNibble == 0xf) {
+		uint8_t exponent = lsb >> 2;
+		uint8_t multiplier = (lsb & 0x03) * 2 + 1;
+		if(exponent > 30) return 0xffffffff; //larger than anything we can map, caught by the size check
+		return (1u << exponent) * multiplier;
+	}
+	return ((msbNibble << 8) | lsb) * unit;
+}
+
+bool NES_ROM::parseHeader() {
+	const uint8_t* header = romContents;
+
+	if(size < INES_HEADER_SIZE || header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1a) {
+		printf("ERROR: selected ROM is invalid\n");
+		return false;
+	}
+
+	nes2 = (header[7] & 0x0c) == 0x08;
+
+	mirrortype = isBitSet(header[6], 0);
+	batteryRamPresent = isBitSet(header[6], 1);
+	trainerPresent = isBitSet(header[6], 2);
+	if(isBitSet(header[6], 3)) mirrortype = 2;
+
+	mapper = (header[6] >> 4) | (header[7] & 0xf0);
+
+	if(nes2) {
+		mapper |= (header[8] & 0x0f) << 8;
+		submapper = header[8] >> 4;
+		prg_size = nes2RomSize(header[4], header[9] & 0x0f, KB16);
+		chr_size = nes2RomSize(header[5], header[9] >> 4, KB8);
+		uint8_t prgRamShift = header[10] & 0x0f; //PRG RAM is 64 << shift bytes
+		uint8_t prgNvramShift = header[10] >> 4;
+		uint32_t prgRam = (prgRamShift ? 64u << prgRamShift : 0) + (prgNvramShift ? 64u << prgNvramShift : 0);
+		ramBanks = prgRam == 0 ? 1 : (prgRam + KB8 - 1) / KB8;
+		if(ramBanks > PRG_RAM_MAX_BANKS) {
+			printf("ERROR: ROM has an unsupported PRG RAM size (%u bytes)\n", prgRam);
+			return false;
+		}
+	} else {
+		submapper = 0;
+		prg_size = header[4] * KB16;
+		chr_size = header[5] * KB8;
+		ramBanks = header[8] == 0 ? 1 : header[8];
+		if(ramBanks > PRG_RAM_MAX_BANKS) ramBanks = PRG_RAM_MAX_BANKS; //byte 8 is often garbage in iNES 1.0 dumps
+	}
+
+	prg_banks = prg_size / KB16;
+	chr_banks = chr_size / KB8;
+
+	if(prg_size == 0 || prg_size % KB8 != 0 || chr_size % 1024 != 0) {
+		printf("ERROR: ROM has an unsupported PRG (%u bytes) or CHR (%u bytes) size\n", prg_size, chr_size);
+		return false;
+	}
+
+	uint64_t expected = (uint64_t) INES_HEADER_SIZE + (trainerPresent ? INES_TRAINER_SIZE : 0) + prg_size + chr_size;
+	if(size < expected) {
+		printf("ERROR: ROM is truncated, header describes %llu bytes but the file has %llu\n",
+				(unsigned long long) expected, (unsigned long long) size);
+		return false;
+	}
+
+	prg_rom = trainerPresent ? &romContents[INES_TRAINER_SIZE+INES_HEADER_SIZE] : &romContents[INES_HEADER_SIZE];
+	chr_rom = chr_size ? &prg_rom[prg_size] : NULL;
+
+	return true;
+}
+
 void NES_ROM::d_printRom() {
 	if(romContents != NULL) {
 		printf("Dumping the first KB of ROM: \n");
@@ -1,23 +1,87 @@
-
 #ifndef NES_ROM_H_
 #define NES_ROM_H_
 
+#define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 512
+#define KB8 8192
+#define PRG_RAM_MAX_BANKS 4 //32KB of PRG RAM, the most any board we emulate carries (MMC1 SXROM)
+
+//Where the contents of a NES_ROM_IMAGE live
+enum NES_ROM_STORAGE {
+	ROM_MAPPED, //a read-only file mapping
+	ROM_HEAP, //new[]
+	ROM_BORROWED //the caller's buffer, only passed to NES_ROM_CACHE::acquire, which copies it if it has to keep it
+};
+
+//The bytes of one ROM file, immutable and shared by every NES_ROM that loaded the same contents
+struct NES_ROM_IMAGE {
+	const uint8_t* contents;
+	size_t size;
+	uint8_t storage; //NES_ROM_STORAGE
+	uint64_t hash; //FNV-1a of contents
+	uint32_t users;
+};
+
+/*
+ * Process-wide cache of ROM images, keyed by content hash
+ * Instances of the same game share one image whether they loaded it from the same path, a copy of the file
+ * or a buffer, so per instance only RAM, VRAM, CHR RAM and PRG RAM are allocated. Loading hashes the whole
+ * file once, an image is freed when its last user releases it. Safe to use from several threads.
+ */
+class NES_ROM_CACHE {
+public:
+	static NES_ROM_IMAGE* acquire(const uint8_t* contents, size_t size, uint8_t storage); //takes ownership of mapped and heap contents
+	static void retain(NES_ROM_IMAGE* image); //one more user of an image already in the cache
+	static void release(NES_ROM_IMAGE* image);
+	static size_t count(); //images currently cached
+};
+
+/*
+ * An iNES / NES 2.0 image, mapped read-only into memory.
+ * prg_rom and chr_rom point into an image from NES_ROM_CACHE, shared with every other instance of the same game.
+ * The image is released by unloadRom or the destructor.
+ */
 class NES_ROM {
 public:
-	uint8_t* romContents; //TODO: Implement free function
-	std::streampos size;
-	uint8_t prg_banks;
-	uint8_t chr_banks;
+	char* path; //the file the image was loaded from, NULL for images loaded from memory
+	const uint8_t* romContents;
+	size_t size;
+	bool mapped; //false if romContents had to be read into the heap instead
+	uint64_t hash; //of the whole file, identifies the game
+
+	bool nes2; //NES 2.0 header
+	uint16_t mapper;
+	uint8_t submapper;
+	uint16_t prg_banks; //16KB units
+	uint16_t chr_banks; //8KB units, 0 means the cartridge has CHR RAM
+	uint32_t prg_size;
+	uint32_t chr_size;
 	uint8_t mirrortype; //0=horizontal, 1=vertical, 2=fourscreen
 	bool batteryRamPresent;
 	bool trainerPresent;
-	uint8_t ramBanks;
-	uint8_t* prg_rom;
-	uint8_t* chr_rom;
+	uint32_t ramBanks; //8KB units of PRG RAM, at most PRG_RAM_MAX_BANKS
+	const uint8_t* prg_rom;
+	const uint8_t* chr_rom; //NULL if the cartridge has CHR RAM
+
+	NES_ROM();
+	~NES_ROM();
 
-	bool loadRom(char* romPath);
+	bool loadRom(const char* romPath);
+	bool loadImage(const uint8_t* image, size_t size); //copies the image unless the cache already has it
+	bool loadShared(const NES_ROM& other); //the same image as other, without reading or hashing it again
+	void unloadRom();
 	void d_printRom();
 	void d_printPRG();
+
+private:
+	NES_ROM(const NES_ROM&);
+	NES_ROM& operator=(const NES_ROM&);
+
+	NES_ROM_IMAGE* image;
+
+	bool mapFile(const char* romPath);
+	void useImage(NES_ROM_IMAGE* image);
+	bool parseHeader();
 };
 
 
@@ -0,0 +1,114 @@
+#include "header.h"
+
+#include "NES.h"
+#include "NES_RUNAHEAD.h"
+
+NES_RUNAHEAD::NES_RUNAHEAD() {
+	frames = 0;
+	ahead = 0;
+	assumed[0] = 0;
+	assumed[1] = 0;
+	framesRun = 0;
+	rollbacks = 0;
+	states = NULL;
+	stateSize = 0;
+}
+
+NES_RUNAHEAD::~NES_RUNAHEAD() { close(); }
+
+bool NES_RUNAHEAD::open(NES& nes, uint32_t _frames) {
+	close();
+
+	frames = _frames;
+	assumed[0] = nes.buttons[0];
+	assumed[1] = nes.buttons[1];
+	framesRun = 0;
+	rollbacks = 0;
+	if(frames == 0) return true;
+
+	stateSize = nes.stateSize();
+	states = new uint8_t[(frames + 1) * stateSize];
+	if(!save(nes)) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void NES_RUNAHEAD::close() {
+	delete[] states;
+	states = NULL;
+	stateSize = 0;
+	ahead = 0;
+}
+
+uint32_t NES_RUNAHEAD::realFrame(const NES& nes) { return nes.frame - ahead; }
+
+uint8_t* NES_RUNAHEAD::slot(uint32_t frame) { return states + (frame % (frames + 1)) * stateSize; }
+
+bool NES_RUNAHEAD::save(NES& nes) { return nes.saveState(slot(nes.frame), stateSize) == stateSize; }
+
+NES_RUN_STATUS NES_RUNAHEAD::runFrame(NES& nes, uint8_t buttons1, uint8_t buttons2) {
+	if(states == NULL) {
+		nes.setButtons(0, buttons1);
+		nes.setButtons(1, buttons2);
+		return nes.runFrame();
+	}
+
+	NES_RUN_STATUS status;
+	status.cycles = 0;
+	status.reason = STOP_FRAME;
+	status.faultOpcode = 0;
+	status.faultPC = 0;
+
+	uint32_t real = realFrame(nes);
+	void* framebuffer = nes.ppu.framebuffer;
+	uint8_t format = nes.ppu.format;
+	bool muted = nes.apu.muted;
+
+	if(ahead > 0 && (buttons1 != assumed[0] || buttons2 != assumed[1])) {
+		//The frames ahead were run with the wrong input, the ones up to the real frame all still hold
+		nes.apu.setMuted(true);
+		if(!nes.loadState(slot(real), stateSize)) {
+			nes.apu.setMuted(muted);
+			status.reason = STOP_FAULT;
+			return status;
+		}
+		ahead = 0;
+		rollbacks++;
+	}
+
+	assumed[0] = buttons1;
+	assumed[1] = buttons2;
+	nes.setButtons(0, buttons1);
+	nes.setButtons(1, buttons2);
+
+	//Only the newest frame is shown and heard
+	uint32_t target = real + 1 + frames;
+	while(nes.frame < target) {
+		bool newest = nes.frame + 1 == target;
+		nes.ppu.setFramebuffer(newest ? framebuffer : NULL, format);
+		nes.apu.setMuted(newest ? muted : true);
+
+		NES_RUN_STATUS frameStatus = nes.runFrame();
+		frameStatus.cycles += status.cycles;
+		status = frameStatus;
+		framesRun++;
+
+		if(status.reason == STOP_FAULT || !save(nes)) break;
+	}
+
+	nes.ppu.setFramebuffer(framebuffer, format);
+	nes.apu.setMuted(muted);
+
+	ahead = nes.frame > real + 1 ? nes.frame - real - 1 : 0;
+	return status;
+}
+
+bool NES_RUNAHEAD::sync(NES& nes) {
+	if(states == NULL || ahead == 0) return true;
+
+	if(!nes.loadState(slot(realFrame(nes)), stateSize)) return false;
+	ahead = 0;
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef NES_RUNAHEAD_H_
+#define NES_RUNAHEAD_H_
+
+class NES;
+struct NES_RUN_STATUS;
+
+/*
+ * Run-ahead, to hide the frames of lag games have between reading input and showing its effect
+ * The NES is kept frames ahead of the real frame, as if the input of the last host frame were held all along.
+ * A save state is kept for each of those frames. While the input stays the same the speculation was right,
+ * so every host frame runs just one frame, at the cost of a state save. When the input changes the NES is
+ * rolled back to the real frame and frames + 1 are run with the new input, of which only the last is shown.
+ * Audio comes from the newest frame, so there is exactly one frame of it per host frame.
+ */
+class NES_RUNAHEAD {
+public:
+	uint32_t frames; //how far ahead, 0 runs every frame as it comes
+	uint32_t ahead; //frames the NES currently is past the real one
+	uint8_t assumed[2]; //the input the frames ahead were run with
+
+	uint64_t framesRun; //including the ones run again after a rollback
+	uint64_t rollbacks;
+
+	NES_RUNAHEAD();
+	~NES_RUNAHEAD();
+
+	bool open(NES& nes, uint32_t frames); //the NES as it is becomes the real frame, open again after every init or loadState
+	void close();
+
+	NES_RUN_STATUS runFrame(NES& nes, uint8_t buttons1, uint8_t buttons2); //one host frame, the framebuffer gets the frame ahead
+	bool sync(NES& nes); //rolls back to the real frame, e.g. before saving state
+
+	uint32_t realFrame(const NES& nes);
+
+private:
+	uint8_t* states; //one per frame, indexed by nes.frame modulo frames + 1
+	size_t stateSize;
+
+	uint8_t* slot(uint32_t frame);
+	bool save(NES& nes);
+
+	NES_RUNAHEAD(const NES_RUNAHEAD&);
+	NES_RUNAHEAD& operator=(const NES_RUNAHEAD&);
+};
+
+
+
+#endif /* NES_RUNAHEAD_H_ */
@@ -0,0 +1,287 @@
+#include "header.h"
+
+#include <string.h>
+#include <vector>
+
+#include "NES.h"
+#include "NES_SNAPSHOT.h"
+
+NES_SNAPSHOT::NES_SNAPSHOT() {
+	chunks = NULL;
+	chunkCount = 0;
+	size = 0;
+	refs = 1;
+	cycle = 0;
+	frame = 0;
+}
+
+NES_SNAPSHOT::~NES_SNAPSHOT() {
+	for(uint32_t i = 0; i < chunkCount; ++i) {
+		if(--chunks[i]->refs == 0) delete chunks[i];
+	}
+	delete[] chunks;
+}
+
+NES_SNAPSHOT* NES_SNAPSHOT::capture(NES& nes, NES_SNAPSHOT* previous) {
+	/*
+	 * Dirty chunks are found by comparing the new state against previous rather than by tracking writes,
+	 * which keeps the CPU's store path free of bookkeeping. The compare is over the mutable state only,
+	 * a few KB for most cartridges.
+	 */
+	size_t size = nes.stateSize();
+	uint8_t* state = new uint8_t[size];
+	if(nes.saveState(state, size) != size) {
+		delete[] state;
+		return NULL;
+	}
+
+	NES_SNAPSHOT* snapshot = new NES_SNAPSHOT();
+	snapshot->size = size;
+	snapshot->chunkCount = (size + SNAPSHOT_CHUNK_SIZE - 1) / SNAPSHOT_CHUNK_SIZE;
+	snapshot->chunks = new NES_SNAPSHOT_CHUNK*[snapshot->chunkCount];
+	snapshot->cycle = nes.cpu.cycles;
+	snapshot->frame = nes.frame;
+
+	if(previous != NULL && previous->size != size) previous = NULL; //different cartridge, nothing to share
+
+	for(uint32_t i = 0; i < snapshot->chunkCount; ++i) {
+		size_t offset = i * SNAPSHOT_CHUNK_SIZE;
+		size_t length = size - offset < SNAPSHOT_CHUNK_SIZE ? size - offset : SNAPSHOT_CHUNK_SIZE;
+
+		if(previous != NULL && memcmp(previous->chunks[i]->data, &state[offset], length) == 0) {
+			snapshot->chunks[i] = previous->chunks[i];
+			snapshot->chunks[i]->refs++;
+			continue;
+		}
+
+		NES_SNAPSHOT_CHUNK* chunk = new NES_SNAPSHOT_CHUNK();
+		chunk->refs = 1;
+		memcpy(chunk->data, &state[offset], length);
+		snapshot->chunks[i] = chunk;
+	}
+
+	delete[] state;
+	return snapshot;
+}
+
+bool NES_SNAPSHOT::restore(NES& nes) {
+	uint8_t* state = new uint8_t[size];
+
+	for(uint32_t i = 0; i < chunkCount; ++i) {
+		size_t offset = i * SNAPSHOT_CHUNK_SIZE;
+		size_t length = size - offset < SNAPSHOT_CHUNK_SIZE ? size - offset : SNAPSHOT_CHUNK_SIZE;
+		memcpy(&state[offset], chunks[i]->data, length);
+	}
+
+	bool loaded = nes.loadState(state, size);
+	delete[] state;
+	return loaded;
+}
+
+void NES_SNAPSHOT::retain() { refs++; }
+
+void NES_SNAPSHOT::release() { if(--refs == 0) delete this; }
+
+uint32_t NES_SNAPSHOT::sharedChunks(NES_SNAPSHOT* other) {
+	if(other == NULL || other->chunkCount != chunkCount) return 0;
+
+	uint32_t shared = 0;
+	for(uint32_t i = 0; i < chunkCount; ++i) {
+		if(chunks[i] == other->chunks[i]) shared++;
+	}
+	return shared;
+}
+
+NES_SNAPSHOT* NES_SNAPSHOT::fork(NES& parent, NES* children, uint32_t count) {
+	/*
+	 * Every child gets its own copy of the working state, which is small, and attaches to the parent's
+	 * cached ROM image, whether that came from a file or from memory. Snapshots the children take against the returned one share
+	 * whatever they did not change with it, and so with each other.
+	 */
+	NES_SNAPSHOT* snapshot = capture(parent, NULL);
+	if(snapshot == NULL) return NULL;
+
+	for(uint32_t i = 0; i < count; ++i) {
+		if(!children[i].init(parent.rom) || !snapshot->restore(children[i])) {
+			snapshot->release();
+			return NULL;
+		}
+	}
+
+	return snapshot;
+}
+
+//Where a console is, as far as selfCheck compares it
+struct NES_SNAPSHOT_POINT {
+	uint64_t cycle;
+	uint32_t frame;
+	uint32_t ram; //NES::ramHash
+
+	NES_SNAPSHOT_POINT(NES& nes) {
+		cycle = nes.cpu.cycles;
+		frame = nes.frame;
+		ram = nes.ramHash();
+	}
+
+	bool operator==(const NES_SNAPSHOT_POINT& other) const {
+		return cycle == other.cycle && frame == other.frame && ram == other.ram;
+	}
+};
+
+static bool checkPoint(FILE* out, const char* label, NES& nes, const NES_SNAPSHOT_POINT& expected) {
+	NES_SNAPSHOT_POINT actual(nes);
+	bool same = actual == expected;
+
+	fprintf(out, "%-24s frame %6u  cycle %12llu  ram %08x  %s\n", label, actual.frame, (unsigned long long) actual.cycle,
+			actual.ram, same ? "ok" : "MISMATCH");
+	if(!same) {
+		fprintf(out, "%-24s frame %6u  cycle %12llu  ram %08x\n", "  expected", expected.frame,
+				(unsigned long long) expected.cycle, expected.ram);
+	}
+	return same;
+}
+
+static bool runFrames(NES& nes, uint32_t frames, FILE* out) {
+	for(uint32_t i = 0; i < frames; ++i) {
+		NES_RUN_STATUS status = nes.runFrame();
+		if(status.reason == STOP_FAULT) {
+			fprintf(out, "ERROR: CPU jammed on opcode %02x at %04x in frame %u\n", status.faultOpcode, status.faultPC, nes.frame);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool NES_SNAPSHOT::selfCheck(NES& nes, uint32_t frames, FILE* out) {
+	if(frames < 2) frames = 2;
+	uint32_t steps = frames - frames / 2; //rewound and replayed
+
+	NES_REWIND rewind;
+	if(!rewind.open(frames + 1)) return false;
+
+	std::vector<NES_SNAPSHOT_POINT> points;
+	rewind.push(nes);
+	points.push_back(NES_SNAPSHOT_POINT(nes));
+
+	uint64_t shared = 0;
+	for(uint32_t i = 0; i < frames; ++i) {
+		if(!runFrames(nes, 1, out)) return false;
+		rewind.push(nes);
+		points.push_back(NES_SNAPSHOT_POINT(nes));
+		shared += rewind.get(0)->sharedChunks(rewind.get(1));
+	}
+	fprintf(out, "Captured %u frames, %u chunks each, %.1f shared with the frame before on average\n", frames,
+			rewind.get(0)->chunkCount, (double) shared / frames);
+
+	bool ok = true;
+	if(!rewind.rewind(nes, steps)) {
+		fprintf(out, "ERROR: Rewinding %u frames failed\n", steps);
+		return false;
+	}
+	ok &= checkPoint(out, "rewind", nes, points[frames - steps]);
+
+	if(!runFrames(nes, steps, out)) return false;
+	ok &= checkPoint(out, "replay", nes, points[frames]);
+
+	//Children are checked against where the parent gets to from the same snapshot
+	const uint32_t count = 4;
+	NES* children = new NES[count];
+	NES_SNAPSHOT* start = fork(nes, children, count);
+	if(start == NULL) {
+		fprintf(out, "ERROR: Forking %u children failed\n", count);
+		delete[] children;
+		return false;
+	}
+
+	if(!runFrames(nes, steps, out)) ok = false;
+	NES_SNAPSHOT_POINT parent(nes);
+
+	for(uint32_t i = 0; ok && i < count; ++i) {
+		if(children[i].rom.romContents != nes.rom.romContents) {
+			fprintf(out, "ERROR: Child %u does not share the parent's ROM image\n", i);
+			ok = false;
+			break;
+		}
+		if(!runFrames(children[i], steps, out)) {
+			ok = false;
+			break;
+		}
+
+		char label[32];
+		snprintf(label, sizeof(label), "fork %u", i);
+		ok &= checkPoint(out, label, children[i], parent);
+	}
+
+	start->release();
+	delete[] children;
+	return ok;
+}
+
+
+NES_REWIND::NES_REWIND() {
+	ring = NULL;
+	capacity = 0;
+	count = 0;
+	newest = 0;
+}
+
+NES_REWIND::~NES_REWIND() { close(); }
+
+bool NES_REWIND::open(uint32_t _capacity) {
+	close();
+
+	if(_capacity == 0) {
+		printf("ERROR: Rewind buffer needs room for at least one snapshot\n");
+		return false;
+	}
+
+	ring = new NES_SNAPSHOT*[_capacity]();
+	capacity = _capacity;
+	return true;
+}
+
+void NES_REWIND::close() {
+	for(uint32_t i = 0; i < count; ++i) get(i)->release();
+	delete[] ring;
+
+	ring = NULL;
+	capacity = 0;
+	count = 0;
+	newest = 0;
+}
+
+void NES_REWIND::push(NES& nes) {
+	NES_SNAPSHOT* snapshot = NES_SNAPSHOT::capture(nes, get(0));
+	if(snapshot == NULL) return;
+
+	push(snapshot);
+	snapshot->release(); //the ring holds the only reference now
+}
+
+void NES_REWIND::push(NES_SNAPSHOT* snapshot) {
+	if(capacity == 0) return;
+
+	newest = (newest + 1) % capacity;
+	if(count == capacity) ring[newest]->release(); //overwrites the oldest
+	else count++;
+
+	snapshot->retain();
+	ring[newest] = snapshot;
+}
+
+bool NES_REWIND::rewind(NES& nes, uint32_t steps) {
+	if(steps >= count) return false;
+
+	for(uint32_t i = 0; i < steps; ++i) {
+		ring[newest]->release();
+		newest = (newest + capacity - 1) % capacity;
+		count--;
+	}
+
+	return ring[newest]->restore(nes);
+}
+
+NES_SNAPSHOT* NES_REWIND::get(uint32_t steps) {
+	if(steps >= count) return NULL;
+	return ring[(newest + capacity - steps) % capacity];
+}
@@ -0,0 +1,84 @@
+#ifndef NES_SNAPSHOT_H_
+#define NES_SNAPSHOT_H_
+
+class NES;
+
+#define SNAPSHOT_CHUNK_SIZE 256
+
+struct NES_SNAPSHOT_CHUNK {
+	uint32_t refs; //snapshots holding this chunk
+	uint8_t data[SNAPSHOT_CHUNK_SIZE];
+};
+
+/*
+ * An immutable save state, split into chunks
+ * A snapshot taken against a previous one shares every chunk that has not changed since, so it only
+ * costs the chunks that were written in between. Snapshots are reference counted, as are their chunks,
+ * and can be restored into any NES running the same cartridge.
+ * Reference counts are not atomic, snapshots sharing chunks belong to one thread.
+ */
+class NES_SNAPSHOT {
+public:
+	NES_SNAPSHOT_CHUNK** chunks;
+	uint32_t chunkCount;
+	size_t size; //of the save state
+	uint32_t refs;
+
+	uint64_t cycle; //cpu.cycles when taken
+	uint32_t frame;
+
+	static NES_SNAPSHOT* capture(NES& nes, NES_SNAPSHOT* previous); //previous may be NULL
+	bool restore(NES& nes);
+
+	void retain();
+	void release(); //deletes the snapshot when the last reference is gone
+
+	uint32_t sharedChunks(NES_SNAPSHOT* other); //chunks both snapshots point at
+
+	static NES_SNAPSHOT* fork(NES& parent, NES* children, uint32_t count); //returns the snapshot all children start from, one reference for the caller
+
+	/*
+	 * Captures frames frames into a rewind ring, rewinds half of them and replays them, then forks the console
+	 * and runs parent and children on. Every rewound, replayed and forked console has to arrive at the cycle,
+	 * frame and RAM the parent recorded or reached. Runs without input, which keeps all of it deterministic.
+	 */
+	static bool selfCheck(NES& nes, uint32_t frames, FILE* out);
+
+private:
+	NES_SNAPSHOT();
+	~NES_SNAPSHOT();
+	NES_SNAPSHOT(const NES_SNAPSHOT&);
+	NES_SNAPSHOT& operator=(const NES_SNAPSHOT&);
+};
+
+/*
+ * Rewind buffer
+ * A ring of snapshots, each taken against the one before it. When full, the oldest is dropped.
+ */
+class NES_REWIND {
+public:
+	NES_SNAPSHOT** ring;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t newest; //index of the newest snapshot
+
+	NES_REWIND();
+	~NES_REWIND();
+
+	bool open(uint32_t capacity);
+	void close();
+
+	void push(NES& nes);
+	void push(NES_SNAPSHOT* snapshot); //adds a reference, e.g. the starting point of a fork
+	bool rewind(NES& nes, uint32_t steps); //restores the snapshot steps before the newest and drops everything after it
+
+	NES_SNAPSHOT* get(uint32_t steps); //steps before the newest, NULL if there is none
+
+private:
+	NES_REWIND(const NES_REWIND&);
+	NES_REWIND& operator=(const NES_REWIND&);
+};
+
+
+
+#endif /* NES_SNAPSHOT_H_ */
@@ -0,0 +1,78 @@
+#include "header.h"
+
+#include <string.h>
+
+#include "NES_STATE.h"
+
+NES_STATE::NES_STATE(uint8_t* _data, size_t _size, bool _loading) {
+	data = _data;
+	size = _size;
+	position = 0;
+	loading = _loading;
+	failed = false;
+}
+
+bool NES_STATE::reserve(size_t length) { //Advances position, false if there is nothing to copy from or to
+	if(failed) return false;
+
+	if(data == NULL && !loading) {
+		position += length;
+		return false;
+	}
+
+	if(position + length > size) {
+		failed = true;
+		return false;
+	}
+
+	position += length;
+	return true;
+}
+
+void NES_STATE::value(uint8_t& v) {
+	if(!reserve(1)) return;
+	if(loading) v = data[position - 1];
+	else data[position - 1] = v;
+}
+
+void NES_STATE::value(uint16_t& v) {
+	uint8_t low = v & 0xff;
+	uint8_t high = v >> 8;
+	value(low);
+	value(high);
+	if(loading) v = low | (high << 8);
+}
+
+void NES_STATE::value(uint32_t& v) {
+	uint16_t low = v & 0xffff;
+	uint16_t high = v >> 16;
+	value(low);
+	value(high);
+	if(loading) v = low | ((uint32_t) high << 16);
+}
+
+void NES_STATE::value(uint64_t& v) {
+	uint32_t low = v & 0xffffffff;
+	uint32_t high = v >> 32;
+	value(low);
+	value(high);
+	if(loading) v = low | ((uint64_t) high << 32);
+}
+
+void NES_STATE::value(bool& v) {
+	uint8_t byte = v ? 1 : 0;
+	value(byte);
+	if(loading) v = byte != 0;
+}
+
+void NES_STATE::value(int& v) {
+	uint32_t word = (uint32_t) v;
+	value(word);
+	if(loading) v = (int) word;
+}
+
+void NES_STATE::bytes(uint8_t* buffer, size_t length) {
+	if(!reserve(length)) return;
+	if(loading) memcpy(buffer, &data[position - length], length);
+	else memcpy(&data[position - length], buffer, length);
+}
@@ -0,0 +1,36 @@
+#ifndef NES_STATE_H_
+#define NES_STATE_H_
+
+#define NES_STATE_MAGIC 0x5353454e //"NESS"
+#define NES_STATE_VERSION 2
+
+/*
+ * Cursor over a save state blob
+ * Every component has a single serialize(NES_STATE&) that is used for saving and loading alike,
+ * so the two can never disagree about the layout. Values are stored little-endian, packed, in declaration order.
+ * A saving state without a buffer only counts the bytes that would be written.
+ */
+class NES_STATE {
+public:
+	uint8_t* data;
+	size_t size;
+	size_t position;
+	bool loading;
+	bool failed; //the blob was too short, or too small a buffer was given
+
+	NES_STATE(uint8_t* data, size_t size, bool loading);
+
+	void value(uint8_t& v);
+	void value(uint16_t& v);
+	void value(uint32_t& v);
+	void value(uint64_t& v);
+	void value(bool& v);
+	void value(int& v);
+	void bytes(uint8_t* buffer, size_t length);
+
+	bool reserve(size_t length);
+};
+
+
+
+#endif /* NES_STATE_H_ */
@@ -0,0 +1,78 @@
+#include "header.h"
+
+#include "NES_TRACE.h"
+
+NES_TRACE::NES_TRACE() {
+	records = NULL;
+	mask = 0;
+	count = 0;
+	flushed = 0;
+	file = NULL;
+}
+
+NES_TRACE::~NES_TRACE() { close(); }
+
+bool NES_TRACE::openRing(uint32_t capacity) {
+	close();
+
+	if(capacity == 0 || (capacity & (capacity - 1)) != 0) {
+		printf("ERROR: Trace capacity %u is not a power of two\n", capacity);
+		return false;
+	}
+
+	records = new NES_TRACE_RECORD[capacity]();
+	mask = capacity - 1;
+	return true;
+}
+
+bool NES_TRACE::openFile(const char* path, uint32_t bufferRecords) {
+	if(!openRing(bufferRecords)) return false;
+
+	file = fopen(path, "wb");
+	if(file == NULL) {
+		printf("ERROR: Trace file %s could not be opened\n", path);
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void NES_TRACE::flush() { //Writes all records not yet in the file, in order
+	if(file == NULL) return;
+
+	while(flushed != count) {
+		uint32_t start = flushed & mask;
+		uint32_t length = count - flushed;
+		if(start + length > mask + 1) length = mask + 1 - start; //wraps around, write up to the end of the buffer first
+
+		fwrite(&records[start], sizeof(NES_TRACE_RECORD), length, file);
+		flushed += length;
+	}
+}
+
+void NES_TRACE::close() {
+	if(file != NULL) {
+		flush();
+		fclose(file);
+		file = NULL;
+	}
+
+	delete[] records;
+	records = NULL;
+	mask = 0;
+	count = 0;
+	flushed = 0;
+}
+
+void NES_TRACE::d_printRing() {
+	if(records == NULL) return;
+
+	uint32_t available = count > mask + 1 ? mask + 1 : count;
+	printf("Dumping the last %u traced instructions: \n", available);
+	for(uint32_t i = count - available; i != count; ++i) {
+		NES_TRACE_RECORD& r = records[i & mask];
+		printf("%8u %04x  %02x %02x %02x  A:%02x X:%02x Y:%02x P:%02x SP:%02x  %i cycles\n",
+				r.index, r.PC, r.opcode, r.operand1, r.operand2, r.A, r.X, r.Y, r.P, r.SP, r.cycles);
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef NES_TRACE_H_
+#define NES_TRACE_H_
+
+/*
+ * One executed instruction, CPU state is taken before the instruction runs.
+ * Fixed size so that traces can be written and read back as raw arrays.
+ */
+struct NES_TRACE_RECORD {
+	uint16_t PC;
+	uint8_t opcode;
+	uint8_t operand1;
+	uint8_t operand2;
+	uint8_t A;
+	uint8_t X;
+	uint8_t Y;
+	uint8_t P;
+	uint8_t SP;
+	uint8_t cycles; //filled in once the instruction has finished
+	uint8_t padding;
+	uint32_t index; //running instruction number since the trace was opened
+};
+
+/*
+ * Binary instruction trace sink
+ * Records go into a ring buffer of a power-of-two size. In ring mode the oldest records are overwritten,
+ * in file mode the buffer is written out with one fwrite whenever it fills up.
+ */
+class NES_TRACE {
+public:
+	NES_TRACE_RECORD* records;
+	uint32_t mask; //capacity - 1
+	uint32_t count; //records written since the trace was opened
+	uint32_t flushed; //records already written to file
+	FILE* file;
+
+	NES_TRACE();
+	~NES_TRACE();
+
+	bool openRing(uint32_t capacity);
+	bool openFile(const char* path, uint32_t bufferRecords);
+	void flush();
+	void close();
+
+	inline NES_TRACE_RECORD* next() {
+		if(file != NULL && count - flushed > mask) flush();
+		NES_TRACE_RECORD* record = &records[count & mask];
+		record->index = count++;
+		return record;
+	}
+
+	void d_printRing();
+};
+
+
+
+#endif /* NES_TRACE_H_ */
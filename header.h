@@ -4,3 +4,29 @@
 #include <fstream>
 
 #define KB16 16384
+#define CACHE_LINE_SIZE 64
+
+//Formatted per-instruction logging, build with -DCPU_DEBUG=1 to enable
+#ifndef CPU_DEBUG
+#define CPU_DEBUG 0
+#endif
+
+//Binary trace sink support (see NES_TRACE.h), build with -DCPU_TRACE=0 to remove it from the hot path entirely
+#ifndef CPU_TRACE
+#define CPU_TRACE 1
+#endif
+
+//Per-opcode and per-PC profiling support (see NES_PROFILE.h), build with -DCPU_PROFILE=0 to remove it from the hot path entirely
+#ifndef CPU_PROFILE
+#define CPU_PROFILE 1
+#endif
+
+//Pre-decoded basic blocks in NES_CPU::runUntil (see NES_BLOCK.h), build with -DCPU_BLOCKS=0 to decode every instruction in runOp
+#ifndef CPU_BLOCKS
+#define CPU_BLOCKS 1
+#endif
+
+//Computed-goto dispatch in NES_CPU::runUntil in place of the block cache, GCC/Clang only, build with -DCPU_THREADED=1 to enable
+#ifndef CPU_THREADED
+#define CPU_THREADED 0
+#endif
@@ -8,6 +8,8 @@ void setBit(uint8_t* byte, uint8_t bitpos, bool toSet);
 
 uint16_t combineLowHigh(uint8_t low, uint8_t high);
 
+inline uint8_t isPageCrossed(uint16_t from, uint16_t to) { return ((from ^ to) & 0xff00) != 0; }
+
 
 
 #endif /* HELPER_H_ */
@@ -1,16 +1,147 @@
 #include "header.h"
 #include "NES.h"
+#include "NES_BATCH.h"
+#include "NES_BENCH.h"
+#include "NES_JIT.h"
+#include "NES_LOCKSTEP.h"
+#include "NES_MOVIE.h"
+#include "NES_NESTEST.h"
+#include "NES_PROFILE.h"
+#include "NES_RUNAHEAD.h"
+#include "NES_SNAPSHOT.h"
+#include <stdlib.h>
+#include <string.h>
 
 
 int main(int argc, char* args[]) {
 
 	NES emu;
+	NES_TRACE trace;
+	NES_JIT jit;
+	NES_PROFILE profile;
+	NES_MOVIE movie;
+	bool replay = false;
+	uint32_t fastForward = 0; //frames of the movie to run without output first
+	NES_RUNAHEAD runAhead;
+	uint32_t runAheadFrames = 0;
+	const char* foldedPath = NULL;
+	uint32_t frames = 0; //0 runs until the CPU jams
 
-	emu.init(args[1]);
+	if(argc < 2) {
+		printf("Usage: %s <rom> [--frames <n>] [--trace <file>] [--jit | --jit-verify] [--profile] [--profile-folded <file>]\n"
+				"       %*s [--movie <file> | --fm2 <file>] [--fast-forward <frame>] [--run-ahead <n>]\n", args[0], (int) strlen(args[0]), "");
+		printf("       %s --batch <job list> [threads]\n", args[0]);
+		printf("       %s --nestest <nestest.nes> <golden log>\n", args[0]);
+		printf("       %s --bench [<json file>|-]\n", args[0]);
+		printf("       %s --snapshot-check <rom> [frames]\n", args[0]);
+		printf("       %s --lockstep <rom> <lanes> [frames]\n", args[0]);
+		return 1;
+	}
 
-	while(emu.run()){}
+	if(strcmp(args[1], "--batch") == 0) {
+		NES_BATCH batch;
+		if(argc < 3 || !batch.loadJobs(args[2])) return 1;
+
+		batch.run(argc > 3 ? atoi(args[3]) : 0);
+		batch.printResults(stdout);
+		return 0;
+	}
+
+	if(strcmp(args[1], "--nestest") == 0) {
+		NES_NESTEST nestest;
+		if(argc < 4 || !nestest.loadLog(args[3])) return 1;
+
+		return nestest.run(args[2], stdout) ? 0 : 1;
+	}
+
+	if(strcmp(args[1], "--bench") == 0) {
+		NES_BENCH bench;
+		bench.runAll();
+		bench.printTable(argc > 2 && strcmp(args[2], "-") == 0 ? stderr : stdout); //stdout only carries the JSON then
+
+		if(argc > 2 && !bench.writeJson(args[2])) return 1;
+		return 0;
+	}
+
+	if(strcmp(args[1], "--snapshot-check") == 0) {
+		if(argc < 3 || !emu.init(args[2])) return 1;
+
+		return NES_SNAPSHOT::selfCheck(emu, argc > 3 ? strtoul(args[3], NULL, 10) : 120, stdout) ? 0 : 1;
+	}
+
+	if(strcmp(args[1], "--lockstep") == 0) {
+		if(argc < 4 || !emu.init(args[2])) return 1;
+
+		return NES_LOCKSTEP::selfCheck(emu.rom, strtoul(args[3], NULL, 10), argc > 4 ? strtoul(args[4], NULL, 10) : 120, stdout) ? 0 : 1;
+	}
+
+	if(!emu.init(args[1])) return 1;
+
+	for(int i = 2; i < argc; ++i) {
+		if(strcmp(args[i], "--trace") == 0 && i + 1 < argc) {
+			if(!trace.openFile(args[++i], 4096)) return 1;
+			emu.cpu.trace = &trace;
+		} else if(strcmp(args[i], "--jit") == 0 || strcmp(args[i], "--jit-verify") == 0) {
+			if(!jit.init(strcmp(args[i], "--jit-verify") == 0)) return 1;
+			emu.cpu.jit = &jit;
+		} else if(strcmp(args[i], "--frames") == 0 && i + 1 < argc) {
+			frames = strtoul(args[++i], NULL, 10);
+		} else if(strcmp(args[i], "--profile") == 0) {
+			emu.cpu.profile = &profile;
+		} else if(strcmp(args[i], "--profile-folded") == 0 && i + 1 < argc) {
+			foldedPath = args[++i];
+			emu.cpu.profile = &profile;
+		} else if(strcmp(args[i], "--movie") == 0 && i + 1 < argc) {
+			if(!movie.load(args[++i])) return 1;
+			replay = true;
+		} else if(strcmp(args[i], "--fm2") == 0 && i + 1 < argc) {
+			if(!movie.importFM2(args[++i])) return 1;
+			replay = true;
+		} else if(strcmp(args[i], "--fast-forward") == 0 && i + 1 < argc) {
+			fastForward = strtoul(args[++i], NULL, 10);
+		} else if(strcmp(args[i], "--run-ahead") == 0 && i + 1 < argc) {
+			runAheadFrames = strtoul(args[++i], NULL, 10);
+		} else {
+			printf("Unknown option %s\n", args[i]);
+			return 1;
+		}
+	}
+
+	if(replay) {
+		movie.matches(emu);
+		if(frames == 0) frames = movie.frames.size(); //a replay ends with its movie
+		if(fastForward > frames) fastForward = frames;
+
+		bool running = movie.fastForward(emu, fastForward).reason != STOP_FAULT;
+		if(!runAhead.open(emu, runAheadFrames)) return 1;
+
+		while(running && runAhead.realFrame(emu) < frames) {
+			NES_MOVIE_FRAME input = movie.input(runAhead.realFrame(emu));
+			running = runAhead.runFrame(emu, input.buttons[0], input.buttons[1]).reason != STOP_FAULT;
+		}
+		if(!runAhead.sync(emu)) return 1;
+
+		if(runAheadFrames != 0) {
+			printf("Run-ahead: %llu frames run, %llu rollbacks\n", (unsigned long long) runAhead.framesRun,
+					(unsigned long long) runAhead.rollbacks);
+		}
+
+		printf("Movie: %u frames, %llu cycles, RAM %08x\n", emu.frame, (unsigned long long) emu.cpu.cycles, emu.ramHash());
+	} else {
+		if(runAheadFrames != 0) printf("WARNING: --run-ahead only applies to movies\n");
+		while(emu.runFrame().reason != STOP_FAULT && (frames == 0 || emu.frame < frames)){}
+	}
+
+	if(emu.cpu.jit != NULL) {
+		printf("JIT: %llu blocks compiled, %llu native runs, %llu mismatches\n", (unsigned long long) jit.compiled,
+				(unsigned long long) jit.nativeRuns, (unsigned long long) jit.mismatches);
+	}
+
+	if(emu.cpu.profile != NULL) {
+		profile.printReport(stdout, 20);
+		if(foldedPath != NULL && !profile.writeFolded(foldedPath)) return 1;
+	}
 
 	//emu.cpu.d_printMemFromPC();
 
 }
-